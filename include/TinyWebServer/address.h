@@ -57,6 +57,11 @@ namespace WebSrv
          * @return std::shared_ptr<IPAddress>
          */
         static std::shared_ptr<IPAddress> lookupAnyIPAddress(const std::string &host, int family = AF_INET, int type = 0, int protocol = 0);
+        /**
+         * @brief 清空lookup的解析缓存(缓存时间由配置address.lookup_cache_ttl指定)
+         *
+         */
+        static void clearLookupCache();
 
         /**
          * @brief 返回本机所有网卡的<网卡名，<地址，子网掩码位数>>
@@ -1,20 +1,21 @@
 #pragma once
 
-#include <vector>
-#include <memory>
-#include "mutex.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "noncopyable.h"
 namespace WebSrv
 {
     /**
      * @brief 管理文件句柄上下文类
+     * 存放在FdManager的固定槽位中，不会移动也不会释放，句柄关闭后槽位被同一句柄号复用，
+     * 持有指针跨越挂起时用getGeneration()判断是否还是原来的句柄
      *
      */
-    class FdCtx : public std::enable_shared_from_this<FdCtx>
+    class FdCtx : NonCopyable
     {
     public:
-        using ptr = std::shared_ptr<FdCtx>;
-
-        FdCtx(int fd);
+        FdCtx() = default;
 
         ~FdCtx()=default;
         /**
@@ -30,28 +31,28 @@ namespace WebSrv
          * @return true
          * @return false
          */
-        bool isSocket() { return _isSocket; }
+        bool isSocket() const { return _isSocket; }
         /**
          * @brief 是否是关闭的
          *
          * @return true
          * @return false
          */
-        bool isClose() { return _isClosed; }
+        bool isClose() const { return _isClosed; }
         /**
          * @brief 是否是系统的阻塞
          *
          * @return true
          * @return false
          */
-        bool getSysNonblock() { return _sysNonblock; }
+        bool getSysNonblock() const { return _sysNonblock; }
         /**
          * @brief 是否是用户设置的非阻塞
          *
          * @return true
          * @return false
          */
-        bool getUserNonblock() { return _userNonblock; }
+        bool getUserNonblock() const { return _userNonblock; }
         /**
          * @brief 设置系统的非阻塞
          *
@@ -77,24 +78,55 @@ namespace WebSrv
          *
          * @param so_timeout SO_RCVTIMEO/SO_SNDTIMEO
          */
-        uint64_t getTimeout(int so_timeout);
+        uint64_t getTimeout(int so_timeout) const;
+        /**
+         * @brief 代数，句柄每次关闭时加1
+         *
+         */
+        uint32_t getGeneration() const { return _generation.load(std::memory_order_acquire); }
+        /**
+         * @brief 是否还是代数为generation时的句柄且没有关闭
+         *
+         * @param generation 之前取得的代数
+         */
+        bool isAlive(uint32_t generation) const { return getGeneration() == generation && !_isClosed; }
     private:
-        void init();
+        friend class FdManager;
+        /**
+         * @brief 槽位状态
+         *
+         */
+        enum State
+        {
+            EMPTY,
+            INITIALIZING,
+            ACTIVE,
+        };
+        /**
+         * @brief 初始化
+         *
+         * @param fd
+         * @param nonblockSocket 已知是非阻塞socket(如accept4(SOCK_NONBLOCK)的结果)，不需要fstat/fcntl
+         */
+        void init(int fd, bool nonblockSocket = false);
     private:
-        bool _isInit = false;
-        bool _isSocket = false;
-        bool _sysNonblock = false;
-        bool _userNonblock = false;
-        bool _isClosed = false;
+        std::atomic<bool> _isInit = false;
+        std::atomic<bool> _isSocket = false;
+        std::atomic<bool> _sysNonblock = false;
+        std::atomic<bool> _userNonblock = false;
+        std::atomic<bool> _isClosed = false;
         // 文件句柄
-        int _fd;
+        int _fd = -1;
         // 读超时
-        int64_t _recvTimeout=-1;
+        std::atomic<uint64_t> _recvTimeout = ~0ull;
         // 写超时
-        int64_t _sendTimeout=-1;
+        std::atomic<uint64_t> _sendTimeout = ~0ull;
+        std::atomic<int> _state = EMPTY;
+        std::atomic<uint32_t> _generation = 0;
     };
     /**
      * @brief 句柄类管理
+     * 两级表：页只分配不移动也不释放，查找只需一次原子加载，不加锁也不增加引用计数
      * 
      */
     class FdManager{
@@ -104,9 +136,16 @@ namespace WebSrv
          * 
          * @param fd 
          * @param autoCreate 是否自动创建
-         * @return FdCtx::ptr 
+         * @return FdCtx* 不存在(或fd超出范围)返回空，槽位一直有效
+         */
+        FdCtx *get(int fd,bool autoCreate=false);
+        /**
+         * @brief 创建已知为非阻塞socket的句柄上下文(accept4(SOCK_NONBLOCK)得到的)，省去fstat和fcntl
+         *
+         * @param fd
+         * @return FdCtx* fd超出范围返回空
          */
-        FdCtx::ptr get(int fd,bool autoCreate=false);
+        FdCtx *addSocket(int fd);
         /**
          * @brief 删除文件句柄
          * 
@@ -121,8 +160,25 @@ namespace WebSrv
         static FdManager* getFdManger();
     private:
         FdManager();
+        ~FdManager();
+        /**
+         * @brief 句柄所在的槽位
+         *
+         * @param fd
+         * @param alloc 所在页不存在时是否分配
+         * @return FdCtx*
+         */
+        FdCtx *getSlot(int fd, bool alloc);
+        /**
+         * @brief 获取/创建句柄上下文
+         *
+         * @param nonblockSocket 创建时是否已知为非阻塞socket
+         */
+        FdCtx *get(int fd, bool autoCreate, bool nonblockSocket);
     private:
-        RWMutex _mutex;
-        std::vector<FdCtx::ptr> _fds;
+        /// @brief 每页大小和页数(支持的最大句柄数为两者乘积)
+        static constexpr std::size_t FD_PAGE_SIZE = 256;
+        static constexpr std::size_t FD_PAGE_COUNT = 4096;
+        std::atomic<FdCtx *> _pages[FD_PAGE_COUNT] = {};
     };
 } // namespace WebSrv
@@ -1,12 +1,14 @@
 #pragma once
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include <thread>
+#include <vector>
+#include "fibercontext.h"
 namespace WebSrv
 {
     class Scheduler;
     /**
-     * @brief 协程类，每根协程一个栈
+     * @brief 协程类，每根协程一个栈，或运行在线程共享栈上(挂起时只保存已使用的栈)
      */
     class Fiber : public std::enable_shared_from_this<Fiber>
     {
@@ -26,6 +28,8 @@ namespace WebSrv
             DONE,
             //异常
             EXCEPT,
+            //已回收到协程池
+            POOLED,
         };
     private:
         //每个线程第一个协程，主协程（切换子协程任务）
@@ -37,10 +41,22 @@ namespace WebSrv
          * @param cb 协程执行函数
          * @param stacksize 协程栈大小
          * @param use_caller 是否在MainFiber上调度
+         * @param shared_stack 是否运行在线程共享栈上，第一次运行后只能在该线程恢复
          */
-        Fiber(std::function<void()> cb, size_t stacksize = 0,bool use_caller=false);
+        Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
     
         ~Fiber();
+        /**
+         * @brief 创建协程，优先复用当前线程协程池中已结束的协程(连同其栈)，
+         * 返回的协程释放时若已结束则回收到协程池，use_caller或非默认栈大小的协程不参与复用
+         *
+         * @param cb 协程执行函数
+         * @param stacksize 协程栈大小
+         * @param use_caller 是否在MainFiber上调度
+         * @param shared_stack 是否运行在线程共享栈上(不参与复用)
+         * @return Fiber::ptr
+         */
+        static Fiber::ptr create(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
         /**
          * @brief 重置协程，将协程设为INIT,作用于已结束（DONE,EXCEPT）或未开始（INIT）
          * 
@@ -79,6 +95,31 @@ namespace WebSrv
          * @return uint64_t 
          */
         uint64_t getState() const {return _state;}
+        /**
+         * @brief 是否运行在共享栈上
+         *
+         * @return true
+         * @return false
+         */
+        bool isSharedStack() const { return _sharedStack; }
+        /**
+         * @brief 共享栈协程绑定的线程(第一次运行的线程)，未绑定或私有栈协程返回空id
+         *
+         * @return std::thread::id
+         */
+        std::thread::id getSharedThread() const { return _sharedThread; }
+        /**
+         * @brief 绑定的线程，空id为不绑定
+         *
+         * @return std::thread::id
+         */
+        std::thread::id getBoundThread() const { return _boundThread; }
+        /**
+         * @brief 绑定到线程：之后协程被唤醒(事件、定时器、让出)时调度器都把它放回该线程执行，重置协程时解除
+         *
+         * @param threadid
+         */
+        void setBoundThread(std::thread::id threadid) { _boundThread = threadid; }
     public:
         /**
          * @brief Set the This current thread running fiber
@@ -108,6 +149,30 @@ namespace WebSrv
          * @return uint64_t 
          */
         static uint64_t totalFibers();
+        /**
+         * @brief 所有线程协程池中缓存的协程数量(不计入totalFibers)
+         *
+         * @return uint64_t
+         */
+        static uint64_t pooledFibers();
+        /**
+         * @brief 协程栈池命中次数(复用缓存栈)
+         *
+         * @return uint64_t
+         */
+        static uint64_t stackPoolHits();
+        /**
+         * @brief 协程栈池未命中次数(新映射栈)
+         *
+         * @return uint64_t
+         */
+        static uint64_t stackPoolMisses();
+        /**
+         * @brief 所有线程栈池中缓存的栈数量
+         *
+         * @return uint64_t
+         */
+        static uint64_t cachedStacks();
         /**
          * @brief 协程执行函数，执行完成后到线程主协程
          * 
@@ -124,19 +189,39 @@ namespace WebSrv
          * @return uint64_t 
          */
         static uint64_t getFiberId();
+    private:
+        /**
+         * @brief Fiber::create返回的协程的删除器，已结束的协程放回协程池
+         *
+         * @param fiber
+         */
+        static void recycle(Fiber *fiber);
+        /**
+         * @brief 切入共享栈协程前(在主协程栈上)保存占用共享栈的协程并恢复本协程的栈
+         *
+         */
+        void switchInShared();
     private:
         /// @brief 协程id
         uint64_t _id=0;
         /// @brief 协程状态
         State _state=INIT;
         /// @brief 协程上下文
-        ucontext_t _ctx;
+        FiberContext _ctx;
         /// @brief 运行栈指针
         void* _stack = nullptr;
         /// @brief 运行栈大小
         uint32_t _stacksize=0;
         /// @brief 协程运行函数
         std::function<void()> _cb;
+        /// @brief 是否运行在共享栈上
+        bool _sharedStack = false;
+        /// @brief 共享栈协程绑定的线程
+        std::thread::id _sharedThread;
+        /// @brief 共享栈协程挂起时保存的栈内容
+        std::vector<char> _saved;
+        /// @brief 绑定的线程
+        std::thread::id _boundThread;
     };
 
 } // namespace WebSrv
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+
+// 协程上下文切换后端
+// 默认在x86-64/aarch64上使用手写汇编只保存被调用者保存寄存器(不会像swapcontext那样调用rt_sigprocmask)，
+// 构建时定义 WEBSRV_FIBER_USE_UCONTEXT 可回退到ucontext，其他架构自动回退
+#if !defined(WEBSRV_FIBER_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define WEBSRV_FIBER_USE_UCONTEXT
+#endif
+
+#ifdef WEBSRV_FIBER_USE_UCONTEXT
+#include <ucontext.h>
+#else
+extern "C" void websrv_swap_context(void **fromSp, void *toSp);
+#endif
+
+namespace WebSrv
+{
+    /**
+     * @brief 协程上下文
+     *
+     */
+    struct FiberContext
+    {
+#ifdef WEBSRV_FIBER_USE_UCONTEXT
+        ucontext_t ctx;
+#else
+        /// @brief 切出时的栈指针(寄存器保存在协程自己的栈上)
+        void *sp = nullptr;
+#endif
+    };
+
+    /**
+     * @brief 初始化线程主协程上下文
+     *
+     * @param ctx
+     */
+    void initMainFiberContext(FiberContext *ctx);
+
+    /**
+     * @brief 在指定栈上构建协程上下文，第一次切入时执行func(func不能返回)
+     *
+     * @param ctx
+     * @param stack 栈起始地址(低地址)
+     * @param size 栈大小
+     * @param func 执行函数
+     */
+    void makeFiberContext(FiberContext *ctx, void *stack, size_t size, void (*func)());
+
+    /**
+     * @brief 保存当前上下文到from，切换到to
+     *
+     * @param from
+     * @param to
+     */
+    inline void swapFiberContext(FiberContext *from, FiberContext *to)
+    {
+#ifdef WEBSRV_FIBER_USE_UCONTEXT
+        swapcontext(&from->ctx, &to->ctx);
+#else
+        websrv_swap_context(&from->sp, to->sp);
+#endif
+    }
+
+    /**
+     * @brief 切出时记录的栈指针，共享栈只需保存[栈指针, 栈顶)
+     *
+     * @param ctx
+     * @return void* 无法取得时返回nullptr
+     */
+    void *fiberContextStackPointer(const FiberContext *ctx);
+
+    /**
+     * @brief 当前使用的上下文切换后端名
+     *
+     * @return const char*
+     */
+    const char *fiberContextBackend();
+
+} // namespace WebSrv
@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <sys/socket.h>
+#include <sys/types.h>
+#include <fcntl.h>
 //对系统函数的重新封装，当时设置为hook状态时，将切换到自己封装的函数
 namespace WebSrv
 {
@@ -39,6 +41,9 @@ namespace WebSrv
     typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
     extern accept_fun accept_f;
 
+    typedef int (*accept4_fun)(int s, struct sockaddr *addr, socklen_t *addrlen, int flags);
+    extern accept4_fun accept4_f;
+
     // read
     typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
     extern read_fun read_f;
@@ -71,6 +76,32 @@ namespace WebSrv
     typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
     extern sendmsg_fun sendmsg_f;
 
+    // 零拷贝
+    typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+    extern sendfile_fun sendfile_f;
+
+    typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+    extern splice_fun splice_f;
+
+    typedef ssize_t (*tee_fun)(int fd_in, int fd_out, size_t len, unsigned int flags);
+    extern tee_fun tee_f;
+
+    typedef ssize_t (*copy_file_range_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+    extern copy_file_range_fun copy_file_range_f;
+
+    // 文件io和域名解析，在调度器协程中交给阻塞任务线程池(OffloadPool)执行
+    typedef int (*open_fun)(const char *pathname, int flags, ...);
+    extern open_fun open_f;
+
+    typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+    extern pread_fun pread_f;
+
+    typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+    extern pwrite_fun pwrite_f;
+
+    typedef int (*getaddrinfo_fun)(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+    extern getaddrinfo_fun getaddrinfo_f;
+
     //句柄设置
 
     typedef int (*close_fun)(int fd);
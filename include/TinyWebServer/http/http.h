@@ -4,6 +4,8 @@
 #include <ostream>
 #include <memory>
 #include <optional>
+#include <string_view>
+#include <vector>
 #include "util.h"
 namespace WebSrv::http
 {
@@ -150,6 +152,13 @@ namespace WebSrv::http
 	 * @return HttpMethod
 	 */
 	HttpMethod HttpMethodFromChars(const char *method);
+	/**
+	 * @brief 将std::string_view 类型转换成HttpMethod(不要求'\0'结尾)
+	 *
+	 * @param method
+	 * @return HttpMethod
+	 */
+	HttpMethod HttpMethodFromView(std::string_view method);
 
 	/**
 	 * @brief 将HttpMethod 类型转成字符串
@@ -239,7 +248,63 @@ namespace WebSrv::http
 		}
 	}
 
+	/**
+	 * @brief 解析器记录的头部：名称和值是指向接收缓冲区的视图，不复制，
+	 * 同时持有缓冲区，保证视图在报文结构体的生命期内有效
+	 *
+	 */
+	class HeaderViews
+	{
+	public:
+		using View = std::pair<std::string_view, std::string_view>;
+		/**
+		 * @brief 添加一个头部(视图指向的内存需在setBuffer的缓冲区内，或由调用者保证有效)
+		 *
+		 * @param key
+		 * @param value
+		 */
+		void add(std::string_view key, std::string_view value) { _views.emplace_back(key, value); }
+		/**
+		 * @brief 持有视图所在的缓冲区
+		 *
+		 * @param buffer
+		 */
+		void setBuffer(std::shared_ptr<const char> buffer) { _buffer = std::move(buffer); }
+		/**
+		 * @brief 查找头部(不区分大小写)，重复时返回最后一个，与Map覆盖的语义一致
+		 *
+		 * @param key
+		 * @return const std::string_view* 不存在返回nullptr
+		 */
+		const std::string_view *find(std::string_view key) const;
+		bool empty() const { return _views.empty(); }
+		const std::vector<View> &views() const { return _views; }
+		/**
+		 * @brief 复制到map中并清空视图(修改头部前调用)，缓冲区继续持有，之前取得的视图仍然有效
+		 *
+		 * @tparam MapType
+		 * @param map
+		 */
+		template <class MapType>
+		void moveTo(MapType &map)
+		{
+			for (auto &[key, value] : _views)
+			{
+				map[std::string(key)] = std::string(value);
+			}
+			clear();
+		}
+		void clear() { _views.clear(); }
+
+	private:
+		/// @brief 头部视图(按报文中的顺序)
+		std::vector<View> _views;
+		/// @brief 视图所在的缓冲区
+		std::shared_ptr<const char> _buffer;
+	};
+
 	class HttpResponse;
+	class HttpBodyReader;
 
 	/**
 	 * @brief http请求报文结构体
@@ -262,12 +327,24 @@ namespace WebSrv::http
 		const std::string &getPath() const { return _path; }
 		// 获取请求fragment
 		const std::string &getFragment() const { return _fragment; }
+		// 获取原始查询串(未解码)
+		const std::string &getQuery() const { return _query; }
 		// 获取请求消息体
 		const std::string &getBody() const { return _body; }
-		// 获取请求头部Map
-		const Map &getHeaders() const { return _headers; }
-		// 获取请求参数Map
-		const Map &getParams() const { return _params; }
+		// 获取请求头部Map(解析得到的头部视图会先复制进来，首次调用会修改内部状态，不能在多个线程同时调用)
+		const Map &getHeaders() const
+		{
+			materializeHeaders();
+			return _headers;
+		}
+		// 获取解析得到的头部视图(修改过头部后为空)
+		const HeaderViews &getHeaderViews() const { return _headerViews; }
+		// 获取请求参数Map(首次访问时解析查询串)
+		const Map &getParams() const
+		{
+			initParams();
+			return _params;
+		}
 		// 获取请求cookie Map
 		const Map &getCookies() const { return _cookies; }
 		// 设置http 方法
@@ -278,14 +355,33 @@ namespace WebSrv::http
 		void setPath(const std::string &path) { _path = path; }
 		// 设置请求fragment
 		void setFragment(const std::string &fragment) { _fragment = fragment; }
+		// 设置原始查询串(未解码)，参数在首次访问时才解析
+		void setQuery(std::string query)
+		{
+			_query = std::move(query);
+			_parserParamStatus &= ~PARAM_QUERY_PARSED;
+		}
 		// 设置请求头部Map
-		void setHeaders(const Map &headers) { _headers = headers; }
-		// 设置请求参数Map
-		void setParams(const Map &params) { _params = params; }
+		void setHeaders(const Map &headers)
+		{
+			_headerViews.clear();
+			_headers = headers;
+		}
+		// 设置请求参数Map(替换查询串中的参数)
+		void setParams(const Map &params)
+		{
+			_params = params;
+			_parserParamStatus |= PARAM_QUERY_PARSED;
+		}
 		// 设置请求cookie Map
 		void setCookies(const Map &cookies) { _cookies = cookies; }
 		// 设置请求消息体
 		void setBody(const std::string &body) { _body = body; }
+		void setBody(std::string &&body) { _body = std::move(body); }
+		// 获取请求消息体读取器，没有消息体或消息体已整体读入body(见http.request.buffer_body_size)时为空
+		const std::shared_ptr<HttpBodyReader> &getBodyReader() const { return _bodyReader; }
+		// 设置请求消息体读取器
+		void setBodyReader(std::shared_ptr<HttpBodyReader> reader) { _bodyReader = std::move(reader); }
 		/**
 		 * @brief 获取HTTP请求的头部参数(不包含cookie)
 		 *
@@ -294,6 +390,26 @@ namespace WebSrv::http
 		 * @return std::string 存在返回对应值，否则为默认值
 		 */
 		std::string getHeader(const std::string &key, const std::string &def = "") const;
+		/**
+		 * @brief 获取HTTP请求的头部参数，不复制(视图在请求结构体和头部未修改前有效)
+		 *
+		 * @param key 键
+		 * @return std::string_view 不存在返回空
+		 */
+		std::string_view getHeaderView(const std::string &key) const;
+		/**
+		 * @brief 添加解析得到的头部视图(由解析器调用)
+		 *
+		 * @param key
+		 * @param value
+		 */
+		void addHeaderView(std::string_view key, std::string_view value) { _headerViews.add(key, value); }
+		/**
+		 * @brief 持有头部视图所在的接收缓冲区
+		 *
+		 * @param buffer
+		 */
+		void setHeaderBuffer(std::shared_ptr<const char> buffer) { _headerViews.setBuffer(std::move(buffer)); }
 
 		/**
 		 * @brief 获取HTTP请求的请求参数
@@ -395,7 +511,9 @@ namespace WebSrv::http
 		template <typename T>
 		T getHeaderAs(const std::string &key, const T &def = T())
 		{
-			return getAs(_headers, key, def);
+			T result;
+			checkGetHeaderAs(key, result, def);
+			return result;
 		}
 
 		/**
@@ -411,7 +529,20 @@ namespace WebSrv::http
 		template <typename T>
 		bool checkGetHeaderAs(const std::string &key, T &result, const T &def = T())
 		{
-			return checkGetAs(_headers, key, result, def);
+			std::string value;
+			if (hasHeader(key, &value))
+			{
+				try
+				{
+					result = lexicalCast<T>(value);
+					return true;
+				}
+				catch (...)
+				{
+				}
+			}
+			result = def;
+			return false;
 		}
 
 		/**
@@ -425,6 +556,7 @@ namespace WebSrv::http
 		template <typename T>
 		T getParamAs(const std::string &key, const T &def = T())
 		{
+			initParams();
 			return getAs(_params, key, def);
 		}
 
@@ -441,6 +573,7 @@ namespace WebSrv::http
 		template <typename T>
 		bool checkGetParamAs(const std::string &key, T &result, const T &def = T())
 		{
+			initParams();
 			return checkGetAs(_params, key, result, def);
 		}
 
@@ -491,8 +624,14 @@ namespace WebSrv::http
 		void addLine(std::ostream &os) const;
 		void addHeaders(std::ostream &os) const;
 		void addBody(std::ostream &os) const;
+		// 把头部视图复制到_headers
+		void materializeHeaders() const { _headerViews.moveTo(_headers); }
+		// 解析查询串到_params(只解析一次)
+		void initParams() const;
 
 	private:
+		// _parserParamStatus标志位：查询串已解析
+		static constexpr uint8_t PARAM_QUERY_PARSED = 0x1;
 		// http 方法
 		HttpMethod _method;
 		// http 版本
@@ -501,16 +640,22 @@ namespace WebSrv::http
 		std::string _path;
 		// 请求fragment(锚点用于客户端本地服务不会上传服务器)
 		std::string _fragment;
+		// 原始查询串(未解码)
+		std::string _query;
 		// 请求消息体
 		std::string _body;
+		// 请求消息体读取器(流式读取时)
+		std::shared_ptr<HttpBodyReader> _bodyReader;
 		// 请求头部Map
-		Map _headers;
+		mutable Map _headers;
+		// 解析得到的请求头部视图，修改头部前复制到_headers
+		mutable HeaderViews _headerViews;
 		// 请求参数Map
-		Map _params;
+		mutable Map _params;
 		// 请求cookie Map
 		Map _cookies;
 		// 初始化请求参数，成功后添加标志位，不在初始化
-		uint8_t _parserParamStatus;
+		mutable uint8_t _parserParamStatus;
 	};
 
 	/**
@@ -571,18 +716,37 @@ namespace WebSrv::http
 		const std::string &getBody() const { return _body; }
 		/// @brief 获取响应原因
 		const std::string &getReason() const { return _reason; }
-		/// @brief 获取响应头部map
-		const Map &getHeaders() const { return _headers; }
+		/// @brief 是否使用分块传输编码发送消息体
+		bool isChunked() const { return _chunked; }
+		/// @brief 获取响应头部map(解析得到的头部视图会先复制进来，首次调用会修改内部状态，不能在多个线程同时调用)
+		const Map &getHeaders() const
+		{
+			materializeHeaders();
+			return _headers;
+		}
+		/// @brief 获取解析得到的头部视图(修改过头部后为空)
+		const HeaderViews &getHeaderViews() const { return _headerViews; }
 		/// @brief 响应状态
 		void setStatus(HttpStatus status) { _status = status; }
 		/// @brief http 版本
 		void setVersion(uint8_t version) { _version = version; }
 		/// @brief 响应消息体
 		void setBody(const std::string &body) { _body = body; }
+		void setBody(std::string &&body) { _body = std::move(body); }
 		/// @brief 响应原因
 		void setReason(const std::string &reason) { _reason = reason; }
+		/// @brief 使用分块传输编码发送消息体(http/1.1)，不再发送content-length
+		void setChunked(bool chunked) { _chunked = chunked; }
 		/// @brief 响应头部map
-		void setHeaders(const Map &headers) { _headers = headers; }
+		void setHeaders(const Map &headers)
+		{
+			_headerViews.clear();
+			_headers = headers;
+		}
+		/// @brief 添加解析得到的头部视图(由解析器调用)
+		void addHeaderView(std::string_view key, std::string_view value) { _headerViews.add(key, value); }
+		/// @brief 持有头部视图所在的接收缓冲区
+		void setHeaderBuffer(std::shared_ptr<const char> buffer) { _headerViews.setBuffer(std::move(buffer)); }
 
 		/**
 		 * @brief 获取HTTP请求的头部参数(不包含cookie)
@@ -592,6 +756,13 @@ namespace WebSrv::http
 		 * @return std::string 存在返回对应值，否则为默认值
 		 */
 		std::string getHeader(const std::string &key, const std::string &def = "") const;
+		/**
+		 * @brief 获取HTTP响应的头部参数，不复制(视图在响应结构体和头部未修改前有效)
+		 *
+		 * @param key 键
+		 * @return std::string_view 不存在返回空
+		 */
+		std::string_view getHeaderView(const std::string &key) const;
 		/**
 		 * @brief 判断Http请求的头部参数(不包含cookie)
 		 *
@@ -648,7 +819,9 @@ namespace WebSrv::http
 		template <typename T>
 		T getHeaderAs(const std::string &key, const T &def = T())
 		{
-			return getAs(_headers, key, def);
+			T result;
+			checkGetHeaderAs(key, result, def);
+			return result;
 		}
 
 		/**
@@ -664,7 +837,20 @@ namespace WebSrv::http
 		template <typename T>
 		bool checkGetHeaderAs(const std::string &key, T &result, const T &def = T())
 		{
-			return checkGetAs(_headers, key, result, def);
+			std::string value;
+			if (hasHeader(key, &value))
+			{
+				try
+				{
+					result = lexicalCast<T>(value);
+					return true;
+				}
+				catch (...)
+				{
+				}
+			}
+			result = def;
+			return false;
 		}
 		/**
 		 * @brief 序列化输出到流中
@@ -673,6 +859,13 @@ namespace WebSrv::http
 		 * @return std::ostream&
 		 */
 		std::ostream &dump(std::ostream &os) const;
+		/**
+		 * @brief 只序列化起始行和头部(含结束空行)，用于先发送头部再流式发送消息体
+		 *
+		 * @param os
+		 * @return std::ostream&
+		 */
+		std::ostream &dumpHeader(std::ostream &os) const;
 		/**
 		 * @brief 转成字符串类型
 		 *
@@ -681,6 +874,8 @@ namespace WebSrv::http
 		std::string toString() const;
 	private:
 		void addCookie(std::ostream& os) const;
+		/// @brief 把头部视图复制到_headers
+		void materializeHeaders() const { _headerViews.moveTo(_headers); }
 	private:
 		/// @brief 响应状态
 		HttpStatus _status;
@@ -691,9 +886,13 @@ namespace WebSrv::http
 		/// @brief 响应原因（自定义响应）
 		std::string _reason;
 		/// @brief 响应头部map
-		Map _headers;
+		mutable Map _headers;
+		/// @brief 解析得到的响应头部视图，修改头部前复制到_headers
+		mutable HeaderViews _headerViews;
 		/// @brief 响应cookie
 		CookieMap _cookies;
+		/// @brief 是否使用分块传输编码
+		bool _chunked;
 	};
 
 	std::ostream &operator<<(std::ostream &os, const HttpRequest &other);
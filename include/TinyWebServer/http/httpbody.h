@@ -0,0 +1,146 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "stream.h"
+#include "bytearray.h"
+#include "httpparser.h"
+namespace WebSrv::http
+{
+    /**
+     * @brief 消息体的流式读取：按需分段读取，或直接写入ByteArray、文件，不必把整个消息体缓存在内存中。
+     * 先返回接收头部时已读入缓冲区的部分，再从连接读取；分块编码边读边原地解码
+     *
+     */
+    class HttpBodyReader
+    {
+    public:
+        using ptr = std::shared_ptr<HttpBodyReader>;
+        /**
+         * @brief 构造
+         *
+         * @param stream 连接，读取期间必须有效
+         * @param buffer 接收头部的缓冲区
+         * @param begin 缓冲区中消息体的起始位置(头部长度)
+         * @param end 缓冲区中已接收数据的结束位置
+         * @param length 消息体长度(content-length)，分块编码时忽略
+         * @param chunked 是否为分块传输编码
+         * @param maxSize 最大消息体长度，分块编码超过时出错
+         */
+        HttpBodyReader(Stream *stream, std::shared_ptr<char> buffer, size_t begin, size_t end,
+                       uint64_t length, bool chunked, uint64_t maxSize);
+        /**
+         * @brief 读取一段消息体
+         *
+         * @param buffer
+         * @param len 大于0
+         * @return int
+         * @retval >0 读到的长度
+         * @retval =0 消息体已读完
+         * @retval <0 连接关闭或出错
+         */
+        int read(void *buffer, size_t len);
+        /**
+         * @brief 读取剩余的消息体追加到body
+         *
+         * @param body
+         * @return int64_t 成功返回读取长度，失败返回-1
+         */
+        int64_t readAll(std::string &body);
+        /**
+         * @brief 读取剩余的消息体写入ba(从当前位置开始)
+         *
+         * @param ba
+         * @return int64_t 成功返回读取长度，失败返回-1
+         */
+        int64_t readTo(ByteArray::ptr ba);
+        /**
+         * @brief 读取剩余的消息体写入文件(写普通文件交给阻塞任务线程池执行，不阻塞工作线程)
+         *
+         * @param fd
+         * @return int64_t 成功返回读取长度，读取或写入失败返回-1
+         */
+        int64_t readTo(int fd);
+        /**
+         * @brief 丢弃剩余的消息体
+         *
+         * @param max 最多丢弃的长度，超过时停止(isFinished()为false)
+         * @return int64_t 成功返回丢弃长度，失败返回-1
+         */
+        int64_t skip(uint64_t max = ~0ull);
+        /**
+         * @brief 消息体是否已读完
+         *
+         */
+        bool isFinished() const;
+        /**
+         * @brief 是否出错(连接关闭、分块格式错误或超过最大长度)
+         *
+         */
+        bool hasError() const { return _error; }
+        /**
+         * @brief 是否为分块传输编码(长度未知)
+         *
+         */
+        bool isChunked() const { return _chunked; }
+        /**
+         * @brief 消息体长度(content-length)，分块编码时为0
+         *
+         */
+        uint64_t getContentLength() const { return _length; }
+        /**
+         * @brief 已读取的消息体长度
+         *
+         */
+        uint64_t getReadSize() const { return _read; }
+        /**
+         * @brief 请求带有"Expect: 100-continue"时设置，第一次从连接读取前先发送"100 Continue"
+         *
+         * @param expect
+         */
+        void setExpectContinue(bool expect) { _expectContinue = expect; }
+        /**
+         * @brief 是否还在等待发送"100 Continue"(客户端可能还没有发送消息体)
+         *
+         */
+        bool isExpectContinue() const { return _expectContinue; }
+
+    private:
+        /**
+         * @brief 从连接读取(需要时先发送"100 Continue")
+         *
+         */
+        int readStream(void *buffer, size_t len);
+        /**
+         * @brief 记录出错
+         *
+         * @return int -1
+         */
+        int fail();
+
+    private:
+        /// @brief 连接
+        Stream *_stream;
+        /// @brief 接收头部的缓冲区
+        std::shared_ptr<char> _buffer;
+        /// @brief 缓冲区中还未返回的消息体(分块编码时已解码)的起始位置
+        size_t _begin;
+        /// @brief 缓冲区中还未返回的消息体的结束位置
+        size_t _end;
+        /// @brief 消息体长度
+        uint64_t _length;
+        /// @brief 还需从连接读取的长度(content-length)
+        uint64_t _remaining;
+        /// @brief 最大消息体长度
+        uint64_t _maxSize;
+        /// @brief 已读取长度
+        uint64_t _read = 0;
+        /// @brief 是否为分块编码
+        bool _chunked;
+        /// @brief 是否出错
+        bool _error = false;
+        /// @brief 是否需要先发送"100 Continue"
+        bool _expectContinue = false;
+        /// @brief 分块解码
+        HttpChunkedDecoder _decoder;
+    };
+} // namespace WebSrv::http
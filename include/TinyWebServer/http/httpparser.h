@@ -1,56 +1,255 @@
 #pragma once
 #include <memory>
+#include <string_view>
 #include <unordered_set>
 #include "http.h"
 namespace WebSrv::http
 {
     /**
-     * @brief http响应报文解析
-     * 
+     * @brief http报文头部的增量解析状态机(请求和响应共用)
+     * 保存已解析到的位置，数据分多次到达时只扫描新到达的部分；查找':'和行尾的同时校验字符
+     * (HttpScanner按CPU选择SIMD实现)，头部名称和值记录为指向接收缓冲区的视图，不复制也不修改缓冲区
+     *
      */
-    class HttpRequestParser
+    class HttpMessageParser
+    {
+    public:
+        /**
+         * @brief 解析状态
+         *
+         */
+        enum State
+        {
+            // 等待起始行
+            START_LINE,
+            // 解析头部行
+            HEADERS,
+            // 头部解析完成
+            DONE,
+            // 解析出错
+            FAILED,
+        };
+        virtual ~HttpMessageParser() = default;
+        /**
+         * @brief 获取消息体长度(content-length)
+         *
+         * @return uint64_t
+         */
+        uint64_t getContentLength() const { return _contentLength; }
+        /**
+         * @brief 消息体是否使用分块传输编码(transfer-encoding最后一项为chunked)
+         *
+         */
+        bool isChunked() const { return _chunked; }
+        /**
+         * @brief 头部是否解析完成
+         *
+         */
+        bool isFinished() const { return _state == DONE; }
+        /**
+         * @brief 是否解析出错
+         *
+         */
+        bool hasError() const { return _state == FAILED; }
+        /**
+         * @brief 错误码对应http状态码
+         *
+         * @return int
+         */
+        int getError() const { return _error; }
+
+    protected:
+        /**
+         * @brief 从上次停止的位置继续解析
+         *
+         * @param data 协议文本内存，多次调用时必须是同一块内存，且之前传入的内容不变
+         * @param len 目前已接收的长度
+         * @return size_t 成功返回头部长度，不是完整报文返回0，错误返回-1
+         */
+        size_t run(const char *data, size_t len);
+        /**
+         * @brief 重置解析状态
+         *
+         */
+        void resetState();
+        /**
+         * @brief 解析起始行(不含行尾)
+         *
+         * @param line
+         * @return true
+         * @return false 格式错误，未设置_error时为400
+         */
+        virtual bool parseStartLine(std::string_view line) = 0;
+        /**
+         * @brief 保存解析出的一个头部
+         *
+         * @param key
+         * @param value 已去掉前后空白
+         */
+        virtual void onHeader(std::string_view key, std::string_view value) = 0;
+        /**
+         * @brief 解析版本号"HTTP/x.y"
+         *
+         * @param version
+         * @param result 高4位主版本号，低4位次版本号
+         * @return true
+         * @return false
+         */
+        static bool parseVersion(std::string_view version, uint8_t &result);
+
+    private:
+        /**
+         * @brief 处理一个已扫描过的头部(名称已是token，值中没有控制字符)
+         *
+         * @param key
+         * @param value ':'之后到行尾的内容
+         * @return true
+         * @return false
+         */
+        bool parseHeader(std::string_view key, std::string_view value);
+        /**
+         * @brief 进入错误状态
+         *
+         * @return size_t -1
+         */
+        size_t fail();
+
+    protected:
+        /// @brief 错误码
+        int _error = 0;
+
+    private:
+        /// @brief 解析状态
+        State _state = START_LINE;
+        /// @brief 下一行的起始位置(之前的行已解析)
+        size_t _offset = 0;
+        /// @brief 已扫描到的位置，之后的调用从这里继续扫描
+        size_t _scanned = 0;
+        /// @brief 当前头部行中':'的位置，0为还未扫描到
+        size_t _nameEnd = 0;
+        /// @brief 消息体长度
+        uint64_t _contentLength = 0;
+        /// @brief 是否已有content-length
+        bool _hasContentLength = false;
+        /// @brief 是否为分块传输编码
+        bool _chunked = false;
+    };
+
+    /**
+     * @brief 分块传输编码(RFC7230 4.1)消息体的增量解码
+     * 数据分多次到达时从上次停止的位置继续，解码出的数据原地移动到传入内存的开头，不另外分配内存；
+     * 忽略块扩展和尾部头部
+     *
+     */
+    class HttpChunkedDecoder
+    {
+    public:
+        /**
+         * @brief 解码一段数据
+         *
+         * @param data 收到的数据，解码结果写回data开头
+         * @param len 数据长度
+         * @param decoded 返回解码出的数据长度
+         * @return size_t 消费的长度(消息体结束前总是len，结束时为结束位置)，错误返回-1
+         */
+        size_t execute(char *data, size_t len, size_t &decoded);
+        /**
+         * @brief 消息体是否已结束(收到最后一块和尾部)
+         *
+         */
+        bool isFinished() const { return _state == DONE; }
+        /**
+         * @brief 是否解码出错
+         *
+         */
+        bool hasError() const { return _state == FAILED; }
+        /**
+         * @brief 重置状态，解码下一个消息体
+         *
+         */
+        void reset();
+
+    private:
+        /**
+         * @brief 解码状态
+         *
+         */
+        enum State
+        {
+            // 块大小(十六进制)
+            SIZE,
+            // 块扩展，跳过到行尾
+            EXTENSION,
+            // 块大小行的LF
+            SIZE_LF,
+            // 块数据
+            DATA,
+            // 块数据后的CR
+            DATA_CR,
+            // 块数据后的LF
+            DATA_LF,
+            // 尾部头部的行首
+            TRAILER,
+            // 尾部头部行，跳过到行尾
+            TRAILER_LINE,
+            // 结束空行的LF
+            TRAILER_LF,
+            // 结束
+            DONE,
+            // 出错
+            FAILED,
+        };
+        /// @brief 解码状态
+        State _state = SIZE;
+        /// @brief 当前块剩余长度
+        uint64_t _remaining = 0;
+        /// @brief 块大小已读的位数
+        uint32_t _digits = 0;
+        /// @brief 已跳过的块扩展和尾部头部长度
+        uint32_t _skipped = 0;
+    };
+
+    /**
+     * @brief http请求报文解析
+     *
+     */
+    class HttpRequestParser : public HttpMessageParser
     {
     public:
         using ptr = std::shared_ptr<HttpRequestParser>;
         HttpRequestParser(uint8_t maxVersion=0x11);
         /**
-         * @brief 解析协议(不解析请求体)
-         * 
-         * @param data 协议文本内存(会添加'\0'破坏原有的结构)
-         * @param len 协议文本内存长度
+         * @brief 增量解析协议(不解析请求体)，可以每收到一段数据调用一次，已解析的部分不会重复扫描
+         *
+         * @param data 协议文本内存(不会被修改)，多次调用时必须是同一块内存，头部视图指向这块内存，
+         * 需通过HttpRequest::setHeaderBuffer保持有效
+         * @param len 协议文本内存长度(目前已接收的总长度)
          * @return size_t 成功返回解析长度，不是完整报文返回0，其他错误返回-1，错误码对应状态码
          */
-        size_t execute(char* data,size_t len);
+        size_t execute(char* data,size_t len) { return run(data, len); }
         /**
-         * @brief 获取http响应报文储存结构
-         * 
-         * @return HttpRequest::ptr 
+         * @brief 重置状态，解析下一个请求
+         *
          */
-        HttpRequest::ptr getData() const{return _data;};
+        void reset();
         /**
-         * @brief 获取消息体长度
-         * 
-         * @return uint64_t 
+         * @brief 获取http请求报文储存结构
+         *
+         * @return HttpRequest::ptr
          */
-        uint64_t getContentLength();
+        HttpRequest::ptr getData() const{return _data;};
         /**
          * @brief 设置支持的http方法（默认支持所有）
-         * 
-         * @param methods 
+         *
+         * @param methods
          */
         void setMethods(std::shared_ptr<std::unordered_set<HttpMethod>> methods) { _methods = methods; }
         /**
          * @brief 获取当前http支持的方法
-         * 
+         *
          * @return std::shared_ptr<std::unordered_set<HttpMethod>>
          */
         std::shared_ptr<std::unordered_set<HttpMethod>> getMethods() { return _methods; }
-        /**
-         * @brief 错误码对应http状态码
-         * 
-         * @return int 
-         */
-        int getError(){return _error;}
         /**
          * @brief 返回http 请求协议解析的缓存大小
          *
@@ -63,13 +262,19 @@ namespace WebSrv::http
          * @return uint64_t
          */
         static uint64_t getHttpRequestMaxBodySize();
+        /**
+         * @brief 返回分发前整体读入body的最大请求体大小，更大的或分块编码的请求体由servlet流式读取
+         *
+         * @return uint64_t
+         */
+        static uint64_t getHttpRequestBufferBodySize();
+
+    protected:
+        bool parseStartLine(std::string_view line) override;
+        void onHeader(std::string_view key, std::string_view value) override;
 
     private:
-        int parseHeaders(std::vector<char *> &headers);
-    private:
-        /// @brief 错误码
-        int _error=0;
-        /// @brief http响应报文储存结构
+        /// @brief http请求报文储存结构
         HttpRequest::ptr _data;
         /// @brief 支持最大版本
         uint8_t _maxVersion;
@@ -77,31 +282,31 @@ namespace WebSrv::http
         std::shared_ptr<std::unordered_set<HttpMethod>> _methods;
     };
 
-    class HttpResponseParser
+    class HttpResponseParser : public HttpMessageParser
     {
     public:
         using ptr = std::shared_ptr<HttpResponseParser>;
         HttpResponseParser();
         /**
-         * @brief 解析协议(不解析请求体)
-         * 
-         * @param data 协议文本内存(会添加'\0'破坏原有的结构)
-         * @param len 协议文本内存长度
-         * @return int 成功返回解析长度，不是完整报文返回0，错误返回-1
+         * @brief 增量解析协议(不解析响应体)，可以每收到一段数据调用一次，已解析的部分不会重复扫描
+         *
+         * @param data 协议文本内存(不会被修改)，多次调用时必须是同一块内存，头部视图指向这块内存，
+         * 需通过HttpResponse::setHeaderBuffer保持有效
+         * @param len 协议文本内存长度(目前已接收的总长度)
+         * @return size_t 成功返回解析长度，不是完整报文返回0，错误返回-1
          */
-        size_t execute(char* data,size_t len);
+        size_t execute(char* data,size_t len) { return run(data, len); }
         /**
-         * @brief 获取http响应报文储存结构
-         * 
-         * @return HttpResponse::ptr 
+         * @brief 重置状态，解析下一个响应
+         *
          */
-        HttpResponse::ptr getData() const{return _data;};
+        void reset();
         /**
-         * @brief 获取消息体长度
-         * 
-         * @return uint64_t 
+         * @brief 获取http响应报文储存结构
+         *
+         * @return HttpResponse::ptr
          */
-        uint64_t getContentLength();
+        HttpResponse::ptr getData() const{return _data;};
         /**
          * @brief 返回http 响应协议解析的缓存大小
          *
@@ -115,8 +320,10 @@ namespace WebSrv::http
          */
         static uint64_t getHttpResponseMaxBodySize();
 
-    private:
-        bool parseHeaders(std::vector<char*> headers); 
+    protected:
+        bool parseStartLine(std::string_view line) override;
+        void onHeader(std::string_view key, std::string_view value) override;
+
     private:
         /// @brief http响应报文储存结构
         HttpResponse::ptr _data;
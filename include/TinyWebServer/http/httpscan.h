@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+namespace WebSrv::http
+{
+    /**
+     * @brief http报文的字符扫描：一次扫描同时完成查找分隔符和校验字符，
+     * 按CPU支持在运行时选择AVX2、SSE4.2或标量实现
+     *
+     */
+    class HttpScanner
+    {
+    public:
+        /**
+         * @brief 扫描实现
+         *
+         */
+        enum Kernel
+        {
+            SCALAR,
+            SSE42,
+            AVX2,
+        };
+        /**
+         * @brief 查找第一个不是token字符(RFC7230 tchar)的位置，用于头部名称(停在':')和方法
+         *
+         * @param p
+         * @param end
+         * @return const char* 没有时返回end
+         */
+        static const char *findNonToken(const char *p, const char *end) { return s_findNonToken(p, end); }
+        /**
+         * @brief 查找第一个控制字符(0x00-0x1f中除制表符以外的字符和0x7f)的位置，
+         * 用于查找行尾('\r'或'\n')，同时校验头部值和起始行中没有非法字符
+         *
+         * @param p
+         * @param end
+         * @return const char* 没有时返回end
+         */
+        static const char *findControl(const char *p, const char *end) { return s_findControl(p, end); }
+        /**
+         * @brief 当前使用的实现
+         *
+         */
+        static Kernel getKernel() { return s_kernel; }
+        /**
+         * @brief CPU支持的最快实现
+         *
+         */
+        static Kernel getBestKernel();
+        /**
+         * @brief 切换实现(用于测试和对比，需在解析开始前调用)，CPU不支持时使用支持的最快实现
+         *
+         * @param kernel
+         * @return Kernel 实际使用的实现
+         */
+        static Kernel setKernel(Kernel kernel);
+        static const char *KernelToString(Kernel kernel);
+
+    private:
+        using ScanFunc = const char *(*)(const char *, const char *);
+        static Kernel s_kernel;
+        static ScanFunc s_findNonToken;
+        static ScanFunc s_findControl;
+    };
+} // namespace WebSrv::http
@@ -6,12 +6,26 @@
 #include "streams/socketstream.h"
 #include "httpsession.h"
 #include "httpparser.h"
+#include "httpbody.h"
 namespace WebSrv::http
 {
     class HttpSession : public SocketStream
     {
     public:
         using ptr = std::shared_ptr<HttpSession>;
+        /**
+         * @brief 当前请求的响应发送状态
+         *
+         */
+        enum class ResponseState
+        {
+            // 还未发送，servlet返回后整体发送
+            NONE,
+            // 已发送头部，正在流式发送消息体
+            STREAMING,
+            // 流式响应已结束
+            FINISHED,
+        };
 
         HttpSession(Socket::ptr socket, bool owner = true);
         /**
@@ -27,6 +41,39 @@ namespace WebSrv::http
          * @param ret 成功返回发送长度，失败返回-1
          */
         int sendResponse(HttpResponse::ptr response);
+        /**
+         * @brief 开始流式发送响应：先发送起始行和头部，消息体之后用sendChunk边生成边发送，
+         * 不必把整个消息体缓存在内存中。http/1.1使用分块传输编码；
+         * http/1.0不支持分块，直接发送消息体并以关闭连接表示结束
+         *
+         * @param response 已设置好状态和头部，其中的消息体不会发送
+         * @return int 成功返回发送长度，失败返回<=0
+         */
+        int sendResponseHeader(HttpResponse::ptr response);
+        /**
+         * @brief 发送一段消息体(一次系统调用发送块头、数据和块尾)
+         *
+         * @param data
+         * @param len 为0时不发送
+         * @return int 成功返回len，失败返回-1
+         */
+        int sendChunk(const void *data, size_t len);
+        /**
+         * @brief 结束流式响应，发送最后一块(servlet返回后HttpServer会自动调用)
+         *
+         * @return int 成功返回>0，失败返回<=0
+         */
+        int finishResponse();
+        /**
+         * @brief 当前请求的响应发送状态
+         *
+         */
+        ResponseState getResponseState() const { return _responseState; }
 
+    private:
+        /// @brief 响应发送状态
+        ResponseState _responseState = ResponseState::NONE;
+        /// @brief 流式响应是否使用分块传输编码
+        bool _chunked = false;
     };
 } // namespace WebSrv
@@ -1,8 +1,12 @@
 #pragma once
 #include "scheduler.h"
 #include "timer.h"
+struct io_uring_sqe;
+struct epoll_event;
 namespace WebSrv
 {
+    class IoUring;
+    struct IoRequest;
     class IOManager : public Scheduler, public TimerManager
     {
     public:
@@ -15,8 +19,20 @@ namespace WebSrv
             // 写事件（EPOLLOUT）
             WRITE = 0x4,
         };
+        /**
+         * @brief io后端
+         *
+         */
+        enum Backend
+        {
+            // epoll就绪通知，收到就绪后再执行系统调用
+            EPOLL,
+            // io_uring直接提交读写请求，完成后恢复协程
+            IO_URING,
+        };
 
     private:
+        friend struct IoRequest;
         struct FdContext
         {
             struct EventContext
@@ -24,20 +40,45 @@ namespace WebSrv
                 Scheduler *scheduler = nullptr;
                 Fiber::ptr fiber;
                 std::function<void()> cb;
+                /// @brief 指定执行的线程(连接亲和模式)
+                std::thread::id threadid;
             };
 
             EventContext &getContext(Event event);
             void resetEventContext(EventContext &ctx);
-            void triggerEvent(Event event);
+            /**
+             * @brief 触发事件，等待者属于batchOwner时放入batch由调用者批量调度，否则立即调度
+             *
+             */
+            void triggerEvent(Event event, TaskList *batch = nullptr, Scheduler *batchOwner = nullptr);
             EventContext read;
             EventContext write;
             Event events = NONE;
             std::mutex mutex;
             int fd;
+            /// @brief 连接亲和模式下注册到的工作线程下标
+            size_t worker = 0;
+            /// @brief 正在执行的io_uring请求链表(受_ringMutex保护)，关闭句柄时逐个按user_data取消
+            IoRequest *ioRequests = nullptr;
+            /// @brief 持久注册模式：是否已注册到epoll
+            bool registered = false;
+            /// @brief 持久注册模式：已就绪但没有等待者的事件，下次添加事件时直接消费
+            Event ready = NONE;
+            /// @brief 代数，从epoll移除注册(或关闭)时加1，和句柄号一起作为epoll的data，用来丢弃移除前已取出的过时事件
+            uint32_t generation = 0;
         };
 
     public:
-        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "");
+        /**
+         * @brief Construct a new IOManager object
+         *
+         * @param threads 线程数量
+         * @param use_caller 是否由当前线程调用
+         * @param name 调度器名
+         * @param affinity 连接亲和模式：每个工作线程有自己的epoll，句柄首次添加事件时分配给当前工作线程，
+         * 事件触发后的协程回到该线程执行
+         */
+        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "", bool affinity = false);
 
         ~IOManager();
         /**
@@ -45,8 +86,9 @@ namespace WebSrv
          *
          * @param fd
          * @param event
-         * @param cb
-         * @return int
+         * @param cb 为空时事件触发后恢复当前协程
+         * @return int 0成功(持久注册模式下事件已就绪时回调直接被调度)，-1失败，
+         * 1事件已就绪(持久注册模式且cb为空，未添加，调用者应直接重试)
          */
         int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
@@ -80,6 +122,58 @@ namespace WebSrv
         bool delEvent(int fd, Event event);
 
         static IOManager *getThis();
+        /**
+         * @brief 使用的io后端(由配置iomanager.backend选择，io_uring不可用时为epoll)
+         *
+         */
+        Backend getBackend() const { return _backend; }
+        /**
+         * @brief io_uring后端下提交一个io请求，挂起当前协程直到完成
+         * 请求的缓冲区在完成前由内核异步访问，不能在共享栈协程中使用
+         *
+         * @param sqe 已填写的请求(user_data由内部设置)
+         * @param timeout 超时时间(ms)，~0为不超时
+         * @return int 请求结果，失败返回-errno(超时为-ETIMEDOUT)
+         */
+        int submitIO(const io_uring_sqe &sqe, uint64_t timeout = ~0ull);
+        /**
+         * @brief 是否为连接亲和模式
+         *
+         */
+        bool isAffinity() const { return _affinity; }
+        /**
+         * @brief 是否为持久注册模式：句柄首次添加事件时以EPOLLIN|EPOLLOUT|EPOLLET注册一次，
+         * 之后添加、取消、触发事件都不再调用epoll_ctl，就绪状态记录在句柄上下文中
+         *
+         */
+        bool isPersistent() const { return _persistent; }
+        /**
+         * @brief 句柄关闭时清除所有持久注册模式IOManager中该句柄的注册状态(句柄号会被复用)
+         *
+         * @param fd
+         */
+        static void forgetFd(int fd);
+        /**
+         * @brief 空闲线程从epoll_wait(或io_uring等待)返回的次数
+         *
+         */
+        uint64_t pollWakeups() const { return _pollWakeups; }
+        /**
+         * @brief 等待返回的事件总数，除以pollWakeups()为每次唤醒处理的事件数
+         *
+         */
+        uint64_t polledEvents() const { return _polledEvents; }
+        /**
+         * @brief 返回事件数达到iomanager.max_events的次数(过多说明max_events偏小)
+         *
+         */
+        uint64_t pollFullBatches() const { return _pollFullBatches; }
+        /**
+         * @brief 轮流返回一个工作线程id，用于把新连接分散到各工作线程(非亲和模式返回空id)
+         *
+         * @return std::thread::id
+         */
+        std::thread::id nextAffinityThread();
 
         /**
          * @brief 停止运行
@@ -87,27 +181,168 @@ namespace WebSrv
          */
         void stop() override;
     protected:
+        /**
+         * @brief 唤醒一个空闲线程：优先唤醒等待在自己eventfd上的线程，没有时唤醒epoll轮询线程
+         *
+         */
         void tickle() override;
+        /**
+         * @brief 唤醒指定线程(空id时同tickle())
+         *
+         * @param threadid
+         */
+        void tickle(std::thread::id threadid) override;
         bool stopping() override;
-        bool stopping(uint64_t timeout);
+        /**
+         * @brief 是否可以停止，同时返回距下一个定时器的时间
+         *
+         * @param timeout 距下一个定时器的时间(ms)，没有定时器为~0
+         */
+        bool stopping(uint64_t &timeout);
         void idle() override;
         void onTimerInsertedAtFront() override;
         /**
-         * @brief socket句柄上下文容器大小
+         * @brief 每个工作线程一个时间轮，外部线程共用最后一个
          *
-         * @param size
          */
-        void contextResize(size_t size);
+        size_t getTimerShard() const override
+        {
+            size_t index = getWorkerIndex();
+            return index != ~0ull ? index : getWorkerCount();
+        }
+        /**
+         * @brief 分配句柄上下文表的一页，已被其他线程分配时返回已有的页
+         *
+         * @param index 页下标
+         * @return FdContext*
+         */
+        FdContext *allocFdPage(size_t index);
+        /**
+         * @brief 唤醒epoll轮询线程(已有未处理的唤醒时不重复写入)
+         *
+         */
+        void wakePoller();
+        /**
+         * @brief 空闲线程不轮询epoll时，阻塞在自己的eventfd上等待唤醒
+         *
+         * @param index 工作线程下标
+         */
+        void waitWakeup(size_t index);
+        /**
+         * @brief 写eventfd
+         *
+         * @param fd
+         */
+        void writeWakeup(int fd);
+        /**
+         * @brief 空闲线程加入/移出等待唤醒列表
+         *
+         * @param index 工作线程下标
+         */
+        void addIdleWaiter(size_t index);
+        void removeIdleWaiter(size_t index);
+        /**
+         * @brief 轮流选择一个已运行的工作线程(不包括use_caller线程)
+         *
+         * @return size_t 工作线程下标
+         */
+        size_t pickWorker();
+        /**
+         * @brief 句柄注册所在的epoll
+         *
+         * @param fdCtx
+         * @return int
+         */
+        int getEpollFd(FdContext *fdCtx) const { return _affinity ? _epollFds[fdCtx->worker] : _epollFd; }
+        /**
+         * @brief 查找句柄上下文(无锁)，所在页尚未分配时返回空
+         *
+         * @param fd
+         * @return FdContext*
+         */
+        FdContext *findFdContext(int fd) const;
+        /**
+         * @brief 获取句柄上下文，所在页不存在时分配，fd超出范围返回空
+         *
+         * @param fd
+         * @return FdContext*
+         */
+        FdContext *getFdContext(int fd);
+        /**
+         * @brief 按剩余事件修改句柄的epoll注册，没有剩余事件时移除
+         *
+         * @param fdCtx
+         * @param events 剩余事件
+         * @return int epoll_ctl的返回值
+         */
+        int updateEpoll(FdContext *fdCtx, Event events);
+        /**
+         * @brief 注册到epoll的data：低32位句柄号，高32位代数
+         *
+         * @param fdCtx
+         * @return uint64_t
+         */
+        static uint64_t epollData(const FdContext *fdCtx) { return (uint64_t)fdCtx->generation << 32 | (uint32_t)fdCtx->fd; }
+        /**
+         * @brief 按配置初始化io_uring后端
+         *
+         */
+        void initIoUring();
+        /**
+         * @brief io_uring后端的等待：epoll句柄本身通过io_uring监听，
+         * 等待io请求完成或epoll就绪，收割完成的请求后取出epoll中的就绪事件
+         *
+         * @param events
+         * @param maxEvents
+         * @param timeout
+         * @param batch 完成的请求的协程放入其中
+         * @return int 同epoll_wait
+         */
+        int waitIoUring(epoll_event *events, int maxEvents, int timeout, TaskList &batch);
 
     private:
         /// @brief epoll文件句柄
         int _epollFd = 0;
-        /// @brief pipe文件句柄
-        int _tickleFds[2];
+        /// @brief 连接亲和模式
+        bool _affinity = false;
+        /// @brief 持久注册模式
+        bool _persistent = false;
+        /// @brief 连接亲和模式下每个工作线程的epoll
+        std::vector<int> _epollFds;
+        /// @brief 轮流分配工作线程的计数
+        std::atomic<size_t> _nextWorker = 0;
+        /// @brief 轮询线程的唤醒eventfd(注册在epoll中)
+        int _wakeFd = -1;
+        /// @brief 轮询线程是否已有未处理的唤醒
+        std::atomic<bool> _pollerNotified = false;
+        /// @brief 正在轮询epoll的工作线程下标，~0为没有
+        std::atomic<size_t> _poller = ~0ull;
+        /// @brief 每个工作线程的唤醒eventfd
+        std::vector<int> _idleFds;
+        /// @brief 等待在eventfd上的空闲线程
+        std::mutex _idleMutex;
+        std::vector<size_t> _idleWorkers;
+        /// @brief 空闲线程是否在等待(按工作线程下标)
+        std::vector<char> _idleWaiting;
+        std::atomic<size_t> _idleWaitingCount = 0;
+        /// @brief io后端
+        Backend _backend = EPOLL;
+        /// @brief io_uring环形队列(io_uring后端)
+        std::unique_ptr<IoUring> _ring;
+        /// @brief 提交队列锁
+        std::mutex _ringMutex;
+        /// @brief epoll句柄是否已在io_uring中监听(只由轮询线程访问)
+        bool _epollArmed = false;
         /// @brief 当前等待执行的事件数量
         std::atomic<uint64_t> _pendingEventCount = 0;
-        RWMutex _rwMutex;
-
-        std::vector<FdContext *> _fdContexts;
+        /// @brief 每次唤醒处理事件数的统计
+        std::atomic<uint64_t> _pollWakeups = 0;
+        std::atomic<uint64_t> _polledEvents = 0;
+        std::atomic<uint64_t> _pollFullBatches = 0;
+        /// @brief 句柄上下文表每页大小和页数(支持的最大句柄数为两者乘积)
+        static constexpr size_t FD_PAGE_SIZE = 256;
+        static constexpr size_t FD_PAGE_COUNT = 4096;
+        /// @brief 两级句柄上下文表：页只分配不移动也不释放(直到析构)，读取只需一次原子加载
+        std::atomic<FdContext *> _fdPages[FD_PAGE_COUNT] = {};
     };
 } // namespace WebSrv
\ No newline at end of file
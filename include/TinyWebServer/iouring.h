@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include "noncopyable.h"
+
+namespace WebSrv
+{
+    /**
+     * @brief io_uring环形队列(直接使用系统调用，不依赖liburing)
+     * 提交端非线程安全，需要调用者加锁；完成端只能由一个线程收割
+     *
+     */
+    class IoUring : NonCopyable
+    {
+    public:
+        IoUring() = default;
+        ~IoUring();
+        /**
+         * @brief 初始化，内核不支持或缺少需要的特性时返回false(errno为原因)
+         *
+         * @param entries 提交队列大小
+         * @return true
+         * @return false
+         */
+        bool init(unsigned entries);
+        /**
+         * @brief 获取一个空的提交项，队列已满返回空
+         *
+         * @return io_uring_sqe*
+         */
+        io_uring_sqe *getSqe();
+        /**
+         * @brief 提交队列剩余空位
+         *
+         */
+        unsigned space() const
+        {
+            return _entries - (_sqeTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE));
+        }
+        /**
+         * @brief 把已填写的提交项发布到内核可见的队列(不进行系统调用)
+         *
+         * @return unsigned 发布数量
+         */
+        unsigned flush();
+        /**
+         * @brief 发布并提交所有提交项，没有待提交项时不进行系统调用
+         *
+         * @return int 提交数量，失败返回-errno
+         */
+        int submit();
+        /**
+         * @brief 提交已发布的提交项并等待至少一个完成项，一次系统调用完成两者
+         *
+         * @param timeout 超时时间(ms)，-1为一直等待
+         * @return int 0成功，失败返回-errno(超时为-ETIME)
+         */
+        int wait(int timeout);
+        /**
+         * @brief 已发布但内核尚未取走的提交项数量
+         *
+         */
+        unsigned unsubmitted() const
+        {
+            return __atomic_load_n(_sqTail, __ATOMIC_RELAXED) - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+        }
+        /**
+         * @brief 是否有未收割的完成项
+         *
+         */
+        bool hasCompletion() const
+        {
+            return *_cqHead != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        }
+        /**
+         * @brief 收割所有完成项
+         *
+         * @tparam F void(uint64_t userData, int res)
+         * @param f
+         * @return unsigned 收割数量
+         */
+        template <class F>
+        unsigned reap(F &&f)
+        {
+            unsigned head = *_cqHead;
+            unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+            unsigned n = tail - head;
+            for (; head != tail; ++head)
+            {
+                io_uring_cqe &cqe = _cqes[head & *_cqMask];
+                f(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+            return n;
+        }
+
+        int getFd() const { return _fd; }
+
+    private:
+        int _fd = -1;
+        void *_sqRing = nullptr;
+        size_t _sqRingSize = 0;
+        void *_cqRing = nullptr;
+        size_t _cqRingSize = 0;
+        io_uring_sqe *_sqes = nullptr;
+        size_t _sqesSize = 0;
+        unsigned _entries = 0;
+
+        unsigned *_sqHead = nullptr;
+        unsigned *_sqTail = nullptr;
+        unsigned *_sqMask = nullptr;
+        unsigned *_sqArray = nullptr;
+        unsigned *_cqHead = nullptr;
+        unsigned *_cqTail = nullptr;
+        unsigned *_cqMask = nullptr;
+        io_uring_cqe *_cqes = nullptr;
+        /// @brief 已填写但尚未提交的提交项区间[_sqeHead, _sqeTail)
+        unsigned _sqeHead = 0;
+        unsigned _sqeTail = 0;
+    };
+} // namespace WebSrv
@@ -26,7 +26,7 @@
                              new WebSrv::LogEvent(logger, level,                                                            \
                                           CALLER_FILE(), CALLER_LINE(), CALLER_FUNCTION(), WebSrv::getElapseTime(), \
                                           WebSrv::getSystemTheadId(), WebSrv::Fiber::getFiberId(),                                            \
-                                          WebSrv::SystemClock::to_time_t(WebSrv::SystemClock::now()),WebSrv::Thread::getName())))             \
+                                          WebSrv::getCachedTime(),WebSrv::Thread::getName())))             \
         .getStringStream()
 #define SRV_LOG_DEBUG(logger) SRV_LOGGER_LEVEL(logger, WebSrv::LogLevel::Debug)
 #define SRV_LOG_INFO(logger) SRV_LOGGER_LEVEL(logger, WebSrv::LogLevel::Info)
@@ -40,7 +40,7 @@
                              new WebSrv::LogEvent(logger, level,                                                            \
                                           CALLER_FILE(), CALLER_LINE(), CALLER_FUNCTION(), WebSrv::getElapseTime(), \
                                           WebSrv::getSystemTheadId(), 0,                                            \
-                                          WebSrv::SystemClock::to_time_t(WebSrv::SystemClock::now()),WebSrv::Thread::getName())))             \
+                                          WebSrv::getCachedTime(),WebSrv::Thread::getName())))             \
         .getEvent()                                                                                                 \
         ->format(fmt, ##__VA_ARGS__)
 
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "noncopyable.h"
+#include "fiber.h"
+
+namespace WebSrv
+{
+    class Scheduler;
+    /**
+     * @brief 阻塞任务线程池：协程把没有非阻塞版本的调用(getaddrinfo、文件io)交给池中线程执行，
+     * 自己挂起直到完成，调度器的工作线程在此期间继续执行其他协程
+     *
+     */
+    class OffloadPool : NonCopyable
+    {
+    public:
+        static OffloadPool *getInstance();
+        /**
+         * @brief 执行阻塞任务并返回其结果，可以卸载时挂起当前协程，完成后在原线程恢复(errno同步回来)；
+         * 否则直接在当前线程执行
+         *
+         * @tparam F 无参可调用对象
+         * @param f
+         * @return f的返回值
+         */
+        template <class F>
+        static auto await(F &&f) -> decltype(f())
+        {
+            using R = decltype(f());
+            if (!canOffload())
+            {
+                return f();
+            }
+            if constexpr (std::is_void_v<R>)
+            {
+                getInstance()->run([&]()
+                                   { f(); });
+            }
+            else
+            {
+                R result{};
+                getInstance()->run([&]()
+                                   { result = f(); });
+                return result;
+            }
+        }
+        /**
+         * @brief 当前是否在调度器的任务协程中(hook已启用)，且不是共享栈协程
+         * (共享栈协程挂起时栈内容被换出，池中线程不能访问栈上的参数和结果)
+         *
+         */
+        static bool canOffload();
+        /**
+         * @brief 交给池中线程执行并挂起当前协程直到完成，必须canOffload()为true
+         *
+         * @param cb
+         */
+        void run(const std::function<void()> &cb);
+        /**
+         * @brief 已卸载执行的任务数量
+         *
+         */
+        uint64_t getOffloadCount() const { return _offloadCount; }
+        /**
+         * @brief 池中线程数量(首次卸载时按配置offload.threads创建)
+         *
+         */
+        size_t getThreadCount() const { return _threads.size(); }
+
+    private:
+        OffloadPool() = default;
+        ~OffloadPool();
+        /**
+         * @brief 等待中的任务，位于挂起协程的栈上
+         *
+         */
+        struct Job
+        {
+            const std::function<void()> *cb;
+            Scheduler *scheduler;
+            Fiber::ptr fiber;
+            std::thread::id threadid;
+            int error = 0;
+        };
+        void start();
+        void worker();
+
+    private:
+        std::once_flag _started;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::deque<Job *> _jobs;
+        std::vector<std::thread> _threads;
+        bool _stopping = false;
+        std::atomic<uint64_t> _offloadCount = 0;
+    };
+} // namespace WebSrv
@@ -1,13 +1,16 @@
 #pragma once
 #include <mutex>
 #include "fiber.h"
+#include "task.h"
 #include <thread>
-#include <list>
+#include <vector>
 #include <atomic>
+#include "workqueue.h"
 namespace WebSrv
 {
     /**
      * @brief 协程调度器，内部包含一个线程池，n+m个协程，每个线程一个主协程和n个子协程
+     * 每个工作线程有自己的无锁任务队列，空闲时从其他线程窃取任务，外部线程的任务进入全局队列
      *
      */
     class Scheduler
@@ -61,16 +64,7 @@ namespace WebSrv
         template <class FiberOrCb>
         void schedule(FiberOrCb fc, std::thread::id threadid =std::thread::id())
         {
-            bool needTickle = false;
-            {
-                std::lock_guard<std::mutex> lock(_mutex);
-                needTickle = scheduleNoLock(fc, threadid);
-            }
-            //当前无执行任务时立刻唤醒线程
-            if (needTickle)
-            {
-                tickle();
-            }
+            scheduleNoLock(std::move(fc), threadid);
         }
 
         /**
@@ -83,20 +77,22 @@ namespace WebSrv
         template <class InputIterator>
         void schedule(InputIterator begin, InputIterator end)
         {
-            bool need_tickle = false;
+            TaskList tasks;
+            while (begin != end)
             {
-                std::lock_guard<std::mutex> lock(_mutex);
-                while (begin != end)
+                Task *task = Task::Create();
+                task->assign(&*begin);
+                if (task->valid())
                 {
-                    need_tickle = scheduleNoLock(&*begin,std::thread::id()) || need_tickle;
-                    ++begin;
+                    tasks.push(task);
                 }
+                else
+                {
+                    Task::Destroy(task);
+                }
+                ++begin;
             }
-            //当前无执行任务时立刻唤醒线程
-            if (need_tickle)
-            {
-                tickle();
-            }
+            pushTasks(tasks);
         }
         /**
          * @brief 切换到指定线程执行
@@ -104,6 +100,32 @@ namespace WebSrv
          * @param thread
          */
         void switchTo(std::thread::id threadid = std::thread::id());
+        /**
+         * @brief 回调函数任务是否运行在共享栈协程上
+         *
+         * @return true
+         * @return false
+         */
+        bool isSharedStack() const { return _sharedStack; }
+        /**
+         * @brief 设置回调函数任务运行在共享栈协程上(适合大量挂起等待的任务)
+         *
+         * @param sharedStack
+         */
+        void setSharedStack(bool sharedStack) { _sharedStack = sharedStack; }
+        /**
+         * @brief 协程挂起等待外部线程(如阻塞任务线程池)恢复前调用，恢复后调用removeExternalWait，
+         * 期间调度器不会停止
+         *
+         */
+        void addExternalWait() { ++_externalWaits; }
+        void removeExternalWait() { --_externalWaits; }
+        /**
+         * @brief 线程池中各线程的id，不包括use_caller线程(它只在stop()时执行调度)
+         *
+         * @return std::vector<std::thread::id>
+         */
+        std::vector<std::thread::id> getPoolThreadIds() const;
 
     protected:
         /**
@@ -111,6 +133,12 @@ namespace WebSrv
          * 
          */
         virtual void tickle();
+        /**
+         * @brief 有任务添加到队列，唤醒指定线程(空id时为任意一个空闲线程)，默认有空闲线程时调用tickle()
+         *
+         * @param threadid
+         */
+        virtual void tickle(std::thread::id threadid);
 
         void run();
 
@@ -124,92 +152,105 @@ namespace WebSrv
          * 
          */
         bool hasIdleThreads() { return _idleThreadCount > 0; }
+        /**
+         * @brief 当前线程是否有可执行的任务(自己的收件箱、全局队列或任意可窃取队列非空)
+         *
+         */
+        bool hasRunnableTask();
+        /**
+         * @brief 当前线程的工作线程下标，不是该调度器的工作线程返回~0
+         *
+         */
+        size_t getWorkerIndex() const;
+        /**
+         * @brief 指定线程的工作线程下标，不存在返回~0
+         *
+         */
+        size_t getWorkerIndex(std::thread::id threadid);
+        /**
+         * @brief 工作线程数量(包括use_caller的线程)
+         *
+         */
+        size_t getWorkerCount() const { return _workers.size(); }
+        /**
+         * @brief 工作线程绑定的线程id，尚未运行返回空id
+         *
+         * @param index 工作线程下标
+         * @return std::thread::id
+         */
+        std::thread::id getWorkerThreadId(size_t index) const { return _workers[index]->threadid; }
+        /**
+         * @brief 批量添加任务：全局队列和每个线程的收件箱各只加一次锁，
+         * 最后只唤醒一次(指定了其他线程的任务唤醒各自的线程)
+         *
+         * @param tasks 任务列表，添加后为空
+         * @param tickleAny 有可由任意线程执行的任务时是否唤醒空闲线程(调用者会自己唤醒时传false)
+         */
+        void pushTasks(TaskList &tasks, bool tickleAny = true);
 
     private:
         template <class FiberOrCb>
-        bool scheduleNoLock(FiberOrCb fc, std::thread::id threadid)
+        void scheduleNoLock(FiberOrCb &&fc, std::thread::id threadid)
         {
-            bool need_tickle = _fibers.empty();
-            FiberAndThread ft(fc, threadid);
-            if (ft._fiber || ft._cb)
+            Task *task = Task::Create();
+            task->assign(std::forward<FiberOrCb>(fc));
+            if (!task->valid())
             {
-                _fibers.push_back(ft);
+                Task::Destroy(task);
+                return;
             }
-            return need_tickle;
+            task->threadid = threadid;
+            pushTask(task);
         }
 
+        struct Worker;
+        /**
+         * @brief 添加任务：指定线程的任务进入该线程的收件箱，工作线程自己添加的任务进入自己的队列，
+         * 其他情况(外部线程、队列已满、指定线程尚未运行)进入全局队列，然后唤醒指定线程或一个空闲线程
+         *
+         * @param task
+         */
+        void pushTask(Task *task);
+        /**
+         * @brief 按顺序从收件箱、自己的队列、全局队列、其他线程的队列取任务
+         *
+         * @param self 当前工作线程，可能为空
+         * @param tickleMe 是否还有其他线程可执行的任务
+         * @return Task*
+         */
+        Task *takeTask(Worker *self, bool &tickleMe);
+        /**
+         * @brief 查找指定线程的工作线程
+         *
+         * @param threadid
+         * @return Worker*
+         */
+        Worker *findWorker(std::thread::id threadid);
+        /**
+         * @brief 当前线程绑定到一个空闲的工作线程槽位
+         *
+         * @return Worker*
+         */
+        Worker *bindWorker();
+
     private:
         /**
-         * @brief 线程或协程
+         * @brief 工作线程的任务队列
          *
          */
-        struct FiberAndThread
+        struct Worker
         {
-            Fiber::ptr _fiber;
-            std::function<void()> _cb;
-            std::thread::id _threadid;
-
-            /**
-             * @brief Construct a new Fiber And Thread object
-             *
-             * @param fiber
-             * @param threadid
-             */
-            FiberAndThread(Fiber::ptr fiber,  std::thread::id threadid)
-                : _fiber(fiber),
-                  _threadid(threadid)
-            {
-            }
-
-            /**
-             * @brief Construct a new Fiber And Thread object
-             *
-             * @param fiber
-             * @param threadid
-             */
-            FiberAndThread(Fiber::ptr *fiber,  std::thread::id threadid)
-                : _threadid(threadid)
-            {
-                _fiber.swap(*fiber);
-            }
-
-            /**
-             * @brief Construct a new Fiber And Thread object
-             *
-             * @param func
-             * @param threadid
-             */
-            FiberAndThread(std::function<void()> func,  std::thread::id threadid)
-                : _cb(func),
-                  _threadid(threadid)
-            {
-            }
-
-            /**
-             * @brief Construct a new Fiber And Thread object
-             *
-             * @param func
-             * @param threadid
-             */
-            FiberAndThread(std::function<void()> *func, std::thread::id threadid)
-                : _threadid(threadid)
-            {
-                _cb.swap(*func);
-            }
-
-            FiberAndThread()
-            {
-            }
-
-            /**
-             * @brief 重置数据
-             */
-            void reset()
-            {
-                _fiber = nullptr;
-                _cb = nullptr;
-                _threadid= std::thread::id();
-            }
+            Worker(size_t idx, size_t capacity) : index(idx), queue(capacity) {}
+            /// @brief 在_workers中的下标
+            size_t index;
+            /// @brief 绑定的线程id，空id表示未绑定
+            std::atomic<std::thread::id> threadid{std::thread::id()};
+            /// @brief 可被窃取的任务队列
+            WorkStealingQueue<Task> queue;
+            /// @brief 指定在该线程执行的任务(不可被窃取)
+            std::mutex mutex;
+            TaskList inbox;
+            std::atomic<size_t> inboxSize = 0;
         };
 
     private:
@@ -219,8 +260,14 @@ namespace WebSrv
         std::vector<std::thread> _threads;
         /// @brief 主线程的协程
         Fiber::ptr _rootFiber;
-        /// @brief 协程任务队列
-        std::list<FiberAndThread> _fibers;
+        /// @brief 全局任务队列(外部线程添加的任务)
+        TaskList _fibers;
+        /// @brief 全局任务队列大小
+        std::atomic<size_t> _globalSize = 0;
+        /// @brief 工作线程任务队列，构造后数量不变
+        std::vector<std::unique_ptr<Worker>> _workers;
+        /// @brief 所有队列中的任务数量
+        std::atomic<uint64_t> _taskCount = 0;
     protected:
         /// @brief 协程下的线程id数组
         std::vector<std::thread::id> _threadIds;
@@ -229,9 +276,13 @@ namespace WebSrv
         /// @brief 活动协程数量
         std::atomic<uint64_t> _activeThreadCount = 0;
         /// @brief 是否正在停止
-        bool _stopping = true;
+        std::atomic<bool> _stopping = true;
+        /// @brief 挂起等待外部线程恢复的协程数量
+        std::atomic<uint64_t> _externalWaits = 0;
         /// @brief 是否自动停止
         bool _autoStop = false;
+        /// @brief 回调函数任务是否使用共享栈协程
+        bool _sharedStack = false;
         /// @brief 主线程id(use_caller)
         std::thread::id _rootThreadid;
         /// @brief 线程数量
@@ -1,6 +1,7 @@
 #pragma once
 #include "noncopyable.h"
 #include "address.h"
+#include <fcntl.h>
 
 namespace WebSrv
 {
@@ -152,13 +153,30 @@ namespace WebSrv
 
         int getError();
 
-        bool bind(Address::ptr address);
+        /**
+         * @brief 绑定地址
+         *
+         * @param address
+         * @param reusePort 是否设置SO_REUSEPORT(多个socket监听同一地址，由内核分散新连接)
+         * @return true
+         * @return false
+         */
+        bool bind(Address::ptr address, bool reusePort = false);
 
         virtual bool listen(int backlog = SOMAXCONN);
 
         virtual bool close();
 
         virtual Socket::ptr accept();
+        /**
+         * @brief 批量接收连接：等待到第一个连接后，继续用非阻塞accept4取出积压的连接，直到取空或达到max。
+         * 新连接由accept4直接设置非阻塞和CLOEXEC，TCP_NODELAY等选项从监听socket继承，不再逐个设置
+         *
+         * @param clients 接收到的连接追加到其中
+         * @param max 最多接收数量
+         * @return size_t 接收数量，0为出错(errno为原因)
+         */
+        virtual size_t acceptBatch(std::vector<Socket::ptr> &clients, size_t max);
 
         virtual bool connect(const Address::ptr addr, int64_t timeoutMs = -1);
 
@@ -176,19 +194,47 @@ namespace WebSrv
         virtual int recvFrom(void *buffer, size_t length,  Address::ptr from, int flags = 0);
         virtual int recvFrom(iovec *buffers, size_t length,  Address::ptr from, int flags = 0);
         /**
-         * @brief 获取远端地址
+         * @brief 把文件内容直接发送到socket(sendfile)，不经过用户空间，超时同send
+         *
+         * @param fd 文件句柄
+         * @param offset 文件偏移，返回时更新为已发送的末尾，nullptr为使用并更新文件当前偏移
+         * @param count 最多发送的字节数
+         * @return ssize_t 发送的字节数，失败返回-1
+         */
+        virtual ssize_t sendFile(int fd, off_t *offset, size_t count);
+        /**
+         * @brief 从句柄(管道，或一端为管道时的文件/socket)直接转移数据到socket(splice)，超时同send
+         *
+         * @param fd 输入句柄，和socket之间必须有一端是管道
+         * @param offset 输入偏移，nullptr为使用句柄当前偏移(管道必须为nullptr)
+         * @param length 最多转移的字节数
+         * @param flags splice标志
+         * @return ssize_t 转移的字节数，失败返回-1
+         */
+        virtual ssize_t spliceFrom(int fd, loff_t *offset, size_t length, unsigned int flags = SPLICE_F_MOVE | SPLICE_F_MORE);
+        /**
+         * @brief 从socket直接转移数据到管道(splice)，超时同recv
+         *
+         * @param fd 输出管道
+         * @param length 最多转移的字节数
+         * @param flags splice标志
+         * @return ssize_t 转移的字节数，对端关闭返回0，失败返回-1
+         */
+        virtual ssize_t spliceTo(int fd, size_t length, unsigned int flags = SPLICE_F_MOVE);
+        /**
+         * @brief 获取远端地址(未知时通过getpeername获取)
          *
          * @return Address::ptr
          */
 
-        Address::ptr getRemoteAddress() const{return _remoteAddress;}
+        Address::ptr getRemoteAddress() const;
 
         /**
-         * @brief 获取本地地址
+         * @brief 获取本地地址(接收的连接监听在通配地址上时，首次获取才调用getsockname)
          *
          * @return Address::ptr
          */
-        Address::ptr getLocalAddress() const{return _localAddress;}
+        Address::ptr getLocalAddress() const;
 
         /**
          * @brief 获取协议簇
@@ -235,6 +281,15 @@ namespace WebSrv
         void initSocket();
         void initRemoteAddress();
         bool init(int socket);
+        /**
+         * @brief 包装accept4得到的已注册非阻塞连接，远端地址来自accept4，本地地址尽量沿用监听socket的
+         *
+         * @param socket
+         * @param peer accept4返回的远端地址
+         * @param peerLen
+         * @return Socket::ptr
+         */
+        Socket::ptr wrapAccepted(int socket, const sockaddr *peer, socklen_t peerLen);
     protected:
         int _socket;
         // 协议簇
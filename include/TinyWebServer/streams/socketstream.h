@@ -65,6 +65,56 @@ namespace WebSrv
          * @retval <0 流错误
          */
         int write(ByteArray::ptr ba, size_t len) override;
+        /**
+         * @brief 一次系统调用写多块数据(sendmsg)
+         *
+         * @param buffers 数据块
+         * @param count 数据块数量
+         * @return int
+         * @retval >0 发送数据长度(可能只发送了一部分)
+         * @retval =0 流关闭
+         * @retval <0 流错误
+         */
+        int writev(const iovec *buffers, size_t count);
+        /**
+         * @brief 写完所有数据块，部分发送时调整buffers后继续发送
+         *
+         * @param buffers 数据块，返回时内容已被修改
+         * @param count 数据块数量
+         * @return int64_t 成功返回总长度，否则同writev
+         */
+        int64_t writevFixSize(iovec *buffers, size_t count);
+        /**
+         * @brief 零拷贝发送文件的[offset, offset + length)部分(sendfile)，发送完或出错才返回
+         *
+         * @param fd 文件句柄，不改变其当前偏移
+         * @param offset 起始偏移
+         * @param length 发送长度
+         * @return int64_t
+         * @retval >0 成功，返回length
+         * @retval =0 流关闭或文件提前结束
+         * @retval <0 流错误
+         */
+        int64_t sendFile(int fd, off_t offset, size_t length);
+        /**
+         * @brief 零拷贝把管道中的数据转移到socket(splice)，转移完length或出错才返回
+         *
+         * @param fd 管道读端
+         * @param length 转移长度
+         * @return int64_t 同sendFile，管道写端关闭返回0
+         */
+        int64_t spliceFrom(int fd, size_t length);
+        /**
+         * @brief 零拷贝把socket收到的数据转移到管道(splice)
+         *
+         * @param fd 管道写端
+         * @param length 最多转移的长度
+         * @return int64_t
+         * @retval >0 转移数据长度
+         * @retval =0 流关闭
+         * @retval <0 流错误
+         */
+        int64_t spliceTo(int fd, size_t length);
 
         /**
          * @brief 关闭socket
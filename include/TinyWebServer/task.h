@@ -0,0 +1,277 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace WebSrv
+{
+    /**
+     * @brief 只可移动的无返回值可调用对象，不超过INLINE_SIZE的可调用对象直接存放在内部缓冲区不分配内存
+     *
+     */
+    class TaskFunction : NonCopyable
+    {
+    public:
+        /// @brief 内部缓冲区大小(可放下std::function或捕获几个指针的lambda)
+        static constexpr size_t INLINE_SIZE = 48;
+
+        TaskFunction() = default;
+
+        template <class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TaskFunction>>>
+        TaskFunction(F &&f)
+        {
+            assign(std::forward<F>(f));
+        }
+
+        TaskFunction(TaskFunction &&other) noexcept
+        {
+            moveFrom(other);
+        }
+
+        TaskFunction &operator=(TaskFunction &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        ~TaskFunction() { reset(); }
+
+        void operator()() { _ops->invoke(_buf); }
+
+        explicit operator bool() const { return _ops != nullptr; }
+
+        /**
+         * @brief 释放可调用对象
+         *
+         */
+        void reset()
+        {
+            if (_ops)
+            {
+                _ops->destroy(_buf);
+                _ops = nullptr;
+            }
+        }
+
+    private:
+        struct Ops
+        {
+            void (*invoke)(void *buf);
+            void (*move)(void *dst, void *src);
+            void (*destroy)(void *buf);
+        };
+
+        template <class F>
+        static constexpr bool isInline()
+        {
+            return sizeof(F) <= INLINE_SIZE &&
+                   alignof(F) <= alignof(std::max_align_t) &&
+                   std::is_nothrow_move_constructible_v<F>;
+        }
+
+        /**
+         * @brief 直接存放在缓冲区的可调用对象
+         *
+         */
+        template <class F>
+        struct InlineOps
+        {
+            static void invoke(void *buf) { (*(F *)buf)(); }
+            static void move(void *dst, void *src)
+            {
+                new (dst) F(std::move(*(F *)src));
+                ((F *)src)->~F();
+            }
+            static void destroy(void *buf) { ((F *)buf)->~F(); }
+            static constexpr Ops ops = {&invoke, &move, &destroy};
+        };
+
+        /**
+         * @brief 过大的可调用对象放在堆上，缓冲区只存放指针
+         *
+         */
+        template <class F>
+        struct HeapOps
+        {
+            static void invoke(void *buf) { (**(F **)buf)(); }
+            static void move(void *dst, void *src) { *(F **)dst = *(F **)src; }
+            static void destroy(void *buf) { delete *(F **)buf; }
+            static constexpr Ops ops = {&invoke, &move, &destroy};
+        };
+
+        template <class F>
+        void assign(F &&f)
+        {
+            using Fn = std::decay_t<F>;
+            if constexpr (std::is_same_v<Fn, std::function<void()>>)
+            {
+                // 空的std::function视为没有任务
+                if (!f)
+                {
+                    return;
+                }
+            }
+            if constexpr (isInline<Fn>())
+            {
+                new (_buf) Fn(std::forward<F>(f));
+                _ops = &InlineOps<Fn>::ops;
+            }
+            else
+            {
+                *(Fn **)_buf = new Fn(std::forward<F>(f));
+                _ops = &HeapOps<Fn>::ops;
+            }
+        }
+
+        void moveFrom(TaskFunction &other)
+        {
+            if (other._ops)
+            {
+                other._ops->move(_buf, other._buf);
+                _ops = other._ops;
+                other._ops = nullptr;
+            }
+        }
+
+    private:
+        alignas(std::max_align_t) unsigned char _buf[INLINE_SIZE];
+        const Ops *_ops = nullptr;
+    };
+
+    struct TaskCache;
+
+    /**
+     * @brief 调度任务(协程或回调函数)，带侵入式next指针直接串入调度队列，
+     * 由线程缓存分配回收，稳定运行时调度任务不分配内存
+     *
+     */
+    struct Task : NonCopyable
+    {
+        /**
+         * @brief 从当前线程缓存分配任务
+         *
+         * @return Task*
+         */
+        static Task *Create();
+        /**
+         * @brief 释放任务，其他线程释放的任务归还到分配线程的缓存，缓存已满或已交出时直接delete
+         *
+         * @param task
+         */
+        static void Destroy(Task *task);
+
+        /**
+         * @brief 设置任务内容(协程或回调函数)，指针形式会移走原对象(原对象置空)
+         *
+         */
+        template <class F>
+        void assign(F &&f)
+        {
+            using Fn = std::decay_t<F>;
+            if constexpr (std::is_same_v<Fn, Fiber::ptr>)
+            {
+                fiber = std::forward<F>(f);
+            }
+            else if constexpr (std::is_same_v<Fn, Fiber::ptr *>)
+            {
+                fiber.swap(*f);
+            }
+            else if constexpr (std::is_same_v<Fn, std::function<void()> *>)
+            {
+                cb = TaskFunction(std::move(*f));
+                *f = nullptr;
+            }
+            else
+            {
+                cb = TaskFunction(std::forward<F>(f));
+            }
+        }
+
+        /**
+         * @brief 是否为有效任务
+         *
+         */
+        bool valid() const { return fiber || cb; }
+
+        Fiber::ptr fiber;
+        TaskFunction cb;
+        /// @brief 指定执行的线程，空id为任意线程
+        std::thread::id threadid;
+        /// @brief 队列中的下一个任务
+        Task *next = nullptr;
+        /// @brief 分配该任务的线程缓存，为空时释放直接delete
+        TaskCache *owner = nullptr;
+    };
+
+    /**
+     * @brief 侵入式任务队列(非线程安全)
+     *
+     */
+    struct TaskList
+    {
+        void push(Task *task)
+        {
+            task->next = nullptr;
+            if (tail)
+            {
+                tail->next = task;
+            }
+            else
+            {
+                head = task;
+            }
+            tail = task;
+        }
+
+        Task *pop()
+        {
+            Task *task = head;
+            if (task)
+            {
+                head = task->next;
+                if (!head)
+                {
+                    tail = nullptr;
+                }
+                task->next = nullptr;
+            }
+            return task;
+        }
+
+        /**
+         * @brief 移除prev之后的任务(prev为空时移除队头)
+         *
+         * @param prev
+         * @return Task*
+         */
+        Task *removeAfter(Task *prev)
+        {
+            if (!prev)
+            {
+                return pop();
+            }
+            Task *task = prev->next;
+            prev->next = task->next;
+            if (tail == task)
+            {
+                tail = prev;
+            }
+            task->next = nullptr;
+            return task;
+        }
+
+        bool empty() const { return head == nullptr; }
+
+        Task *head = nullptr;
+        Task *tail = nullptr;
+    };
+} // namespace WebSrv
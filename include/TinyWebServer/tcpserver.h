@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include "socket.h"
 #include "noncopyable.h"
 #include "iomanager.h"
@@ -83,6 +85,73 @@ namespace WebSrv
          * @param recvTimeout
          */
         void setSendTimeout(uint64_t sendTimeout) { _sendTimeout = sendTimeout; }
+        /**
+         * @brief 连接处理协程是否使用共享栈
+         *
+         * @return true
+         * @return false
+         */
+        bool isSharedStack() const { return _sharedStack; }
+        /**
+         * @brief 设置连接处理协程使用共享栈，大量空闲长连接时挂起的协程只占用已使用的栈大小
+         *
+         * @param sharedStack
+         */
+        void setSharedStack(bool sharedStack) { _sharedStack = sharedStack; }
+        /**
+         * @brief 是否为多监听模式
+         *
+         * @return true
+         * @return false
+         */
+        bool isReusePort() const { return _reusePort; }
+        /**
+         * @brief 设置多监听模式(需在listen前设置)：每个地址为ioWorker的每个线程打开一个SO_REUSEPORT监听socket，
+         * 接收循环固定在对应线程，由内核分散新连接，连接在接收它的线程处理(不使用acceptWorker)，
+         * ioWorker为连接亲和模式时之后该连接的事件也都在这个线程处理
+         *
+         * @param reusePort
+         */
+        void setReusePort(bool reusePort) { _reusePort = reusePort; }
+        /**
+         * @brief 最大并发连接数，0为不限制
+         *
+         */
+        uint32_t getMaxConnections() const { return _maxConnections; }
+        /**
+         * @brief 设置最大并发连接数(0为不限制)：达到上限后接收循环挂起，不再接收新连接(留在内核积压队列中)，
+         * 直到有连接处理结束
+         *
+         * @param maxConnections
+         */
+        void setMaxConnections(uint32_t maxConnections) { _maxConnections = maxConnections; }
+        /**
+         * @brief 每秒最多接收的连接数，0为不限制
+         *
+         */
+        uint32_t getMaxAcceptRate() const { return _maxAcceptRate; }
+        /**
+         * @brief 设置每秒最多接收的连接数(0为不限制，需在start前设置)，按令牌桶计算，最多积累1秒的突发
+         *
+         * @param maxAcceptRate
+         */
+        void setMaxAcceptRate(uint32_t maxAcceptRate) { _maxAcceptRate = maxAcceptRate; }
+        /**
+         * @brief 每次就绪最多接收的连接数
+         *
+         */
+        uint32_t getAcceptBatch() const { return _acceptBatch; }
+        /**
+         * @brief 设置每次就绪最多接收的连接数
+         *
+         * @param acceptBatch
+         */
+        void setAcceptBatch(uint32_t acceptBatch) { _acceptBatch = acceptBatch ? acceptBatch : 1; }
+        /**
+         * @brief 当前连接数(包括已为接收预留的名额)
+         *
+         */
+        uint64_t getConnectionCount() const { return _connections; }
         /**
          * @brief 获取服务器名
          *
@@ -128,12 +197,42 @@ namespace WebSrv
          * @param sock
          */
         virtual void startAccept(Socket::ptr sock);
+        /**
+         * @brief 准入控制：为接收连接预留名额，达到最大连接数时挂起等待连接结束，超过接收速率时休眠等待令牌
+         *
+         * @param want 希望接收的数量
+         * @return size_t 预留的名额(不超过want)，服务停止时返回0
+         */
+        size_t admit(size_t want);
+        /**
+         * @brief 归还名额，有接收循环在等待时唤醒
+         *
+         * @param count
+         */
+        void release(size_t count = 1);
+        /**
+         * @brief 从令牌桶取令牌
+         *
+         * @param want
+         * @param waitMs 没有令牌时返回距下一个令牌的时间
+         * @return size_t 取到的令牌数
+         */
+        size_t takeAcceptTokens(size_t want, uint64_t &waitMs);
+        /**
+         * @brief 处理连接，结束后归还名额
+         *
+         * @param client
+         */
+        void serveClient(Socket::ptr client);
 
     protected:
         /// @brief 监听socket
         std::vector<Socket::ptr> _socks;
+        /// @brief 监听socket的接收循环固定的线程(多监听模式)，空id为不固定
+        std::vector<std::thread::id> _acceptThreads;
         /// @brief 新连接工作调度
         IOManager *_worker;
+        /// @brief 连接处理调度(连接亲和模式下连接按线程分片)
         IOManager *_ioWorker;
         /// @brief 接收连接工作调度
         IOManager *_acceptWorker;
@@ -143,6 +242,32 @@ namespace WebSrv
         uint64_t _sendTimeout;
         /// @brief 是否停止服务
         bool _stop;
+        /// @brief 连接处理协程是否使用共享栈
+        bool _sharedStack;
+        /// @brief 多监听模式(SO_REUSEPORT)
+        bool _reusePort;
+        /// @brief 最大并发连接数，0为不限制
+        uint32_t _maxConnections;
+        /// @brief 每秒最多接收的连接数，0为不限制
+        uint32_t _maxAcceptRate;
+        /// @brief 每次就绪最多接收的连接数
+        uint32_t _acceptBatch;
+        /// @brief 当前连接数(包括预留的名额)
+        std::atomic<uint64_t> _connections = 0;
+        /// @brief 保护等待名额的接收循环和令牌桶
+        std::mutex _admissionMutex;
+        /// @brief 达到最大连接数后挂起的接收循环
+        struct AcceptWaiter
+        {
+            Scheduler *scheduler;
+            Fiber::ptr fiber;
+            std::thread::id threadid;
+        };
+        std::vector<AcceptWaiter> _acceptWaiters;
+        std::atomic<bool> _hasAcceptWaiters = false;
+        /// @brief 令牌桶剩余令牌和上次补充的时间(ms)
+        double _acceptTokens = 0;
+        uint64_t _acceptRefillTime = 0;
         /// @brief 服务器名称
         std::string _name;
         /// @brief 服务器类型
@@ -3,6 +3,7 @@
 #include <functional>
 #include "mutex.h"
 #include <set>
+#include <vector>
 namespace WebSrv
 {
     class TimerManager;
@@ -18,7 +19,9 @@ namespace WebSrv
         using ptr=std::shared_ptr<Timer>;
         /**
          * @brief 取消定时器
-         * 
+         * 非循环定时器惰性取消：只标记并释放回调，不加锁也不从时间轮/有序集合中移除，
+         * 节点在到期、下移或已取消的超过一半时清理
+         *
          */
         bool cannel();
         /**
@@ -45,8 +48,9 @@ namespace WebSrv
          * @param cb 回调函数
          * @param recurring 是否循环执行
          * @param manager 定时器管理
+         * @param slack 允许的延迟(ms)
          */
-        Timer(uint64_t ms,std::function<void()> cb, bool recurring,TimerManager* manager);
+        Timer(uint64_t ms,std::function<void()> cb, bool recurring,TimerManager* manager,uint64_t slack = 0);
         
         /**
          * @brief 用来取超时部分用的
@@ -63,6 +67,27 @@ namespace WebSrv
         {
             bool operator()(const Timer::ptr& lhs,const Timer::ptr& rhs) const;
         };
+
+        /**
+         * @brief 执行时间向上取整到合并粒度，同一粒度内的定时器共用一个执行时间
+         *
+         * @param next
+         * @return uint64_t
+         */
+        uint64_t coalesce(uint64_t next) const
+        {
+            return _slack ? (next + _slack - 1) & ~(_slack - 1) : next;
+        }
+        /**
+         * @brief 是否已惰性取消(只用于非循环定时器)
+         *
+         */
+        bool isLazyCancelled() const { return !_recurring && _done; }
+        /**
+         * @brief 是否还在等待执行(需持有所在时间轮或集合的锁)
+         *
+         */
+        bool isPending() const { return _recurring ? (bool)_cb : !_done; }
         
         //结束所有循环任务
     private:
@@ -73,22 +98,46 @@ namespace WebSrv
         TimerManager *_manager = nullptr;
         // 时间戳
         uint64_t _next;
+        // 合并粒度(2的幂，0为不合并)
+        uint64_t _slack = 0;
+        // 非循环定时器：已执行或已取消，先置位的一方拥有回调
+        std::atomic<bool> _done = false;
+        // 时间轮：所在的时间轮、槽位(-1为不在时间轮中)和槽位链表指针
+        size_t _shard = 0;
+        int _slot = -1;
+        Timer *_prevNode = nullptr;
+        Timer *_nextNode = nullptr;
+        // 时间轮：在时间轮中时持有自身
+        Timer::ptr _hold;
     };
 
 
+    /**
+     * @brief 定时器管理
+     * 默认使用分层时间轮(添加、取消O(1))，每个线程一个时间轮，添加定时器时只锁自己线程的时间轮；
+     * 配置timer.wheel为false时使用原来的有序集合
+     *
+     */
     class TimerManager{
     friend class Timer;
     public:
-        TimerManager()=default;
-        virtual ~TimerManager()=default;
+        /**
+         * @brief Construct a new Timer Manager object
+         *
+         * @param shards 时间轮数量，由getTimerShard()决定添加到哪个时间轮
+         */
+        TimerManager(size_t shards = 1);
+        virtual ~TimerManager();
         /**
          * @brief Construct a new Timer object
          *
          * @param ms 定时器执行间隔
          * @param cb 回调函数
          * @param recurring 是否循环执行
+         * @param slack 允许的延迟(ms)，执行时间向上取整到不超过slack的2的幂，
+         * 相近的定时器合并到同一个执行时间，减少唤醒次数(用于很少真正触发的超时定时器)
          */
-        Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring=false);
+        Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring=false, uint64_t slack=0);
 
         /**
          * @brief 条件定时器
@@ -97,9 +146,10 @@ namespace WebSrv
          * @param cb 回调函数
          * @param recurring 是否循环执行
          * @param cond 条件回调
+         * @param slack 允许的延迟(ms)
          * @return Timer::ptr 
          */
-        Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::function<bool()> condCb,bool recurring=false);
+        Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::function<bool()> condCb,bool recurring=false, uint64_t slack=0);
 
         /**
          * @brief 获取超时定时器列表
@@ -137,10 +187,41 @@ namespace WebSrv
          * 
          */
         virtual void onTimerInsertedAtFront()=0;
+        /**
+         * @brief 当前线程添加定时器使用的时间轮下标
+         *
+         */
+        virtual size_t getTimerShard() const { return 0; }
+    private:
+        struct TimerWheel;
+        /**
+         * @brief 定时器加入时间轮，比当前最早的定时器更早时触发onTimerInsertedAtFront
+         *
+         * @param timer
+         */
+        void wheelInsert(const Timer::ptr &timer);
+        /**
+         * @brief 定时器是否提前到了最早，是则调用onTimerInsertedAtFront
+         *
+         * @param next 定时器执行时间
+         */
+        void wheelCheckFront(uint64_t next);
+        /**
+         * @brief 惰性取消的定时器超过一半时从有序集合中移除(需持有写锁)
+         *
+         */
+        void sweepTimerSet();
     private:
+        /// @brief 是否使用时间轮
+        bool _useWheel = true;
+        std::vector<std::unique_ptr<TimerWheel>> _wheels;
+        /// @brief 时间轮中已知最早的执行时间，更早的定时器插入时需要唤醒
+        std::atomic<uint64_t> _earliest = ~0ull;
         std::atomic_bool _closeRecurring=false;
         std::shared_mutex _rWMutex;
         std::set<Timer::ptr,Timer::Comparator> _timerSet;
+        /// @brief 有序集合中惰性取消还未移除的定时器数量
+        std::atomic<int64_t> _deadTimers = 0;
         //触发一次后就要使用getNextTimer重新读时间，所以不用反复触发
         bool _tickled=false;
         //std::mutex _mutex;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <functional>
 #include <fstream>
 #include <chrono>
 #include <string>
@@ -154,6 +156,43 @@ namespace WebSrv
     //获取毫秒级时间戳
     uint64_t getCurrentMilliseconds();
 
+    /**
+     * @brief 单调时钟毫秒数(不受系统时间调整影响，用于定时器和超时)
+     * 开启时钟缓存的线程返回最近一次刷新的值
+     *
+     * @return uint64_t
+     */
+    uint64_t getMonotonicMilliseconds();
+
+    /**
+     * @brief 墙上时间(秒)，用于日志时间戳
+     * 开启时钟缓存的线程返回缓存的值，跨秒后的第一次刷新时重新读取
+     *
+     * @return time_t
+     */
+    time_t getCachedTime();
+
+    /**
+     * @brief 开启/关闭当前线程的时钟缓存，开启时立即刷新
+     * 事件循环线程开启后每轮循环调用refreshClockCache()，循环中读取时钟不再调用clock_gettime
+     *
+     * @param enable
+     */
+    void setClockCache(bool enable);
+
+    /**
+     * @brief 刷新当前线程的时钟缓存(未开启时不做任何事)
+     *
+     */
+    void refreshClockCache();
+
+    /**
+     * @brief 读取系统时钟(clock_gettime)的总次数，用于统计
+     *
+     * @return uint64_t
+     */
+    uint64_t getClockReads();
+
 
     /**
      * @brief 获取当前调用栈
@@ -239,23 +278,56 @@ namespace WebSrv
     };
 
     /**
-     * @brief 解析url
+     * @brief 解析绝对url：scheme "://" authority path ["?" query] ["#" fragment] (RFC3986)，
+     * 各部分保持编码形式不解码
      * 
      * @param url 
      * @param res 
      * @return true 
      * @return false 
      */
-    bool parseURL(const std::string& url,URL& res);
+    bool parseURL(std::string_view url,URL& res);
     /**
-     * @brief 解析url相对路径（不包含主机名和协议）
+     * @brief 解析url相对路径（不包含主机名和协议）：path ["?" query] ["#" fragment]，各部分保持编码形式不解码
      * 
      * @param url 
      * @param res 
      * @return true 
-     * @return false 
+     * @return false 包含控制字符或空格
+     */
+    bool parse2URL(std::string_view url,URL& res);
+    /**
+     * @brief 原地百分号解码，格式错误的%序列原样保留
+     *
+     * @param data
+     * @param len
+     * @param plusAsSpace 是否把'+'解码为空格(application/x-www-form-urlencoded)
+     * @return size_t 解码后的长度(不超过len)
+     */
+    size_t percentDecode(char *data, size_t len, bool plusAsSpace = false);
+    /**
+     * @brief 原地移除路径中的"."和".."段(RFC 3986 5.2.4)，解码后的路径使用前调用
+     *
+     * @param path
+     * @return true
+     * @return false ".."超出根目录
+     */
+    bool removeDotSegments(std::string &path);
+    /**
+     * @brief 百分号编码，只保留非保留字符(字母、数字和-._~)
+     *
+     * @param str
+     * @param spaceAsPlus 是否把空格编码为'+'(application/x-www-form-urlencoded)
+     * @return std::string
+     */
+    std::string percentEncode(std::string_view str, bool spaceAsPlus = false);
+    /**
+     * @brief 解析查询字符串(key=value&key2=value2)，键和值按表单编码解码，空键忽略，没有'='时值为空
+     *
+     * @param query
+     * @param cb 依次回调解码后的键和值
      */
-    bool parse2URL(const std::string& url,URL& res);
+    void parseQuery(std::string_view query, const std::function<void(std::string &key, std::string &value)> &cb);
 
     template <class V, class Map, class K>
     V GetParamValue(const Map &m, const K &k, const V &def = V())
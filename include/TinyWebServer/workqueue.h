@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "noncopyable.h"
+
+namespace WebSrv
+{
+    /**
+     * @brief 有界无锁工作窃取队列(Chase-Lev)，只有所属线程可以push，任意线程可以steal
+     * 所属线程也通过steal从队头取任务，保证先进先出(yieldToReady的协程不会一直插队)
+     *
+     * @tparam T 元素类型(保存指针)
+     */
+    template <class T>
+    class WorkStealingQueue : NonCopyable
+    {
+    public:
+        /**
+         * @brief Construct a new Work Stealing Queue object
+         *
+         * @param capacity 容量，向上取整为2的幂
+         */
+        explicit WorkStealingQueue(size_t capacity)
+        {
+            size_t cap = 1;
+            while (cap < capacity)
+            {
+                cap <<= 1;
+            }
+            _mask = cap - 1;
+            _buffer.reset(new std::atomic<T *>[cap]);
+            for (size_t i = 0; i < cap; ++i)
+            {
+                _buffer[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief 添加到队尾(仅所属线程)
+         *
+         * @param item
+         * @return true 添加成功
+         * @return false 队列已满
+         */
+        bool push(T *item)
+        {
+            int64_t b = _bottom.load(std::memory_order_relaxed);
+            int64_t t = _top.load(std::memory_order_acquire);
+            if (b - t > (int64_t)_mask)
+            {
+                return false;
+            }
+            _buffer[b & _mask].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * @brief 从队头取出(任意线程)，与其他线程竞争失败时返回空
+         *
+         * @return T*
+         */
+        T *steal()
+        {
+            int64_t t = _top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = _bottom.load(std::memory_order_acquire);
+            if (t >= b)
+            {
+                return nullptr;
+            }
+            T *item = _buffer[t & _mask].load(std::memory_order_relaxed);
+            if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return item;
+        }
+
+        /**
+         * @brief 近似元素数量
+         *
+         * @return size_t
+         */
+        size_t size() const
+        {
+            int64_t b = _bottom.load(std::memory_order_relaxed);
+            int64_t t = _top.load(std::memory_order_relaxed);
+            return b > t ? (size_t)(b - t) : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+        /**
+         * @brief 队列容量
+         *
+         * @return size_t
+         */
+        size_t capacity() const { return _mask + 1; }
+
+    private:
+        /// @brief 队头，窃取端(独占缓存行，避免与队尾伪共享)
+        alignas(64) std::atomic<int64_t> _top{0};
+        /// @brief 队尾，所属线程写入端
+        alignas(64) std::atomic<int64_t> _bottom{0};
+        size_t _mask = 0;
+        std::unique_ptr<std::atomic<T *>[]> _buffer;
+    };
+} // namespace WebSrv
@@ -1,13 +1,87 @@
 #include "address.h"
 #include <string>
 #include "log.h"
+#include "configurator.h"
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
+#include <unordered_map>
 
 namespace WebSrv
 {
     static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
+
+    static ConfigVar<uint32_t>::ptr g_lookupCacheTtl =
+        Configurator::lookup<uint32_t>("address.lookup_cache_ttl", 30000, "address lookup cache ttl ms, 0 disable cache");
+
+    static ConfigVar<uint32_t>::ptr g_lookupCacheSize =
+        Configurator::lookup<uint32_t>("address.lookup_cache_size", 1024, "address lookup cache max entries");
+
+    /**
+     * @brief lookup的解析缓存，getaddrinfo不返回记录的TTL，统一按配置的时间过期
+     *
+     */
+    struct LookupCache
+    {
+        struct Entry
+        {
+            std::vector<Address::ptr> addrs;
+            /// @brief 过期时间(单调时钟ms)
+            uint64_t expire;
+        };
+        RWMutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    static LookupCache &getLookupCache()
+    {
+        static LookupCache cache;
+        return cache;
+    }
+
+    /**
+     * @brief 查缓存，命中时把地址的副本加入result(调用者可能修改地址，如setPort)
+     *
+     */
+    static bool findLookupCache(const std::string &key, std::vector<Address::ptr> &result)
+    {
+        LookupCache &cache = getLookupCache();
+        ReadMutex lock(cache.mutex);
+        auto it = cache.entries.find(key);
+        if (it == cache.entries.end() || it->second.expire <= getMonotonicMilliseconds())
+        {
+            return false;
+        }
+        for (auto &addr : it->second.addrs)
+        {
+            result.emplace_back(Address::create(addr->getAddr(), addr->getAddrLen()));
+        }
+        return true;
+    }
+
+    static void storeLookupCache(const std::string &key, const std::vector<Address::ptr> &addrs, uint64_t ttl)
+    {
+        LookupCache &cache = getLookupCache();
+        uint64_t now = getMonotonicMilliseconds();
+        WriteMutex lock(cache.mutex);
+        size_t maxSize = g_lookupCacheSize->getValue();
+        if (cache.entries.size() >= maxSize && !cache.entries.count(key))
+        {
+            // 先清除过期的，仍然满时随便淘汰一个
+            for (auto it = cache.entries.begin(); it != cache.entries.end();)
+            {
+                it = it->second.expire <= now ? cache.entries.erase(it) : std::next(it);
+            }
+            if (cache.entries.size() >= maxSize && !cache.entries.empty())
+            {
+                cache.entries.erase(cache.entries.begin());
+            }
+        }
+        if (maxSize)
+        {
+            cache.entries[key] = {addrs, now + ttl};
+        }
+    }
     // 生成不同位数的掩码
     template <class T>
     static T createMask(uint32_t bits)
@@ -51,6 +125,17 @@ namespace WebSrv
 
     bool Address::lookup(std::vector<Address::ptr> &result, const std::string &host, int family, int type, int protocol)
     {
+        uint64_t ttl = g_lookupCacheTtl->getValue();
+        std::string key;
+        if (ttl)
+        {
+            key = std::to_string(family) + ',' + std::to_string(type) + ',' + std::to_string(protocol) + ',' + host;
+            if (findLookupCache(key, result))
+            {
+                return true;
+            }
+        }
+
         addrinfo hints{}, *results, *next;
         hints.ai_flags = 0;
         hints.ai_family = family;
@@ -98,6 +183,7 @@ namespace WebSrv
             node = host;
         }
 
+        // 在调度器协程中由hook交给阻塞任务线程池执行
         int ret = getaddrinfo(node.c_str(), service, &hints, &results);
         if (ret)
         {
@@ -105,16 +191,36 @@ namespace WebSrv
             return false;
         }
 
+        std::vector<Address::ptr> addrs;
         next = results;
         while (next)
         {
-            result.emplace_back(create(next->ai_addr, (socklen_t)next->ai_addrlen));
+            addrs.emplace_back(create(next->ai_addr, (socklen_t)next->ai_addrlen));
             next = next->ai_next;
         }
         freeaddrinfo(results);
+        if (ttl && !addrs.empty())
+        {
+            storeLookupCache(key, addrs, ttl);
+            for (auto &addr : addrs)
+            {
+                result.emplace_back(create(addr->getAddr(), addr->getAddrLen()));
+            }
+        }
+        else
+        {
+            result.insert(result.end(), addrs.begin(), addrs.end());
+        }
         return !result.empty();
     }
 
+    void Address::clearLookupCache()
+    {
+        LookupCache &cache = getLookupCache();
+        WriteMutex lock(cache.mutex);
+        cache.entries.clear();
+    }
+
     Address::ptr Address::lookupAny(const std::string &host, int family, int type, int protocol)
     {
         std::vector<Address::ptr> result;
@@ -3,15 +3,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <thread>
 #include "hook.h"
 namespace WebSrv
 {
-    FdCtx::FdCtx(int fd)
-        : _fd(fd)
-    {
-        init();
-    }
-
     void FdCtx::setTimeout(int so_timeout, uint64_t timeout)
     {
         if (so_timeout == SO_RCVTIMEO)
@@ -24,7 +19,7 @@ namespace WebSrv
         }
     }
 
-    uint64_t FdCtx::getTimeout(int so_timeout)
+    uint64_t FdCtx::getTimeout(int so_timeout) const
     {
         if (so_timeout == SO_RCVTIMEO)
         {
@@ -36,8 +31,23 @@ namespace WebSrv
         }
     }
 
-    void FdCtx::init()
+    void FdCtx::init(int fd, bool nonblockSocket)
     {
+        _fd = fd;
+        _isInit = false;
+        _isSocket = false;
+        _sysNonblock = false;
+        _userNonblock = false;
+        _isClosed = false;
+        _recvTimeout = ~0ull;
+        _sendTimeout = ~0ull;
+        if (nonblockSocket)
+        {
+            _isInit = true;
+            _isSocket = true;
+            _sysNonblock = true;
+            return;
+        }
         // 判断句柄是否有效
         struct stat fdStat;
         if (fstat(_fd, &fdStat) != -1)
@@ -60,49 +70,100 @@ namespace WebSrv
 
     FdManager::FdManager()
     {
-        _fds.resize(64);
+        getSlot(0, true);
+    }
+
+    FdManager::~FdManager()
+    {
+        for (auto &page : _pages)
+        {
+            delete[] page.load();
+        }
     }
 
-    FdCtx::ptr FdManager::get(int fd, bool autoCreate)
+    FdCtx *FdManager::getSlot(int fd, bool alloc)
     {
-        if (fd == -1)
+        if (fd < 0 || (size_t)fd >= FD_PAGE_SIZE * FD_PAGE_COUNT)
         {
             return nullptr;
         }
-        ReadMutex readlock(_mutex);
-        if ((int)_fds.size() <= fd)
+        std::atomic<FdCtx *> &slot = _pages[fd / FD_PAGE_SIZE];
+        FdCtx *page = slot.load(std::memory_order_acquire);
+        if (!page && alloc)
         {
-            if (autoCreate == false)
+            // 多个线程同时分配同一页时只有一个成功，其他的释放自己分配的页
+            FdCtx *newPage = new FdCtx[FD_PAGE_SIZE];
+            if (slot.compare_exchange_strong(page, newPage, std::memory_order_acq_rel))
             {
-                return nullptr;
+                page = newPage;
             }
-        }
-        else
-        {
-            
-            if (_fds[fd] || !autoCreate)//如果不自动创建不存在则还是返null
+            else
             {
-                return _fds[fd];
+                delete[] newPage;
             }
         }
-        readlock.unlock();
-        WriteMutex writelock(_mutex);
-        FdCtx::ptr ctx(new FdCtx(fd));
-        if (fd >= (int)_fds.size())
+        return page ? &page[fd % FD_PAGE_SIZE] : nullptr;
+    }
+
+    FdCtx *FdManager::get(int fd, bool autoCreate)
+    {
+        return get(fd, autoCreate, false);
+    }
+
+    FdCtx *FdManager::addSocket(int fd)
+    {
+        return get(fd, true, true);
+    }
+
+    FdCtx *FdManager::get(int fd, bool autoCreate, bool nonblockSocket)
+    {
+        FdCtx *ctx = getSlot(fd, autoCreate);
+        if (!ctx)
         {
-            _fds.resize(fd * 1.5);
+            return nullptr;
+        }
+        int state = ctx->_state.load(std::memory_order_acquire);
+        if (state == FdCtx::ACTIVE)
+        {
+            return ctx;
         }
-        _fds[fd] = ctx;
-        return ctx;
+        //如果不自动创建不存在则还是返null
+        if (!autoCreate)
+        {
+            return nullptr;
+        }
+        state = FdCtx::EMPTY;
+        if (ctx->_state.compare_exchange_strong(state, FdCtx::INITIALIZING, std::memory_order_acquire))
+        {
+            ctx->init(fd, nonblockSocket);
+            ctx->_state.store(FdCtx::ACTIVE, std::memory_order_release);
+            return ctx;
+        }
+        // 其他线程正在初始化同一个句柄
+        while ((state = ctx->_state.load(std::memory_order_acquire)) == FdCtx::INITIALIZING)
+        {
+            std::this_thread::yield();
+        }
+        return state == FdCtx::ACTIVE ? ctx : nullptr;
     }
 
     void FdManager::del(int fd)
     {
-        WriteMutex writelock(_mutex);
-        if(fd>=(int)_fds.size()){
+        FdCtx *ctx = getSlot(fd, false);
+        if (!ctx)
+        {
+            return;
+        }
+        // 先占住槽位，标记完成前同一句柄号不会被重新初始化
+        int state = FdCtx::ACTIVE;
+        if (!ctx->_state.compare_exchange_strong(state, FdCtx::INITIALIZING, std::memory_order_acquire))
+        {
             return;
         }
-        _fds[fd].reset();
+        // 还持有该槽位的协程通过关闭标记和代数发现句柄已关闭
+        ctx->_isClosed = true;
+        ctx->_generation.fetch_add(1, std::memory_order_release);
+        ctx->_state.store(FdCtx::EMPTY, std::memory_order_release);
     }
 
     FdManager *FdManager::getFdManger()
@@ -1,5 +1,10 @@
 #include "fiber.h"
 #include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
@@ -17,52 +22,281 @@ namespace WebSrv
 
     static ConfigVar<uint32_t>::ptr g_fiberStackSize =
         Configurator::lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+
+    static ConfigVar<uint32_t>::ptr g_fiberStackPoolMaxSize =
+        Configurator::lookup<uint32_t>("fiber.stack_pool.max_size", 64, "fiber stack pool max cached stacks per thread");
+
+    static ConfigVar<bool>::ptr g_fiberStackGuard =
+        Configurator::lookup<bool>("fiber.stack_guard", true, "fiber stack guard page");
+
+    static std::atomic<uint64_t> s_stackPoolHits = 0;
+    static std::atomic<uint64_t> s_stackPoolMisses = 0;
+    static std::atomic<uint64_t> s_stackPoolCached = 0;
+
+    static uint32_t s_stackPoolMaxSize = 0;
+    static bool s_stackGuard = true;
+
+    struct _StackPoolInit
+    {
+        _StackPoolInit()
+        {
+            s_stackPoolMaxSize = g_fiberStackPoolMaxSize->getValue();
+            s_stackGuard = g_fiberStackGuard->getValue();
+            g_fiberStackPoolMaxSize->addChangeValueListener([](const uint32_t &oldValue, const uint32_t &newValue)
+                                                            { s_stackPoolMaxSize = newValue; });
+            g_fiberStackGuard->addChangeValueListener([](const bool &oldValue, const bool &newValue)
+                                                      { s_stackGuard = newValue; });
+        }
+    };
+
+    static _StackPoolInit s_stackPoolInit;
+
+    static ConfigVar<uint32_t>::ptr g_fiberPoolMaxSize =
+        Configurator::lookup<uint32_t>("fiber.pool.max_size", 256, "fiber object pool max cached fibers per thread");
+
+    /// @brief 所有线程协程池中缓存的协程数量
+    static std::atomic<uint64_t> s_fiberPoolCached = 0;
+
+    static uint32_t s_fiberPoolMaxSize = 0;
+
+    struct _FiberPoolInit
+    {
+        _FiberPoolInit()
+        {
+            s_fiberPoolMaxSize = g_fiberPoolMaxSize->getValue();
+            g_fiberPoolMaxSize->addChangeValueListener([](const uint32_t &oldValue, const uint32_t &newValue)
+                                                       { s_fiberPoolMaxSize = newValue; });
+        }
+    };
+
+    static _FiberPoolInit s_fiberPoolInit;
+
+    static const size_t s_pageSize = sysconf(_SC_PAGESIZE);
+
     /**
-     * @brief 栈空间配置类
+     * @brief 线程栈缓存，缓存已释放的栈供下一个协程复用
      *
      */
+    struct StackCache
+    {
+        ~StackCache();
+        /// @brief 按栈大小分类的空闲栈
+        std::unordered_map<size_t, std::vector<void *>> stacks;
+        /// @brief 缓存栈数量
+        size_t count = 0;
+    };
+
+    /// @brief 线程退出时栈缓存已析构(可能还有协程在之后析构)
+    static thread_local bool t_stackCacheDestroyed = false;
+
+    static StackCache *getStackCache()
+    {
+        if (t_stackCacheDestroyed)
+        {
+            return nullptr;
+        }
+        static thread_local StackCache cache;
+        return &cache;
+    }
+
+    /**
+     * @brief 栈空间配置类
+     * 使用mmap预留栈空间(按需提交物理页)，栈底设置一个PROT_NONE保护页，溢出时触发段错误而不是破坏堆，
+     * 释放的栈放入线程缓存复用
+     */
     class StackAllocator
     {
     public:
         static void *Alloc(size_t size)
         {
-            return malloc(size);
+            StackCache *cache = getStackCache();
+            if (cache)
+            {
+                auto it = cache->stacks.find(size);
+                if (it != cache->stacks.end() && !it->second.empty())
+                {
+                    void *vp = it->second.back();
+                    it->second.pop_back();
+                    --cache->count;
+                    --s_stackPoolCached;
+                    ++s_stackPoolHits;
+                    return vp;
+                }
+            }
+            ++s_stackPoolMisses;
+            return MapStack(size);
         }
 
         static void Dealloc(void *vp, size_t size)
         {
-            return free(vp);
+            StackCache *cache = getStackCache();
+            if (cache && cache->count < s_stackPoolMaxSize)
+            {
+                cache->stacks[size].emplace_back(vp);
+                ++cache->count;
+                ++s_stackPoolCached;
+                return;
+            }
+            UnmapStack(vp, size);
+        }
+
+        static void *MapStack(size_t size)
+        {
+            // 保护页总是预留，释放时不需要关心配置是否被修改
+            size_t len = mapLength(size);
+            void *base = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+            if (base == MAP_FAILED)
+            {
+                SRV_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size << " errno=" << errno
+                                        << " errstr=" << strerror(errno);
+                throw std::bad_alloc();
+            }
+            if (s_stackGuard && mprotect(base, s_pageSize, PROT_NONE))
+            {
+                SRV_LOG_ERROR(g_logger) << "mprotect fiber stack guard errno=" << errno
+                                        << " errstr=" << strerror(errno);
+            }
+            return (char *)base + s_pageSize;
+        }
+
+        static void UnmapStack(void *vp, size_t size)
+        {
+            munmap((char *)vp - s_pageSize, mapLength(size));
+        }
+
+    private:
+        static size_t mapLength(size_t size)
+        {
+            return ((size + s_pageSize - 1) / s_pageSize + 1) * s_pageSize;
+        }
+    };
+
+    StackCache::~StackCache()
+    {
+        t_stackCacheDestroyed = true;
+        for (auto &[size, list] : stacks)
+        {
+            for (auto vp : list)
+            {
+                StackAllocator::UnmapStack(vp, size);
+            }
+            s_stackPoolCached -= list.size();
+        }
+        stacks.clear();
+        count = 0;
+    }
+
+    /**
+     * @brief 线程协程池，缓存已结束的协程对象(连同其栈)，超过上限时直接释放
+     *
+     */
+    struct FiberPool
+    {
+        ~FiberPool();
+        std::vector<Fiber *> fibers;
+    };
+
+    /// @brief 线程退出时协程池已析构
+    static thread_local bool t_fiberPoolDestroyed = false;
+
+    static FiberPool *getFiberPool()
+    {
+        if (t_fiberPoolDestroyed)
+        {
+            return nullptr;
+        }
+        static thread_local FiberPool pool;
+        return &pool;
+    }
+
+    FiberPool::~FiberPool()
+    {
+        t_fiberPoolDestroyed = true;
+        s_fiberPoolCached -= fibers.size();
+        for (auto fiber : fibers)
+        {
+            delete fiber;
         }
+        fibers.clear();
+    }
+
+    static ConfigVar<uint32_t>::ptr g_fiberSharedStackSize =
+        Configurator::lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size per thread");
+
+    /**
+     * @brief 线程共享栈，共享栈协程都在这块栈上运行，切换时把上一个协程已使用的部分拷贝出去
+     *
+     */
+    struct SharedStack
+    {
+        ~SharedStack();
+        void *stack = nullptr;
+        size_t size = 0;
+        /// @brief 当前栈上保存着其内容的协程
+        std::weak_ptr<Fiber> occupant;
     };
 
+    /// @brief 线程退出时共享栈已析构
+    static thread_local bool t_sharedStackDestroyed = false;
+
+    static SharedStack *getSharedStack()
+    {
+        if (t_sharedStackDestroyed)
+        {
+            return nullptr;
+        }
+        static thread_local SharedStack sharedStack;
+        if (!sharedStack.stack)
+        {
+            sharedStack.size = g_fiberSharedStackSize->getValue();
+            sharedStack.stack = StackAllocator::MapStack(sharedStack.size);
+        }
+        return &sharedStack;
+    }
+
+    SharedStack::~SharedStack()
+    {
+        t_sharedStackDestroyed = true;
+        if (stack)
+        {
+            StackAllocator::UnmapStack(stack, size);
+            stack = nullptr;
+        }
+    }
+
     Fiber::Fiber()
     {
         _state = RUNNING;
         setThis(this);
         ++s_fiberCount;
-        getcontext(&_ctx);
+        initMainFiberContext(&_ctx);
         SRV_LOG_DEBUG(g_logger) << "main fiber create";
     }
 
-    Fiber::Fiber(std::function<void()> cb, size_t stacksize,bool use_caller)
+    Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
         : _id(++s_fiberId),
-          _cb(cb)
+          _cb(std::move(cb))
     {
         ++s_fiberCount;
+        if (shared_stack)
+        {
+            // 共享栈协程第一次切入时才在共享栈上构建上下文
+            WebSrvAssert2(!use_caller, "shared stack fiber can not use caller");
+            _sharedStack = true;
+            SRV_LOG_DEBUG(g_logger) << "fiber create id=" << _id << " shared stack";
+            return;
+        }
         _stacksize = stacksize ? stacksize : g_fiberStackSize->getValue();
         _stack = StackAllocator::Alloc(_stacksize);
-        getcontext(&_ctx);
-        _ctx.uc_link = nullptr;
-        _ctx.uc_stack.ss_sp = _stack;
-        _ctx.uc_stack.ss_size = _stacksize;
 
         if (!use_caller)
         {
-            makecontext(&_ctx, &Fiber::mainFunc, 0);
+            makeFiberContext(&_ctx, _stack, _stacksize, &Fiber::mainFunc);
         }
         else
         {
-            makecontext(&_ctx, &Fiber::callerMainFunc, 0);
+            makeFiberContext(&_ctx, _stack, _stacksize, &Fiber::callerMainFunc);
         }
 
         SRV_LOG_DEBUG(g_logger) << "fiber create id=" << _id;
@@ -70,12 +304,15 @@ namespace WebSrv
 
     Fiber::~Fiber()
     {
-        --s_fiberCount;
+        if (_state != POOLED)
+        {
+            --s_fiberCount;
+        }
         if (_stack)
         {
             StackAllocator::Dealloc(_stack, _stacksize);
         }
-        else
+        else if (!_sharedStack)
         {
             Fiber *cur = t_fiber;
             if (cur == this)
@@ -87,26 +324,120 @@ namespace WebSrv
         SRV_LOG_DEBUG(g_logger) << "fiber destruction id=" << _id << " total=" << s_fiberCount;
     }
 
+    Fiber::ptr Fiber::create(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
+    {
+        size_t size = stacksize ? stacksize : g_fiberStackSize->getValue();
+        if (use_caller || shared_stack || size != g_fiberStackSize->getValue())
+        {
+            return Fiber::ptr(new Fiber(std::move(cb), stacksize, use_caller, shared_stack));
+        }
+        FiberPool *pool = getFiberPool();
+        while (pool && !pool->fibers.empty())
+        {
+            Fiber *fiber = pool->fibers.back();
+            pool->fibers.pop_back();
+            --s_fiberPoolCached;
+            // 栈大小配置已修改的协程不再复用
+            if (fiber->_stacksize != size)
+            {
+                delete fiber;
+                continue;
+            }
+            fiber->_id = ++s_fiberId;
+            fiber->_state = INIT;
+            ++s_fiberCount;
+            fiber->reset(std::move(cb));
+            return Fiber::ptr(fiber, &Fiber::recycle);
+        }
+        return Fiber::ptr(new Fiber(std::move(cb), stacksize, use_caller), &Fiber::recycle);
+    }
+
+    void Fiber::recycle(Fiber *fiber)
+    {
+        // 只回收没有运行栈帧的协程，挂起中的协程栈上还有未析构的对象
+        if (fiber->_state == INIT || fiber->_state == DONE || fiber->_state == EXCEPT)
+        {
+            FiberPool *pool = getFiberPool();
+            if (pool && pool->fibers.size() < s_fiberPoolMaxSize)
+            {
+                fiber->_cb = nullptr;
+                fiber->_state = POOLED;
+                --s_fiberCount;
+                ++s_fiberPoolCached;
+                pool->fibers.emplace_back(fiber);
+                return;
+            }
+        }
+        delete fiber;
+    }
+
     void Fiber::reset(std::function<void()> cb)
     {
-        WebSrvAssert(_stack);
+        WebSrvAssert(_stack || _sharedStack);
         WebSrvAssert(_state == INIT || _state == EXCEPT || _state == DONE);
-        _cb = cb;
-        getcontext(&_ctx);
-        _ctx.uc_link = nullptr;
-        _ctx.uc_stack.ss_sp = _stack;
-        _ctx.uc_stack.ss_size = _stacksize;
-
-        makecontext(&_ctx, &Fiber::mainFunc, 0);
+        _cb = std::move(cb);
+        _boundThread = std::thread::id();
+        if (_stack)
+        {
+            makeFiberContext(&_ctx, _stack, _stacksize, &Fiber::mainFunc);
+        }
         _state = INIT;
     }
 
+    void Fiber::switchInShared()
+    {
+        SharedStack *shared = getSharedStack();
+        WebSrvAssert(shared);
+        if (_sharedThread == std::thread::id())
+        {
+            _sharedThread = std::this_thread::get_id();
+        }
+        WebSrvAssert2(_sharedThread == std::this_thread::get_id(),
+                      "shared stack fiber resumed on another thread id=" << _id);
+
+        char *top = (char *)shared->stack + shared->size;
+        Fiber::ptr occupant = shared->occupant.lock();
+        if (occupant.get() != this)
+        {
+            // 保存上一个协程已使用的栈，已结束的协程不需要保存
+            if (occupant && (occupant->_state == SUSPEND || occupant->_state == READY))
+            {
+                // 从切出时保存的栈指针开始拷贝，取不到时保存整个栈
+                char *sp = (char *)fiberContextStackPointer(&occupant->_ctx);
+                if (!sp)
+                {
+                    sp = (char *)shared->stack;
+                }
+                WebSrvAssert2(sp >= (char *)shared->stack && sp <= top,
+                              "shared stack pointer out of range id=" << occupant->_id);
+                occupant->_saved.assign(sp, top);
+                if (occupant->_saved.capacity() > occupant->_saved.size() * 2)
+                {
+                    occupant->_saved.shrink_to_fit();
+                }
+            }
+            if (_state != INIT)
+            {
+                memcpy(top - _saved.size(), _saved.data(), _saved.size());
+            }
+            shared->occupant = shared_from_this();
+        }
+        if (_state == INIT)
+        {
+            makeFiberContext(&_ctx, shared->stack, shared->size, &Fiber::mainFunc);
+        }
+    }
+
     void Fiber::call()
     {
+        if (_sharedStack)
+        {
+            switchInShared();
+        }
         setThis(this);
         WebSrvAssert(_state != RUNNING);
         _state = RUNNING;
-        swapcontext(&t_threadFiber->_ctx, &_ctx);
+        swapFiberContext(&t_threadFiber->_ctx, &_ctx);
     }
 
     void Fiber::back()
@@ -118,15 +449,19 @@ namespace WebSrv
         {
             _state = SUSPEND;
         }
-        swapcontext(&_ctx, &t_threadFiber->_ctx);
+        swapFiberContext(&_ctx, &t_threadFiber->_ctx);
     }
 
     void Fiber::swapIn()
     {
+        if (_sharedStack)
+        {
+            switchInShared();
+        }
         setThis(this);
         WebSrvAssert(_state != RUNNING);
         _state = RUNNING;
-        swapcontext(&Scheduler::getMainFiber()->_ctx, &_ctx);
+        swapFiberContext(&Scheduler::getMainFiber()->_ctx, &_ctx);
     }
 
     void Fiber::swapOut()
@@ -138,7 +473,7 @@ namespace WebSrv
         {
             _state = SUSPEND;
         }
-        swapcontext(&_ctx, &Scheduler::getMainFiber()->_ctx);
+        swapFiberContext(&_ctx, &Scheduler::getMainFiber()->_ctx);
     }
 
     void Fiber::setThis(Fiber *fiber)
@@ -179,6 +514,26 @@ namespace WebSrv
         return s_fiberCount;
     }
 
+    uint64_t Fiber::pooledFibers()
+    {
+        return s_fiberPoolCached;
+    }
+
+    uint64_t Fiber::stackPoolHits()
+    {
+        return s_stackPoolHits;
+    }
+
+    uint64_t Fiber::stackPoolMisses()
+    {
+        return s_stackPoolMisses;
+    }
+
+    uint64_t Fiber::cachedStacks()
+    {
+        return s_stackPoolCached;
+    }
+
     void Fiber::mainFunc()
     {
         Fiber::ptr cur = getThis();
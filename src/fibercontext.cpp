@@ -0,0 +1,156 @@
+#include "fibercontext.h"
+#include <cstdint>
+#include <cstring>
+
+#ifndef WEBSRV_FIBER_USE_UCONTEXT
+#if defined(__x86_64__)
+// websrv_swap_context(void **fromSp, void *toSp)
+// 压入rbp rbx r12-r15和mxcsr/x87控制字，保存rsp到*fromSp，切换到toSp后按相反顺序恢复
+__asm__(R"(
+    .text
+    .globl websrv_swap_context
+    .type websrv_swap_context,@function
+    .align 16
+websrv_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size websrv_swap_context,.-websrv_swap_context
+)");
+#elif defined(__aarch64__)
+// websrv_swap_context(void **fromSp, void *toSp)
+// 保存x19-x30和d8-d15，x30为返回地址
+__asm__(R"(
+    .text
+    .globl websrv_swap_context
+    .type websrv_swap_context,%function
+    .align 4
+websrv_swap_context:
+    sub sp, sp, #176
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #176
+    ret
+    .size websrv_swap_context,.-websrv_swap_context
+)");
+#endif
+#endif
+
+namespace WebSrv
+{
+#ifdef WEBSRV_FIBER_USE_UCONTEXT
+    void initMainFiberContext(FiberContext *ctx)
+    {
+        getcontext(&ctx->ctx);
+    }
+
+    void makeFiberContext(FiberContext *ctx, void *stack, size_t size, void (*func)())
+    {
+        getcontext(&ctx->ctx);
+        ctx->ctx.uc_link = nullptr;
+        ctx->ctx.uc_stack.ss_sp = stack;
+        ctx->ctx.uc_stack.ss_size = size;
+        makecontext(&ctx->ctx, func, 0);
+    }
+
+    void *fiberContextStackPointer(const FiberContext *ctx)
+    {
+#if defined(__x86_64__)
+        return (void *)ctx->ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+        return (void *)ctx->ctx.uc_mcontext.sp;
+#else
+        return nullptr;
+#endif
+    }
+
+    const char *fiberContextBackend()
+    {
+        return "ucontext";
+    }
+#else
+    void initMainFiberContext(FiberContext *ctx)
+    {
+        // 主协程在第一次切出时保存栈指针
+        ctx->sp = nullptr;
+    }
+
+    void makeFiberContext(FiberContext *ctx, void *stack, size_t size, void (*func)())
+    {
+        uintptr_t sp = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+        // 栈布局(低->高): mxcsr/fpucw, r15, r14, r13, r12, rbx, rbp, func, func返回地址(不会返回)
+        // ret进入func时rsp+8按16字节对齐，符合函数入口的调用约定
+        sp -= sizeof(void *);
+        *(void **)sp = nullptr;
+        sp -= sizeof(void *);
+        *(void **)sp = (void *)func;
+        sp -= 6 * sizeof(void *);
+        memset((void *)sp, 0, 6 * sizeof(void *));
+        sp -= sizeof(void *);
+        uint32_t *csr = (uint32_t *)sp;
+        csr[0] = 0x1F80; // mxcsr默认值
+        csr[1] = 0x037F; // x87控制字默认值
+#elif defined(__aarch64__)
+        // 栈布局与websrv_swap_context一致，x30(偏移88)为func
+        sp -= 176;
+        memset((void *)sp, 0, 176);
+        *(void **)(sp + 88) = (void *)func;
+#endif
+        ctx->sp = (void *)sp;
+    }
+
+    void *fiberContextStackPointer(const FiberContext *ctx)
+    {
+        return ctx->sp;
+    }
+
+    const char *fiberContextBackend()
+    {
+#if defined(__x86_64__)
+        return "asm-x86_64";
+#else
+        return "asm-aarch64";
+#endif
+    }
+#endif
+} // namespace WebSrv
@@ -5,10 +5,18 @@
 #include "configurator.h"
 #include "iomanager.h"
 #include "fdmanager.h"
+#include "offload.h"
 #include <functional>
 #include <fcntl.h>
 #include <cstdarg>
+#include <cstring>
+#include <type_traits>
+#include <algorithm>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <linux/io_uring.h>
 static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("system");
 
 namespace WebSrv
@@ -18,12 +26,19 @@ namespace WebSrv
     static ConfigVar<int>::ptr g_tcpConnectTimeout =
         Configurator::lookup<int>("tcp.connect.timeout", 5000, "tcp connect timeout");
 
+    static ConfigVar<uint64_t>::ptr g_ioTimerSlack =
+        Configurator::lookup<uint64_t>("timer.io_slack", 100, "max extra delay(ms) of io timeout timers, close timers share one expiry time, 0 disables");
+
+    static ConfigVar<bool>::ptr g_offloadFileIo =
+        Configurator::lookup<bool>("offload.file_io", true, "run hooked open/pread/pwrite in the offload pool");
+
 #define HOOK_FUN(XX) \
     XX(sleep)        \
     XX(usleep)       \
     XX(socket)       \
     XX(connect)      \
     XX(accept)       \
+    XX(accept4)      \
     XX(read)         \
     XX(readv)        \
     XX(recv)         \
@@ -34,6 +49,14 @@ namespace WebSrv
     XX(send)         \
     XX(sendto)       \
     XX(sendmsg)      \
+    XX(sendfile)     \
+    XX(splice)       \
+    XX(tee)          \
+    XX(copy_file_range) \
+    XX(open)         \
+    XX(pread)        \
+    XX(pwrite)       \
+    XX(getaddrinfo)  \
     XX(close)        \
     XX(fcntl)        \
     XX(ioctl)        \
@@ -48,6 +71,8 @@ namespace WebSrv
     }
 
     static uint64_t s_connectTimeout = -1;
+    static uint64_t s_ioTimerSlack = 0;
+    static bool s_offloadFileIo = true;
 
     struct _HookInit
     {
@@ -57,6 +82,12 @@ namespace WebSrv
             s_connectTimeout = g_tcpConnectTimeout->getValue();
             g_tcpConnectTimeout->addChangeValueListener([](const int &oldValue, const int &newValue)
                                                         { s_connectTimeout = newValue; });
+            s_ioTimerSlack = g_ioTimerSlack->getValue();
+            g_ioTimerSlack->addChangeValueListener([](const uint64_t &oldValue, const uint64_t &newValue)
+                                                   { s_ioTimerSlack = newValue; });
+            s_offloadFileIo = g_offloadFileIo->getValue();
+            g_offloadFileIo->addChangeValueListener([](const bool &oldValue, const bool &newValue)
+                                                    { s_offloadFileIo = newValue; });
         }
     };
 
@@ -77,8 +108,45 @@ namespace WebSrv
         int cannel=0;
     };
 
-    template <typename OriginFun, typename... Args>
-    static ssize_t doIO(int fd, OriginFun fun, const char *hook_fun, uint32_t event, int so_timeout, Args &&...args)
+    /**
+     * @brief io超时定时器允许的延迟，不超过超时时间的1/16
+     *
+     */
+    static uint64_t ioTimerSlack(uint64_t timeout)
+    {
+        return std::min(s_ioTimerSlack, timeout / 16);
+    }
+
+    /**
+     * @brief 填写io_uring请求
+     *
+     */
+    static void prepUring(io_uring_sqe &sqe, uint8_t opcode, const void *addr, uint32_t len, uint64_t off)
+    {
+        sqe.opcode = opcode;
+        sqe.addr = (uint64_t)addr;
+        sqe.len = len;
+        sqe.off = off;
+    }
+
+    /**
+     * @brief io_uring后端且不在共享栈协程中时，直接提交请求而不是等待就绪
+     *
+     */
+    static bool useUring(IOManager *ioManager)
+    {
+        // 共享栈协程挂起时栈内容会被换出，内核不能异步访问栈上的缓冲区
+        return ioManager && ioManager->getBackend() == IOManager::IO_URING &&
+               !Fiber::getThis()->isSharedStack();
+    }
+
+    /**
+     * @brief hook的io操作
+     *
+     * @param prep io_uring后端填写请求，nullptr为该操作不使用io_uring
+     */
+    template <typename OriginFun, typename Prep, typename... Args>
+    static ssize_t doIO(int fd, OriginFun fun, const char *hook_fun, uint32_t event, int so_timeout, Prep prep, Args &&...args)
     {
         // 未设置，或阻塞时，默认的
         if (!t_hookEnable)
@@ -86,7 +154,7 @@ namespace WebSrv
             return fun(fd, std::forward<Args>(args)...);
         }
 
-        FdCtx::ptr ctx = FdManager::getFdManger()->get(fd);
+        FdCtx *ctx = FdManager::getFdManger()->get(fd);
 
         // 不在管理范畴
         if (!ctx)
@@ -106,6 +174,26 @@ namespace WebSrv
         }
 
         uint64_t to = ctx->getTimeout(so_timeout);
+        // 槽位不会释放，挂起期间句柄可能关闭后被复用，用代数区分
+        uint32_t generation = ctx->getGeneration();
+        if constexpr (!std::is_same_v<Prep, std::nullptr_t>)
+        {
+            IOManager *ioManager = IOManager::getThis();
+            if (useUring(ioManager))
+            {
+                io_uring_sqe sqe;
+                memset(&sqe, 0, sizeof(sqe));
+                prep(sqe);
+                sqe.fd = fd;
+                int n = ioManager->submitIO(sqe, to);
+                if (n < 0)
+                {
+                    errno = -n;
+                    return -1;
+                }
+                return n;
+            }
+        }
         std::shared_ptr<TimerInfo> timerInfo(new TimerInfo);
         do
         {
@@ -119,6 +207,16 @@ namespace WebSrv
             if (n == -1 && errno == EAGAIN)
             {
                 IOManager *ioManager = IOManager::getThis();
+                // 先添加事件，持久注册模式下已就绪时直接重试，不创建定时器
+                int ret = ioManager->addEvent(fd, (IOManager::Event)(event));
+                if (ret == -1)
+                {
+                    return -1;
+                }
+                if (ret == 1)
+                {
+                    continue;
+                }
                 Timer::ptr timer;
                 std::weak_ptr<TimerInfo> weakInfo(timerInfo);
                 //设置超时
@@ -136,33 +234,28 @@ namespace WebSrv
                             p->cannel = ETIMEDOUT;
                             ioManager->cancelEvent(fd, (IOManager::Event)(event));
                         },
-                        [ctx]()
+                        [ctx, generation]()
                         {
-                            return !ctx->isClose();
-                        });
+                            return ctx->isAlive(generation);
+                        },
+                        false, ioTimerSlack(to));
                 }
-                int ret = ioManager->addEvent(fd, (IOManager::Event)(event));
-                if (ret == -1)
+                Fiber::yieldToSuspend();
+
+                if (timer)
                 {
-                    if (timer)
-                    {
-                        timer->cannel();
-                    }
+                    timer->cannel();
+                }
+                if (timerInfo->cannel)
+                {
+                    errno = timerInfo->cannel;
                     return -1;
                 }
-                else
+                // 挂起期间句柄已关闭(关闭时先标记再取消事件)，不能再重试，否则会在已关闭的句柄上重新挂起
+                if (!ctx->isAlive(generation))
                 {
-                    Fiber::yieldToSuspend();
-
-                    if (timer)
-                    {
-                        timer->cannel();
-                    }
-                    if (timerInfo->cannel)
-                    {
-                        errno = timerInfo->cannel;
-                        return -1;
-                    }
+                    errno = EBADF;
+                    return -1;
                 }
             }
             else
@@ -171,6 +264,26 @@ namespace WebSrv
             }
         } while (true);
     }
+
+    /**
+     * @brief hook两个句柄间的传输(splice/tee/copy_file_range)，按其中的socket等待：
+     * 输出端是socket时等待可写(SO_SNDTIMEO)，否则输入端是socket时等待可读(SO_RCVTIMEO)，
+     * 都不是socket时(管道、文件)直接调用原函数
+     *
+     * @param call 执行一次原函数
+     */
+    template <typename Call>
+    static ssize_t doTransferIO(int fdIn, int fdOut, const char *hook_fun, Call call)
+    {
+        auto fun = [&](int)
+        { return call(); };
+        FdCtx *ctx = t_hookEnable ? FdManager::getFdManger()->get(fdOut) : nullptr;
+        if (ctx && ctx->isSocket())
+        {
+            return doIO(fdOut, fun, hook_fun, IOManager::WRITE, SO_SNDTIMEO, nullptr);
+        }
+        return doIO(fdIn, fun, hook_fun, IOManager::READ, SO_RCVTIMEO, nullptr);
+    }
     extern "C"
     {
 #define XX(name) name##_fun name##_f = nullptr;
@@ -196,7 +309,7 @@ namespace WebSrv
         {
             if (!t_hookEnable)
             {
-                return usleep(usec);
+                return usleep_f(usec);
             }
             Fiber::ptr fiber = Fiber::getThis();
             IOManager *ioManager = IOManager::getThis();
@@ -227,7 +340,7 @@ namespace WebSrv
             {
                 return connect_f(fd, addr, addrlen);
             }
-            FdCtx::ptr ctx = FdManager::getFdManger()->get(fd);
+            FdCtx *ctx = FdManager::getFdManger()->get(fd);
             if (!ctx || ctx->isClose())
             {
                 errno = EBADF;
@@ -244,6 +357,22 @@ namespace WebSrv
                 return connect_f(fd, addr, addrlen);
             }
 
+            IOManager *ioManager = IOManager::getThis();
+            if (useUring(ioManager))
+            {
+                io_uring_sqe sqe;
+                memset(&sqe, 0, sizeof(sqe));
+                prepUring(sqe, IORING_OP_CONNECT, addr, 0, addrlen);
+                sqe.fd = fd;
+                int n = ioManager->submitIO(sqe, timeout_ms == -1 ? ~0ull : (uint64_t)timeout_ms);
+                if (n < 0)
+                {
+                    errno = -n;
+                    return -1;
+                }
+                return 0;
+            }
+
             int n = connect_f(fd, addr, addrlen);
             if (n == 0)
             {
@@ -253,7 +382,6 @@ namespace WebSrv
             {
                 return n;
             }
-            IOManager *ioManager = IOManager::getThis();
             Timer::ptr timer;
             std::shared_ptr<TimerInfo> timerInfo(new TimerInfo);
             std::weak_ptr<TimerInfo> weakInfo(timerInfo);
@@ -271,7 +399,8 @@ namespace WebSrv
                         }
                         p->cannel = ETIMEDOUT;
                         ioManager->cancelEvent(fd, IOManager::Event::WRITE);
-                    });
+                    },
+                    false, ioTimerSlack(timeout_ms));
             }
 
             int ret = ioManager->addEvent(fd, IOManager::Event::WRITE);
@@ -283,6 +412,14 @@ namespace WebSrv
                 }
                 SRV_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
             }
+            else if (ret == 1)
+            {
+                // 持久注册模式下已可写，连接已完成
+                if (timer)
+                {
+                    timer->cannel();
+                }
+            }
             else
             {
                 Fiber::yieldToSuspend();
@@ -324,7 +461,9 @@ namespace WebSrv
 
         int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
         {
-            int fd = doIO(s, accept_f, "accept", IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+            int fd = doIO(s, accept_f, "accept", IOManager::READ, SO_RCVTIMEO, [=](io_uring_sqe &sqe)
+                          { prepUring(sqe, IORING_OP_ACCEPT, addr, 0, (uint64_t)addrlen); },
+                          addr, addrlen);
             if (fd >= 0)
             {
                 FdManager::getFdManger()->get(fd, true);
@@ -332,71 +471,205 @@ namespace WebSrv
             return fd;
         }
 
+        int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags)
+        {
+            int fd = doIO(s, accept4_f, "accept4", IOManager::READ, SO_RCVTIMEO, [=](io_uring_sqe &sqe)
+                          {
+                              prepUring(sqe, IORING_OP_ACCEPT, addr, 0, (uint64_t)addrlen);
+                              sqe.accept_flags = flags; },
+                          addr, addrlen, flags);
+            if (fd >= 0 && t_hookEnable)
+            {
+                // 同socket()，SOCK_NONBLOCK只是省去fcntl，hook下的读写仍然挂起协程等待
+                if (flags & SOCK_NONBLOCK)
+                {
+                    FdManager::getFdManger()->addSocket(fd);
+                }
+                else
+                {
+                    FdManager::getFdManger()->get(fd, true);
+                }
+            }
+            return fd;
+        }
+
         ssize_t read(int fd, void *buf, size_t count)
         {
-            return doIO(fd, read_f, "read", IOManager::READ, SO_RCVTIMEO, buf, count);
+            return doIO(fd, read_f, "read", IOManager::READ, SO_RCVTIMEO, [=](io_uring_sqe &sqe)
+                        { prepUring(sqe, IORING_OP_READ, buf, count, -1); },
+                        buf, count);
         }
 
         ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
         {
-            return doIO(fd, readv_f, "readv", IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+            return doIO(fd, readv_f, "readv", IOManager::READ, SO_RCVTIMEO, [=](io_uring_sqe &sqe)
+                        { prepUring(sqe, IORING_OP_READV, iov, iovcnt, -1); },
+                        iov, iovcnt);
         }
 
         ssize_t recv(int sockfd, void *buf, size_t len, int flags)
         {
-            return doIO(sockfd, recv_f, "recv", IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+            return doIO(sockfd, recv_f, "recv", IOManager::READ, SO_RCVTIMEO, [=](io_uring_sqe &sqe)
+                        {
+                            prepUring(sqe, IORING_OP_RECV, buf, len, 0);
+                            sqe.msg_flags = flags; },
+                        buf, len, flags);
         }
 
         ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen)
         {
-            return doIO(sockfd, recvfrom_f, "recvfrom", IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+            return doIO(sockfd, recvfrom_f, "recvfrom", IOManager::READ, SO_RCVTIMEO, nullptr, buf, len, flags, src_addr, addrlen);
         }
 
         ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
         {
-            return doIO(sockfd, recvmsg_f, "recvmsg", IOManager::READ, SO_RCVTIMEO, msg, flags);
+            return doIO(sockfd, recvmsg_f, "recvmsg", IOManager::READ, SO_RCVTIMEO, [=](io_uring_sqe &sqe)
+                        {
+                            prepUring(sqe, IORING_OP_RECVMSG, msg, 1, 0);
+                            sqe.msg_flags = flags; },
+                        msg, flags);
         }
 
         ssize_t write(int fd, const void *buf, size_t count)
         {
-            return doIO(fd, write_f, "write", IOManager::WRITE, SO_SNDTIMEO, buf, count);
+            return doIO(fd, write_f, "write", IOManager::WRITE, SO_SNDTIMEO, [=](io_uring_sqe &sqe)
+                        { prepUring(sqe, IORING_OP_WRITE, buf, count, -1); },
+                        buf, count);
         }
 
         ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
         {
-            return doIO(fd, writev_f, "writev", IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+            return doIO(fd, writev_f, "writev", IOManager::WRITE, SO_SNDTIMEO, [=](io_uring_sqe &sqe)
+                        { prepUring(sqe, IORING_OP_WRITEV, iov, iovcnt, -1); },
+                        iov, iovcnt);
         }
 
         ssize_t send(int s, const void *msg, size_t len, int flags)
         {
-            return doIO(s, send_f, "send", IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+            return doIO(s, send_f, "send", IOManager::WRITE, SO_SNDTIMEO, [=](io_uring_sqe &sqe)
+                        {
+                            prepUring(sqe, IORING_OP_SEND, msg, len, 0);
+                            sqe.msg_flags = flags; },
+                        msg, len, flags);
         }
 
         ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen)
         {
-            return doIO(s, sendto_f, "sendto", IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+            return doIO(s, sendto_f, "sendto", IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, len, flags, to, tolen);
         }
 
         ssize_t sendmsg(int s, const struct msghdr *msg, int flags)
         {
-            return doIO(s, sendmsg_f, "sendmsg", IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+            return doIO(s, sendmsg_f, "sendmsg", IOManager::WRITE, SO_SNDTIMEO, [=](io_uring_sqe &sqe)
+                        {
+                            prepUring(sqe, IORING_OP_SENDMSG, msg, 1, 0);
+                            sqe.msg_flags = flags; },
+                        msg, flags);
+        }
+
+        ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+        {
+            return doIO(out_fd, sendfile_f, "sendfile", IOManager::WRITE, SO_SNDTIMEO, nullptr, in_fd, offset, count);
+        }
+
+        ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+        {
+            return doTransferIO(fd_in, fd_out, "splice", [=]()
+                                { return splice_f(fd_in, off_in, fd_out, off_out, len, flags); });
+        }
+
+        ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+        {
+            // 两端都是管道，不会等待，是否阻塞由管道自身和SPLICE_F_NONBLOCK决定
+            return doTransferIO(fd_in, fd_out, "tee", [=]()
+                                { return tee_f(fd_in, fd_out, len, flags); });
+        }
+
+        ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+        {
+            // 普通文件总是就绪，这里只检查已关闭的句柄
+            return doTransferIO(fd_in, fd_out, "copy_file_range", [=]()
+                                { return copy_file_range_f(fd_in, off_in, fd_out, off_out, len, flags); });
+        }
+        int open(const char *pathname, int flags, ...)
+        {
+            mode_t mode = 0;
+            if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+            {
+                va_list va;
+                va_start(va, flags);
+                mode = va_arg(va, mode_t);
+                va_end(va);
+            }
+            if (!s_offloadFileIo)
+            {
+                return open_f(pathname, flags, mode);
+            }
+            return OffloadPool::await([=]()
+                                      { return open_f(pathname, flags, mode); });
+        }
+
+        ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+        {
+            if (!s_offloadFileIo || !OffloadPool::canOffload())
+            {
+                return pread_f(fd, buf, count, offset);
+            }
+            // 先只从页缓存读，全部命中时不需要切换线程
+            iovec iov{buf, count};
+            ssize_t n = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+            if (n == (ssize_t)count || n == 0)
+            {
+                return n;
+            }
+            n = n < 0 ? 0 : n;
+            // 部分命中时剩下的交给线程池读，保持普通文件读到文件尾才返回不足的语义
+            ssize_t rest = OffloadPool::await([=]()
+                                              { return pread_f(fd, (char *)buf + n, count - n, offset + n); });
+            if (rest < 0)
+            {
+                return n ? n : rest;
+            }
+            return n + rest;
+        }
+
+        ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+        {
+            if (!s_offloadFileIo)
+            {
+                return pwrite_f(fd, buf, count, offset);
+            }
+            return OffloadPool::await([=]()
+                                      { return pwrite_f(fd, buf, count, offset); });
         }
+
+        int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res)
+        {
+            return OffloadPool::await([=]()
+                                      { return getaddrinfo_f(node, service, hints, res); });
+        }
+
         int close(int fd)
         {
+            // 关闭后句柄号会被复用，清除持久注册状态
+            IOManager::forgetFd(fd);
             if (!t_hookEnable)
             {
+                // 未hook的线程也要清除句柄上下文，否则复用的句柄号会沿用旧的状态
+                FdManager::getFdManger()->del(fd);
                 return close_f(fd);
             }
 
-            FdCtx::ptr ctx = FdManager::getFdManger()->get(fd);
+            FdCtx *ctx = FdManager::getFdManger()->get(fd);
             if (ctx)
             {
+                // 先标记关闭再取消事件，被唤醒的协程发现句柄已关闭后直接返回
+                FdManager::getFdManger()->del(fd);
                 auto ioManager = IOManager::getThis();
                 if (ioManager)
                 {
                     ioManager->cancelAll(fd);
                 }
-                FdManager::getFdManger()->del(fd);
             }
             return close_f(fd);
         }
@@ -411,7 +684,7 @@ namespace WebSrv
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                FdCtx::ptr ctx = FdManager::getFdManger()->get(fd);
+                FdCtx *ctx = FdManager::getFdManger()->get(fd);
                 if (!ctx || ctx->isClose() || !ctx->isSocket())
                 {
                     return fcntl_f(fd, cmd, arg);
@@ -432,7 +705,7 @@ namespace WebSrv
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                FdCtx::ptr ctx = FdManager::getFdManger()->get(fd);
+                FdCtx *ctx = FdManager::getFdManger()->get(fd);
                 if (!ctx || ctx->isClose() || !ctx->isSocket())
                 {
                     return arg;
@@ -508,7 +781,7 @@ namespace WebSrv
             if (FIONBIO == request)
             {
                 bool user_nonblock = !!*(int *)arg;
-                FdCtx::ptr ctx = FdManager::getFdManger()->get(d);
+                FdCtx *ctx = FdManager::getFdManger()->get(d);
                 if (!ctx || ctx->isClose() || !ctx->isSocket())
                 {
                     return ioctl_f(d, request, arg);
@@ -532,7 +805,7 @@ namespace WebSrv
             {
                 if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)
                 {
-                    FdCtx::ptr ctx = FdManager::getFdManger()->get(sockfd);
+                    FdCtx *ctx = FdManager::getFdManger()->get(sockfd);
                     if (ctx)
                     {
                         const timeval *v = (const timeval *)optval;
@@ -34,6 +34,27 @@ namespace WebSrv::http
 #undef XX
     };
 
+    HttpMethod HttpMethodFromView(std::string_view method)
+    {
+        // 常用方法放在前面
+        if (method == "GET")
+        {
+            return HttpMethod::HTTP_GET;
+        }
+        if (method == "POST")
+        {
+            return HttpMethod::HTTP_POST;
+        }
+        for (size_t i = 0; i < sizeof(s_methodStr) / sizeof(s_methodStr[0]); ++i)
+        {
+            if (method == s_methodStr[i])
+            {
+                return (HttpMethod)i;
+            }
+        }
+        return HttpMethod::HTTP_INVALID_METHOD;
+    }
+
     const char *HttpMethodToString(const HttpMethod &method)
     {
         int index = (int)method;
@@ -64,13 +85,44 @@ namespace WebSrv::http
         return strcasecmp(lhs.c_str(), rhs.c_str())<0;
     }
 
+    const std::string_view *HeaderViews::find(std::string_view key) const
+    {
+        for (auto it = _views.rbegin(); it != _views.rend(); ++it)
+        {
+            if (it->first.size() == key.size() && strncasecmp(it->first.data(), key.data(), key.size()) == 0)
+            {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
     HttpRequest::HttpRequest(uint8_t version)
-        : _version(version)
+        : _version(version), _parserParamStatus(0)
     {
     }
 
+    void HttpRequest::initParams() const
+    {
+        if (_parserParamStatus & PARAM_QUERY_PARSED)
+        {
+            return;
+        }
+        _parserParamStatus |= PARAM_QUERY_PARSED;
+        if (_query.empty())
+        {
+            return;
+        }
+        parseQuery(_query, [this](std::string &key, std::string &value)
+                   { _params[key] = std::move(value); });
+    }
+
     std::string HttpRequest::getHeader(const std::string &key, const std::string &def) const
     {
+        if (const std::string_view *value = _headerViews.find(key))
+        {
+            return std::string(*value);
+        }
         auto it = _headers.find(key);
         if (it != _headers.end())
         {
@@ -81,6 +133,7 @@ namespace WebSrv::http
 
     std::string HttpRequest::getParam(const std::string &key, const std::string &def) const
     {
+        initParams();
         auto it = _params.find(key);
         if (it != _params.end())
         {
@@ -99,8 +152,26 @@ namespace WebSrv::http
         return def;
     }
 
+    std::string_view HttpRequest::getHeaderView(const std::string &key) const
+    {
+        if (const std::string_view *value = _headerViews.find(key))
+        {
+            return *value;
+        }
+        auto it = _headers.find(key);
+        return it != _headers.end() ? std::string_view(it->second) : std::string_view();
+    }
+
     bool HttpRequest::hasHeader(const std::string &key, std::string *result) const
     {
+        if (const std::string_view *value = _headerViews.find(key))
+        {
+            if (result)
+            {
+                *result = std::string(*value);
+            }
+            return true;
+        }
         auto it = _headers.find(key);
         if (it != _headers.end())
         {
@@ -115,6 +186,7 @@ namespace WebSrv::http
 
     bool HttpRequest::hasParam(const std::string &key, std::string *result) const
     {
+        initParams();
         auto it = _params.find(key);
         if (it != _params.end())
         {
@@ -145,11 +217,13 @@ namespace WebSrv::http
 
     void HttpRequest::setHeader(const std::string &key, const std::string &value)
     {
+        materializeHeaders();
         _headers[key] = value;
     }
 
     void HttpRequest::setParam(const std::string &key, const std::string &value)
     {
+        initParams();
         _params[key] = value;
     }
 
@@ -160,17 +234,19 @@ namespace WebSrv::http
 
     void HttpRequest::delHeader(const std::string &key)
     {
+        materializeHeaders();
         _headers.erase(key);
     }
 
     void HttpRequest::delParam(const std::string &key)
     {
-        _headers.erase(key);
+        initParams();
+        _params.erase(key);
     }
 
     void HttpRequest::delCookie(const std::string &key)
     {
-        _headers.erase(key);
+        _cookies.erase(key);
     }
 
     std::ostream &HttpRequest::dump(std::ostream &os) const
@@ -191,13 +267,21 @@ namespace WebSrv::http
     void HttpRequest::addLine(std::ostream &os) const
     {
         os << HttpMethodToString(_method) << " " << _path;
-        if (!_params.empty() && _method == HttpMethod::HTTP_GET)
+        if (!(_parserParamStatus & PARAM_QUERY_PARSED))
+        {
+            // 参数未被访问过，原样输出查询串
+            if (!_query.empty())
+            {
+                os << "?" << _query;
+            }
+        }
+        else if (!_params.empty() && _method == HttpMethod::HTTP_GET)
         {
             auto it = _params.begin();
             os << "?";
             for (;;)
             {
-                os << it->first << "=" << it->second;
+                os << percentEncode(it->first, true) << "=" << percentEncode(it->second, true);
                 it++;
                 if (it == _params.end())
                 {
@@ -218,6 +302,10 @@ namespace WebSrv::http
         {
             os << key << ": " << value << "\r\n";
         }
+        for (auto &&[key, value] : _headerViews.views())
+        {
+            os << key << ": " << value << "\r\n";
+        }
         if (!_cookies.empty())
         {
             auto it = _cookies.begin();
@@ -237,23 +325,23 @@ namespace WebSrv::http
     }
     void HttpRequest::addBody(std::ostream &os) const
     {
-        auto it = _headers.find("content-type");
-        if (it == _headers.end())
+        std::string type;
+        if (!hasHeader("content-type", &type))
         {
             os << "\r\n";
             return;
         }
 
-        auto type = it->second;
         std::stringstream ss;
         if (strstr(type.c_str(), "application/x-www-form-urlencoded") != nullptr)
         {
+            initParams();
             if (!_params.empty())
             {
                 auto it = _params.begin();
                 for (;;)
                 {
-                    ss << it->first << "=" << it->second;
+                    ss << percentEncode(it->first, true) << "=" << percentEncode(it->second, true);
                     it++;
                     if (it == _params.end())
                     {
@@ -281,12 +369,16 @@ namespace WebSrv::http
         }
     }
     HttpResponse::HttpResponse(uint8_t version)
-        :_status(HttpStatus::HTTP_STATUS_OK),_version(version)
+        :_status(HttpStatus::HTTP_STATUS_OK),_version(version),_chunked(false)
     {
     }
     
     std::string HttpResponse::getHeader(const std::string &key, const std::string &def) const
     {
+        if (const std::string_view *value = _headerViews.find(key))
+        {
+            return std::string(*value);
+        }
         auto it = _headers.find(key);
         if (it != _headers.end())
         {
@@ -294,8 +386,25 @@ namespace WebSrv::http
         }
         return def;
     }
+    std::string_view HttpResponse::getHeaderView(const std::string &key) const
+    {
+        if (const std::string_view *value = _headerViews.find(key))
+        {
+            return *value;
+        }
+        auto it = _headers.find(key);
+        return it != _headers.end() ? std::string_view(it->second) : std::string_view();
+    }
     bool HttpResponse::hasHeader(const std::string &key, std::string *result) const
     {
+        if (const std::string_view *value = _headerViews.find(key))
+        {
+            if (result)
+            {
+                *result = std::string(*value);
+            }
+            return true;
+        }
         auto it = _headers.find(key);
         if (it != _headers.end())
         {
@@ -309,10 +418,12 @@ namespace WebSrv::http
     }
     void HttpResponse::setHeader(const std::string &key, const std::string &value)
     {
+        materializeHeaders();
         _headers[key] = value;
     }
     void HttpResponse::delHeader(const std::string &key)
     {
+        materializeHeaders();
         _headers.erase(key);
     }
 
@@ -332,7 +443,27 @@ namespace WebSrv::http
 
     std::ostream &HttpResponse::dump(std::ostream &os) const
     {
-        os << " HTTP/"
+        dumpHeader(os);
+        if (_chunked)
+        {
+            // 整个消息体作为一块，再加上结束块
+            if (!_body.empty())
+            {
+                os << std::hex << _body.size() << std::dec << "\r\n"
+                   << _body << "\r\n";
+            }
+            os << "0\r\n\r\n";
+        }
+        else
+        {
+            os << _body;
+        }
+        return os;
+    }
+
+    std::ostream &HttpResponse::dumpHeader(std::ostream &os) const
+    {
+        os << "HTTP/"
            << ((uint32_t)(_version >> 4))
            << "."
            << ((uint32_t)(_version & 0x0F))
@@ -346,16 +477,20 @@ namespace WebSrv::http
         {
             os << key << ": " << value << "\r\n";
         }
+        for (auto &&[key, value] : _headerViews.views())
+        {
+            os << key << ": " << value << "\r\n";
+        }
         addCookie(os);
-        if (!_body.empty())
+        if (_chunked)
         {
-            os << "content-length: " << _body.size() << "\r\n\r\n"
-               << _body;
+            os << "transfer-encoding: chunked\r\n";
         }
-        else
+        else if (!_body.empty())
         {
-            os << "\r\n";
+            os << "content-length: " << _body.size() << "\r\n";
         }
+        os << "\r\n";
         return os;
     }
 
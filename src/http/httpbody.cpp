@@ -0,0 +1,221 @@
+#include "http/httpbody.h"
+#include <climits>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include "fdmanager.h"
+#include "offload.h"
+namespace WebSrv::http
+{
+    /// @brief 写入ByteArray、文件和丢弃时每次读取的长度
+    static const size_t READ_SIZE = 16 * 1024;
+
+    HttpBodyReader::HttpBodyReader(Stream *stream, std::shared_ptr<char> buffer, size_t begin, size_t end,
+                                   uint64_t length, bool chunked, uint64_t maxSize)
+        : _stream(stream), _buffer(std::move(buffer)), _begin(begin), _end(end),
+          _length(chunked ? 0 : length), _remaining(_length), _maxSize(maxSize), _chunked(chunked)
+    {
+        if (_chunked)
+        {
+            // 缓冲区中已收到的部分原地解码，之后的数据(下一个请求)丢弃
+            size_t decoded = 0;
+            if (_decoder.execute(_buffer.get() + _begin, _end - _begin, decoded) == (size_t)-1)
+            {
+                _error = true;
+            }
+            _end = _begin + decoded;
+        }
+        else
+        {
+            _end = std::min<uint64_t>(_end, _begin + _length);
+            _remaining -= _end - _begin;
+        }
+    }
+
+    int HttpBodyReader::read(void *buffer, size_t len)
+    {
+        if (_error)
+        {
+            return -1;
+        }
+        len = std::min<size_t>(len, INT_MAX);
+        // 先返回缓冲区中的部分
+        if (_begin < _end)
+        {
+            size_t n = std::min(len, _end - _begin);
+            memcpy(buffer, _buffer.get() + _begin, n);
+            _begin += n;
+            _read += n;
+            return n;
+        }
+        if (!_chunked)
+        {
+            if (!_remaining)
+            {
+                return 0;
+            }
+            int n = readStream(buffer, std::min<uint64_t>(len, _remaining));
+            if (n <= 0)
+            {
+                return fail();
+            }
+            _remaining -= n;
+            _read += n;
+            return n;
+        }
+        // 分块编码：直接读到调用者的内存中原地解码，只收到块头时继续读
+        while (!_decoder.isFinished())
+        {
+            int n = readStream(buffer, len);
+            if (n <= 0)
+            {
+                return fail();
+            }
+            size_t decoded = 0;
+            if (_decoder.execute((char *)buffer, n, decoded) == (size_t)-1)
+            {
+                return fail();
+            }
+            _read += decoded;
+            if (_read > _maxSize)
+            {
+                return fail();
+            }
+            if (decoded)
+            {
+                return decoded;
+            }
+        }
+        return 0;
+    }
+
+    int64_t HttpBodyReader::readAll(std::string &body)
+    {
+        uint64_t total = 0;
+        while (!isFinished())
+        {
+            // 长度已知时一次分配好
+            size_t size = body.size();
+            size_t want = _chunked ? READ_SIZE : (_end - _begin) + _remaining;
+            body.resize(size + want);
+            int n = read(&body[size], want);
+            body.resize(size + std::max(n, 0));
+            if (n < 0)
+            {
+                return -1;
+            }
+            total += n;
+        }
+        return _error ? -1 : total;
+    }
+
+    int64_t HttpBodyReader::readTo(ByteArray::ptr ba)
+    {
+        uint64_t total = 0;
+        if (_begin < _end)
+        {
+            ba->write(_buffer.get() + _begin, _end - _begin);
+            total += _end - _begin;
+            _read += _end - _begin;
+            _begin = _end;
+        }
+        if (!_chunked)
+        {
+            // 长度已知时直接接收到ba的内存块中
+            while (_remaining && !_error)
+            {
+                if (_expectContinue && readStream(nullptr, 0) < 0)
+                {
+                    return fail();
+                }
+                int n = _stream->read(ba, std::min<uint64_t>(_remaining, READ_SIZE));
+                if (n <= 0)
+                {
+                    return fail();
+                }
+                _remaining -= n;
+                _read += n;
+                total += n;
+            }
+            return _error ? -1 : total;
+        }
+        std::vector<char> buffer(READ_SIZE);
+        int n = 0;
+        while ((n = read(&buffer[0], buffer.size())) > 0)
+        {
+            ba->write(&buffer[0], n);
+            total += n;
+        }
+        return n < 0 ? -1 : total;
+    }
+
+    int64_t HttpBodyReader::readTo(int fd)
+    {
+        uint64_t total = 0;
+        std::vector<char> buffer(READ_SIZE);
+        // hook只让socket的write不阻塞，写普通文件会阻塞工作线程，交给阻塞任务线程池执行
+        FdCtx *ctx = FdManager::getFdManger()->get(fd);
+        bool socket = ctx && ctx->isSocket();
+        int n = 0;
+        while ((n = read(&buffer[0], buffer.size())) > 0)
+        {
+            for (int written = 0; written < n;)
+            {
+                const char *data = &buffer[written];
+                size_t len = n - written;
+                ssize_t rt = socket ? ::write(fd, data, len)
+                                    : OffloadPool::await([=]()
+                                                         { return ::write(fd, data, len); });
+                if (rt <= 0)
+                {
+                    return -1;
+                }
+                written += rt;
+            }
+            total += n;
+        }
+        return n < 0 ? -1 : total;
+    }
+
+    int64_t HttpBodyReader::skip(uint64_t max)
+    {
+        uint64_t total = 0;
+        std::vector<char> buffer(READ_SIZE);
+        while (total < max && !isFinished())
+        {
+            int n = read(&buffer[0], std::min<uint64_t>(buffer.size(), max - total));
+            if (n < 0)
+            {
+                return -1;
+            }
+            total += n;
+        }
+        return total;
+    }
+
+    bool HttpBodyReader::isFinished() const
+    {
+        return _begin == _end && (_chunked ? _decoder.isFinished() : _remaining == 0);
+    }
+
+    int HttpBodyReader::readStream(void *buffer, size_t len)
+    {
+        if (_expectContinue)
+        {
+            // 客户端等到"100 Continue"才发送消息体(RFC7231 5.1.1)
+            _expectContinue = false;
+            static const char s_continue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (_stream->writeFixSize(s_continue, sizeof(s_continue) - 1) <= 0)
+            {
+                return -1;
+            }
+        }
+        return len ? _stream->read(buffer, len) : 0;
+    }
+
+    int HttpBodyReader::fail()
+    {
+        _error = true;
+        return -1;
+    }
+} // namespace WebSrv::http
@@ -1,6 +1,6 @@
 #include "http/httpconnection.h"
-#include <regex>
 #include "http/httpparser.h"
+#include "http/httpbody.h"
 #include "log.h"
 
 namespace WebSrv::http
@@ -58,21 +58,7 @@ namespace WebSrv::http
     {
         HttpRequest::ptr req = std::make_shared<HttpRequest>();
         req->setPath(url.path);
-        if (!url.query.empty())
-        {
-            req->setPath(url.path);
-            std::vector<std::string> param;
-            // 定义查询参数解析的正则表达式
-            static std::regex queryRegex("([^&=?]+)=([^&=?]+)");
-
-            auto query_begin = std::sregex_iterator(url.query.begin(), url.query.end(), queryRegex);
-            auto query_end = std::sregex_iterator();
-            for (std::sregex_iterator it = query_begin; it != query_end; ++it)
-            {
-                std::smatch match = *it;
-                req->setParam(match[1].str(), match[2].str());
-            }
-        }
+        req->setQuery(url.query);
         req->setFragment(url.fragment);
         req->setHttpMethod(method);
         bool has_host = false;
@@ -144,7 +130,7 @@ namespace WebSrv::http
     }
 
     HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
-        : SocketStream(sock, owner)
+        : SocketStream(sock, owner), _createTime(getMonotonicMilliseconds())
     {
     }
 
@@ -155,12 +141,13 @@ namespace WebSrv::http
     HttpResponse::ptr HttpConnection::recvResponse()
     {
         HttpResponseParser::ptr parser(new HttpResponseParser);
-        uint64_t buffSize = HttpRequestParser::getHttpRequestBufferSize();
+        uint64_t buffSize = HttpResponseParser::getHttpResponseBufferSize();
         std::shared_ptr<char> buffer(new char[buffSize], [](char *p)
                                      { delete[] p; });
         char *data = buffer.get();
-        int offset = 0;
-        // 获取请求头
+        size_t offset = 0;
+        size_t nParse = 0;
+        // 获取响应头，解析器记录已解析的位置，每次只解析新读到的数据
         do
         {
             int len = read(data + offset, buffSize - offset);
@@ -169,63 +156,46 @@ namespace WebSrv::http
                 close();
                 return nullptr;
             }
-            len += offset;
-            size_t nParse = parser->execute(data, len);
-            if (nParse < 0)
+            offset += len;
+            nParse = parser->execute(data, offset);
+            if (parser->hasError())
             {
                 // 解析错误
                 close();
                 return nullptr;
             }
-            // nParse==0 报文不完整(不处理到缓存满或者超时退出)
-            offset = len - nParse;
-
             // 解析完成
             if (nParse > 0)
             {
                 break;
             }
-
-            if (offset == (int)buffSize)
+            // 报文不完整，缓存满时退出
+            if (offset == buffSize)
             {
                 close();
                 return nullptr;
             }
-
         } while (true);
-        // 获取请求消息体
-        u_int64_t length = parser->getContentLength();
-        if (length > 0)
+        // 头部视图指向缓冲区
+        parser->getData()->setHeaderBuffer(buffer);
+        // 获取响应消息体，缓冲区中头部之后的数据是消息体的开头
+        uint64_t length = parser->getContentLength();
+        if (length > 0 || parser->isChunked())
         {
-            if (length > HttpRequestParser::getHttpRequestMaxBodySize())
+            if (length > HttpResponseParser::getHttpResponseMaxBodySize())
             {
                 close();
                 return nullptr;
             }
+            HttpBodyReader reader(this, buffer, nParse, offset, length, parser->isChunked(),
+                                  HttpResponseParser::getHttpResponseMaxBodySize());
             std::string body;
-            body.resize(length);
-            int len = 0;
-            if (length >= (u_int64_t)offset)
+            if (reader.readAll(body) < 0)
             {
-                memcpy(&body[0], data, offset);
-                len = offset;
-            }
-            else
-            {
-                memcpy(&body[0], data, length);
-                len = length;
-            }
-            length -= offset;
-            // 如果响应体没获取完整，继续读消息体
-            if (length > 0)
-            {
-                if (readFixSize(&body[len], length) <= 0)
-                {
-                    close();
-                    return nullptr;
-                }
+                close();
+                return nullptr;
             }
-            parser->getData()->setBody(body);
+            parser->getData()->setBody(std::move(body));
         }
         // 暂时不处理压缩
         return parser->getData();
@@ -262,7 +232,7 @@ namespace WebSrv::http
         {
             return nullptr;
         }
-        uint64_t nowMs = getCurrentMilliseconds();
+        uint64_t nowMs = getMonotonicMilliseconds();
         std::vector<HttpConnection *> invalid_conns;
         HttpConnection *ptr = nullptr;
         std::unique_lock lock(_mutex);
@@ -275,7 +245,8 @@ namespace WebSrv::http
                 invalid_conns.push_back(conn);
                 continue;
             }
-            if ((conn->_createTime + _maxAliveTime) > nowMs)
+            // 超过最大存活时间
+            if ((conn->_createTime + _maxAliveTime) <= nowMs)
             {
                 invalid_conns.push_back(conn);
                 continue;
@@ -417,7 +388,7 @@ namespace WebSrv::http
     void HttpConnectionPool::releasePtr(HttpConnection *ptr, HttpConnectionPool *pool)
     {
         ++ptr->_request;
-        if (!ptr->isConnected() || ((ptr->_createTime + pool->_maxAliveTime) >= getCurrentMilliseconds()) || (ptr->_request >= pool->_maxRequest))
+        if (!ptr->isConnected() || ((ptr->_createTime + pool->_maxAliveTime) <= getMonotonicMilliseconds()) || (ptr->_request >= pool->_maxRequest))
         {
             delete ptr;
             --pool->_total;
@@ -1,9 +1,11 @@
 #include "http/httpparser.h"
 #include <string>
 #include <vector>
-#include <regex>
+#include <cstring>
+#include <algorithm>
 #include "util.h"
 #include "configurator.h"
+#include "http/httpscan.h"
 namespace WebSrv::http
 {
     static ConfigVar<uint64_t>::ptr g_httpRequestBufferSize =
@@ -12,6 +14,9 @@ namespace WebSrv::http
     static ConfigVar<uint64_t>::ptr g_httpRequestMaxBodySize =
         Configurator::lookup("http.request.max_body_size", (uint64_t)(64 * 1024 * 1024), "http request max body size");
 
+    static ConfigVar<uint64_t>::ptr g_httpRequestBufferBodySize =
+        Configurator::lookup("http.request.buffer_body_size", (uint64_t)(64 * 1024), "http request body no larger than this is read into memory before dispatch, 0 streams every body");
+
     static ConfigVar<uint64_t>::ptr g_httpResponseBufferSize =
         Configurator::lookup("http.response.buffer_size", (uint64_t)(4 * 1024), "http response buffer size");
 
@@ -20,6 +25,7 @@ namespace WebSrv::http
 
     static uint64_t s_httpRequestBufferSize=0;
     static uint64_t s_httpRequestMaxBodySize=0;
+    static uint64_t s_httpRequestBufferBodySize=0;
     static uint64_t s_httpResponseBufferSize=0;
     static uint64_t s_httpResponseMaxBodySize=0;
 
@@ -28,6 +34,7 @@ namespace WebSrv::http
         _HttpParserSizeInit(){
             s_httpRequestBufferSize=g_httpRequestBufferSize->getValue();
             s_httpRequestMaxBodySize=g_httpRequestMaxBodySize->getValue();
+            s_httpRequestBufferBodySize=g_httpRequestBufferBodySize->getValue();
             s_httpResponseBufferSize=g_httpResponseBufferSize->getValue();
             s_httpResponseMaxBodySize=g_httpResponseMaxBodySize->getValue();
 
@@ -41,6 +48,11 @@ namespace WebSrv::http
                 {
                     s_httpRequestMaxBodySize = newValue;
                 });
+            g_httpRequestBufferBodySize->addChangeValueListener(
+                [](const uint64_t &oldValue, const uint64_t &newValue)
+                {
+                    s_httpRequestBufferBodySize = newValue;
+                });
             g_httpResponseBufferSize->addChangeValueListener(
                 [](const uint64_t &oldValue, const uint64_t &newValue)
                 {
@@ -56,260 +68,513 @@ namespace WebSrv::http
     
     static _HttpParserSizeInit _init;
 
-    HttpRequestParser::HttpRequestParser(uint8_t maxVersion)
-        : _data(new HttpRequest), _maxVersion(maxVersion)
-    {
-    }
-
-    static bool isValidHTTPVersion(const std::string &version)
-    {
-        std::regex versionRegex("^HTTP/(0*[1-9]\\d*)(\\.([01]))?$");
-        return std::regex_match(version, versionRegex);
-    }
 
-    size_t HttpRequestParser::execute(char *data, size_t len)
+    /**
+     * @brief 不区分大小写比较，b必须是小写
+     *
+     */
+    static bool equalsLower(std::string_view a, std::string_view b)
     {
-        _error=0;
-        // 判断是不是数据接收不完整
-        if (len <= 4)
+        if (a.size() != b.size())
         {
-            return 0;
+            return false;
         }
-
-        char* c=strstr(data,"\r\n\r\n");
-        if (!c)
+        for (size_t i = 0; i < a.size(); ++i)
         {
-            return 0;
-        }
-
-        for(int i=0;i<4;i++,c++){
-            *c='\0';
+            if ((a[i] | 0x20) != b[i])
+            {
+                return false;
+            }
         }
+        return true;
+    }
 
-        // 解析提取行
-        std::vector<char *> lines;
-        split2Str(data, lines, "\r\n");
-        char *oldData = data;
-        data = c;
-        if (lines.size() < 1)
+    size_t HttpMessageParser::run(const char *data, size_t len)
+    {
+        if (_state == DONE)
         {
-            _error=(int)HttpStatus::HTTP_STATUS_BAD_REQUEST;
-            return -1;
+            return _offset;
         }
-
-        // 判断请求行
-        std::vector<char *> chunk;
-        split2Str(lines[0], chunk, " ");
-        if (chunk.size() < 3)
+        if (_state == FAILED)
         {
-            _error=(int)HttpStatus::HTTP_STATUS_BAD_REQUEST;
             return -1;
         }
-
-        auto method = HttpMethodFromString(chunk[0]);
-
-        if (method == HttpMethod::HTTP_INVALID_METHOD || (_methods && _methods->count(method) < 0))
+        const char *end = data + len;
+        while (true)
         {
-            _error=(int)HttpStatus::HTTP_STATUS_METHOD_NOT_ALLOWED;
-            return -1;
+            const char *p = data + _scanned;
+            if (_state == HEADERS && !_nameEnd)
+            {
+                // 空行：头部结束
+                if (_scanned == _offset && p < end && (*p == '\r' || *p == '\n'))
+                {
+                    if (*p == '\r' && p + 1 == end)
+                    {
+                        return 0;
+                    }
+                    if (*p == '\r' && p[1] != '\n')
+                    {
+                        return fail();
+                    }
+                    // 同时有content-length和分块编码时无法确定消息边界，拒绝(RFC7230 3.3.3)
+                    if (_chunked && _hasContentLength)
+                    {
+                        return fail();
+                    }
+                    _offset += *p == '\r' ? 2 : 1;
+                    _scanned = _offset;
+                    _state = DONE;
+                    return _offset;
+                }
+                // 头部名称，停在':'(不支持以空白开头的折行obs-fold)
+                p = HttpScanner::findNonToken(p, end);
+                if (p == end)
+                {
+                    _scanned = len;
+                    return 0;
+                }
+                if (*p != ':' || p == data + _offset)
+                {
+                    return fail();
+                }
+                _nameEnd = p - data;
+                _scanned = _nameEnd + 1;
+                ++p;
+            }
+            // 行尾，同时校验起始行和头部值中没有控制字符
+            p = HttpScanner::findControl(p, end);
+            if (p == end)
+            {
+                _scanned = len;
+                return 0;
+            }
+            size_t lineEnd = p - data;
+            size_t next = lineEnd + 1;
+            // 行尾为CRLF，也接受单独的LF(RFC7230 3.5)
+            if (*p == '\r')
+            {
+                if (p + 1 == end)
+                {
+                    _scanned = lineEnd;
+                    return 0;
+                }
+                if (p[1] != '\n')
+                {
+                    return fail();
+                }
+                ++next;
+            }
+            else if (*p != '\n')
+            {
+                return fail();
+            }
+            bool ok = true;
+            if (_state == START_LINE)
+            {
+                // 忽略起始行前的空行
+                if (lineEnd > _offset)
+                {
+                    ok = parseStartLine(std::string_view(data + _offset, lineEnd - _offset));
+                    _state = HEADERS;
+                }
+            }
+            else
+            {
+                ok = parseHeader(std::string_view(data + _offset, _nameEnd - _offset),
+                                 std::string_view(data + _nameEnd + 1, lineEnd - _nameEnd - 1));
+            }
+            if (!ok)
+            {
+                return fail();
+            }
+            _offset = _scanned = next;
+            _nameEnd = 0;
         }
+    }
 
-        _data->setHttpMethod(method);
-
-        if (strlen(chunk[2]) != 8 || !isValidHTTPVersion(chunk[2]))
+    size_t HttpMessageParser::fail()
+    {
+        _state = FAILED;
+        if (!_error)
         {
-            _error=(int)HttpStatus::HTTP_STATUS_HTTP_VERSION_NOT_SUPPORTED;
-            return -1;
+            _error = (int)HttpStatus::HTTP_STATUS_BAD_REQUEST;
         }
+        return -1;
+    }
 
-        uint8_t version = chunk[2][5] - '0';
-        version <<= 4;
-        version += chunk[2][7] - '0';
+    void HttpMessageParser::resetState()
+    {
+        _error = 0;
+        _state = START_LINE;
+        _offset = 0;
+        _scanned = 0;
+        _nameEnd = 0;
+        _contentLength = 0;
+        _hasContentLength = false;
+        _chunked = false;
+    }
 
-        if (version > _maxVersion)
+    bool HttpMessageParser::parseHeader(std::string_view key, std::string_view value)
+    {
+        // 去掉值前后的空白
+        size_t begin = 0;
+        size_t end = value.size();
+        while (begin < end && (value[begin] == ' ' || value[begin] == '\t'))
         {
-            _error=(int)HttpStatus::HTTP_STATUS_HTTP_VERSION_NOT_SUPPORTED;
-            return -1;
+            ++begin;
         }
-
-        _data->setVersion(version);
-
-        // 解析URL
-        URL url;
-        if (!parse2URL(chunk[1], url))
+        while (end > begin && (value[end - 1] == ' ' || value[end - 1] == '\t'))
         {
-            _error = (int)HttpStatus::HTTP_STATUS_BAD_REQUEST;
-            return -1;
+            --end;
         }
-
-        _data->setPath(url.path);
-        if (!url.query.empty())
+        value = value.substr(begin, end - begin);
+        if (equalsLower(key, "content-length"))
         {
-            _data->setPath(url.path);
-            std::vector<std::string> param;
-            // 定义查询参数解析的正则表达式
-            static std::regex queryRegex("([^&=?]+)=([^&=?]+)");
-
-            auto query_begin = std::sregex_iterator(url.query.begin(), url.query.end(), queryRegex);
-            auto query_end = std::sregex_iterator();
-            for (std::sregex_iterator it = query_begin; it != query_end; ++it)
+            uint64_t length = 0;
+            if (value.empty() || value.size() > 19)
+            {
+                return false;
+            }
+            for (char c : value)
+            {
+                if (c < '0' || c > '9')
+                {
+                    return false;
+                }
+                length = length * 10 + (c - '0');
+            }
+            // 重复且不一致的content-length不能确定消息边界(RFC7230 3.3.3)
+            if (_hasContentLength && length != _contentLength)
             {
-                std::smatch match = *it;
-                _data->setParam(match[1].str(), match[2].str());
+                return false;
             }
+            _contentLength = length;
+            _hasContentLength = true;
         }
-
-        auto err = parseHeaders(lines);
-        if (err != 0)
+        else if (equalsLower(key, "transfer-encoding"))
         {
-            return err;
+            // 只支持最后一项为chunked的编码，消息体按分块解码，其他编码交给使用者
+            size_t last = value.rfind(',');
+            std::string_view coding = value.substr(last == std::string_view::npos ? 0 : last + 1);
+            while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t'))
+            {
+                coding.remove_prefix(1);
+            }
+            _chunked = equalsLower(coding, "chunked");
+            if (!_chunked)
+            {
+                _error = (int)HttpStatus::HTTP_STATUS_NOT_IMPLEMENTED;
+                return false;
+            }
         }
-        return data-oldData;
+        onHeader(key, value);
+        return true;
     }
 
-    uint64_t HttpRequestParser::getContentLength()
+    bool HttpMessageParser::parseVersion(std::string_view version, uint8_t &result)
     {
-        return _data->getHeaderAs("content-length", 0);
+        if (version.size() != 8 || version.compare(0, 5, "HTTP/") != 0 || version[6] != '.' ||
+            version[5] < '1' || version[5] > '9' || version[7] < '0' || version[7] > '9')
+        {
+            return false;
+        }
+        result = (uint8_t)((version[5] - '0') << 4 | (version[7] - '0'));
+        return true;
     }
 
-    uint64_t HttpRequestParser::getHttpRequestBufferSize()
-    {
-        return s_httpRequestBufferSize;
-    }
+    /// @brief 块扩展和尾部头部最多跳过的长度
+    static const uint32_t MAX_CHUNKED_SKIP = 8 * 1024;
 
-    uint64_t HttpRequestParser::getHttpRequestMaxBodySize()
+    static inline int hexDigit(char c)
     {
-        return s_httpRequestMaxBodySize;
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        c |= 0x20;
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        return -1;
     }
 
-    int HttpRequestParser::parseHeaders(std::vector<char *> &headers)
+    size_t HttpChunkedDecoder::execute(char *data, size_t len, size_t &decoded)
     {
-        size_t len;
-        for (size_t i = 1; i < headers.size(); i++)
+        decoded = 0;
+        if (_state == FAILED)
         {
-            char *v = strchr(headers[i], ':');
-            if (v == nullptr)
+            return -1;
+        }
+        size_t i = 0;
+        while (i < len && _state != DONE)
+        {
+            char c = data[i];
+            switch (_state)
+            {
+            case SIZE:
+            {
+                int digit = hexDigit(c);
+                if (digit >= 0)
+                {
+                    // 超过16位会溢出
+                    if (++_digits > 16)
+                    {
+                        _state = FAILED;
+                        break;
+                    }
+                    _remaining = _remaining << 4 | digit;
+                }
+                else if (!_digits)
+                {
+                    _state = FAILED;
+                }
+                else if (c == ';' || c == ' ' || c == '\t')
+                {
+                    _state = EXTENSION;
+                }
+                else if (c == '\r')
+                {
+                    _state = SIZE_LF;
+                }
+                else if (c == '\n')
+                {
+                    _state = _remaining ? DATA : TRAILER;
+                }
+                else
+                {
+                    _state = FAILED;
+                }
+                ++i;
+                break;
+            }
+            case EXTENSION:
+            {
+                const char *lf = (const char *)memchr(data + i, '\n', len - i);
+                size_t n = (lf ? lf - data : len) - i;
+                _skipped += n;
+                if (_skipped > MAX_CHUNKED_SKIP)
+                {
+                    _state = FAILED;
+                    break;
+                }
+                i += n;
+                if (lf)
+                {
+                    _state = _remaining ? DATA : TRAILER;
+                    ++i;
+                }
+                break;
+            }
+            case SIZE_LF:
+                _state = c != '\n' ? FAILED : _remaining ? DATA : TRAILER;
+                ++i;
+                break;
+            case DATA:
+            {
+                size_t n = std::min<uint64_t>(_remaining, len - i);
+                memmove(data + decoded, data + i, n);
+                decoded += n;
+                i += n;
+                _remaining -= n;
+                if (!_remaining)
+                {
+                    _state = DATA_CR;
+                }
+                break;
+            }
+            case DATA_CR:
+                _state = c == '\r' ? DATA_LF : c == '\n' ? SIZE : FAILED;
+                _digits = 0;
+                ++i;
+                break;
+            case DATA_LF:
+                _state = c == '\n' ? SIZE : FAILED;
+                ++i;
+                break;
+            case TRAILER:
+                _state = c == '\r' ? TRAILER_LF : c == '\n' ? DONE : TRAILER_LINE;
+                ++i;
+                break;
+            case TRAILER_LINE:
+            {
+                const char *lf = (const char *)memchr(data + i, '\n', len - i);
+                size_t n = (lf ? lf - data : len) - i;
+                _skipped += n;
+                if (_skipped > MAX_CHUNKED_SKIP)
+                {
+                    _state = FAILED;
+                    break;
+                }
+                i += n;
+                if (lf)
+                {
+                    _state = TRAILER;
+                    ++i;
+                }
+                break;
+            }
+            case TRAILER_LF:
+                _state = c == '\n' ? DONE : FAILED;
+                ++i;
+                break;
+            default:
+                break;
+            }
+            if (_state == FAILED)
             {
-                _error = (int)HttpStatus::HTTP_STATUS_BAD_REQUEST;
                 return -1;
             }
-            len = strlen(v);
-            *v = '\0';
-            v++;
-            for (size_t j = 1; j < len && *v == ' '; j++, v++)
-                ;
-            _data->setHeader(headers[i], v);
         }
-        return 0;
+        return i;
     }
 
-    HttpResponseParser::HttpResponseParser()
-        : _data(new HttpResponse)
+    void HttpChunkedDecoder::reset()
+    {
+        _state = SIZE;
+        _remaining = 0;
+        _digits = 0;
+        _skipped = 0;
+    }
+
+    HttpRequestParser::HttpRequestParser(uint8_t maxVersion)
+        : _data(new HttpRequest), _maxVersion(maxVersion)
     {
     }
 
-    size_t HttpResponseParser::execute(char *data, size_t len)
+    void HttpRequestParser::reset()
     {
-        // 判断是不是数据接收不完整
-        if (len <= 4)
+        resetState();
+        _data.reset(new HttpRequest);
+    }
+
+    bool HttpRequestParser::parseStartLine(std::string_view line)
+    {
+        // method SP request-target SP HTTP-version，findControl已保证行内没有控制字符
+        size_t methodEnd = HttpScanner::findNonToken(line.data(), line.data() + line.size()) - line.data();
+        if (methodEnd == 0 || methodEnd == line.size() || line[methodEnd] != ' ')
         {
-            return 0;
+            return false;
         }
-        
-        char* c=strstr(data,"\r\n\r\n");
-        if (!c)
+        size_t targetEnd = line.find(' ', methodEnd + 1);
+        if (targetEnd == methodEnd + 1 || targetEnd == std::string_view::npos)
         {
-            return 0;
-        }
-        
-        for(int i=0;i<4;i++,c++){
-            *c='\0';
-        }
-        // 解析提取行
-        std::vector<char *> lines;
-        split2Str(data, lines, "\r\n");
-        char *oldData = data;
-        data = c;
-        if (lines.size() < 1)
-        {
-            return -1;
+            return false;
         }
 
-        // 判断响应行
-        std::vector<char *> chunk;
-        split2Str(lines[0], chunk, " ");
-        if (chunk.size() < 2)
+        auto method = HttpMethodFromView(line.substr(0, methodEnd));
+        if (method == HttpMethod::HTTP_INVALID_METHOD || (_methods && _methods->count(method) == 0))
         {
-            return -1;
+            _error = (int)HttpStatus::HTTP_STATUS_METHOD_NOT_ALLOWED;
+            return false;
         }
+        _data->setHttpMethod(method);
 
-        if (strlen(chunk[0]) != 8 || !isValidHTTPVersion(chunk[0]))
+        uint8_t version = 0;
+        if (!parseVersion(line.substr(targetEnd + 1), version) || version > _maxVersion)
         {
-            return -1;
+            _error = (int)HttpStatus::HTTP_STATUS_HTTP_VERSION_NOT_SUPPORTED;
+            return false;
         }
-
-        uint8_t version = chunk[0][5] - '0';
-        version <<= 4;
-        version += chunk[0][7] - '0';
         _data->setVersion(version);
 
-        if (strlen(chunk[1]) != 3)
+        // 解析URL：path?query#fragment，路径解码后使用，查询串保持原样到访问参数时才解析
+        URL url;
+        if (!parse2URL(line.substr(methodEnd + 1, targetEnd - methodEnd - 1), url))
         {
-            return -1;
+            return false;
         }
-
-        try
+        url.path.resize(percentDecode(&url.path[0], url.path.size()));
+        // 解码出的'\0'会截断之后按C字符串使用的路径
+        if (url.path.find('\0') != std::string::npos)
         {
-            int status = lexicalCast<int>(chunk[1]);
-            _data->setStatus((HttpStatus)status);
+            return false;
         }
-        catch (...)
+        // 解码后的"%2e%2e"和"%2F"会形成新的路径段，移除点段，超出根目录的路径直接拒绝
+        if (!removeDotSegments(url.path))
         {
-            return -1;
+            return false;
         }
+        _data->setPath(std::move(url.path));
+        _data->setQuery(std::move(url.query));
+        _data->setFragment(std::move(url.fragment));
+        return true;
+    }
 
-        if (chunk.size() == 3)
-        {
-            _data->setReason(chunk[2]);
-        }
+    void HttpRequestParser::onHeader(std::string_view key, std::string_view value)
+    {
+        _data->addHeaderView(key, value);
+    }
 
-        if (!parseHeaders(lines))
-        {
-            return -1;
-        }
-        return data-oldData;
+    uint64_t HttpRequestParser::getHttpRequestBufferSize()
+    {
+        return s_httpRequestBufferSize;
     }
 
-    uint64_t WebSrv::http::HttpResponseParser::getContentLength()
+    uint64_t HttpRequestParser::getHttpRequestMaxBodySize()
     {
-        return _data->getHeaderAs<uint64_t>("content-length", 0);
+        return s_httpRequestMaxBodySize;
     }
 
-    uint64_t HttpResponseParser::getHttpResponseBufferSize()
+    uint64_t HttpRequestParser::getHttpRequestBufferBodySize()
     {
-        return s_httpResponseBufferSize;
+        return s_httpRequestBufferBodySize;
     }
-    uint64_t HttpResponseParser::getHttpResponseMaxBodySize()
+
+    HttpResponseParser::HttpResponseParser()
+        : _data(new HttpResponse)
     {
-        return s_httpResponseMaxBodySize;
     }
-    bool HttpResponseParser::parseHeaders(std::vector<char *> headers)
+
+    void HttpResponseParser::reset()
+    {
+        resetState();
+        _data.reset(new HttpResponse);
+    }
+
+    bool HttpResponseParser::parseStartLine(std::string_view line)
     {
-        size_t len;
-        for (size_t i = 1; i < headers.size(); i++)
+        // HTTP-version SP status-code SP reason-phrase
+        uint8_t version = 0;
+        if (line.size() < 12 || !parseVersion(line.substr(0, 8), version) || line[8] != ' ')
         {
-            char *v = strchr(headers[i], ':');
-            if (v == nullptr)
+            return false;
+        }
+        _data->setVersion(version);
+
+        int status = 0;
+        for (size_t i = 9; i < 12; ++i)
+        {
+            if (line[i] < '0' || line[i] > '9')
             {
                 return false;
             }
-            len = strlen(v);
-            *v = '\0';
-            v++;
-            for (size_t j = 1; j < len && *v == ' '; j++, v++)
-                ;
-            _data->setHeader(headers[i], v);
+            status = status * 10 + (line[i] - '0');
+        }
+        _data->setStatus((HttpStatus)status);
+
+        if (line.size() > 12)
+        {
+            if (line[12] != ' ')
+            {
+                return false;
+            }
+            _data->setReason(std::string(line.substr(13)));
         }
         return true;
     }
+
+    void HttpResponseParser::onHeader(std::string_view key, std::string_view value)
+    {
+        _data->addHeaderView(key, value);
+    }
+
+    uint64_t HttpResponseParser::getHttpResponseBufferSize()
+    {
+        return s_httpResponseBufferSize;
+    }
+    uint64_t HttpResponseParser::getHttpResponseMaxBodySize()
+    {
+        return s_httpResponseMaxBodySize;
+    }
 } // namespace WebSrv::http
@@ -0,0 +1,239 @@
+#include "http/httpscan.h"
+#include <immintrin.h>
+#include <cstdint>
+#include "configurator.h"
+#include "log.h"
+namespace WebSrv::http
+{
+    static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
+
+    static ConfigVar<bool>::ptr g_httpParserSimd =
+        Configurator::lookup("http.parser.simd", true, "http parser use SSE4.2/AVX2 scanning when the cpu supports it");
+
+    /**
+     * @brief token字符表(RFC7230 3.2.6)，以及AVX2按半字节查表用的位图
+     *
+     */
+    struct TokenTable
+    {
+        constexpr TokenTable() : token(), lowNibble(), highBit()
+        {
+            const char *specials = "!#$%&'*+-.^_`|~";
+            for (int c = '0'; c <= '9'; ++c)
+            {
+                token[c] = true;
+            }
+            for (int c = 'a'; c <= 'z'; ++c)
+            {
+                token[c] = true;
+                token[c - 'a' + 'A'] = true;
+            }
+            for (const char *p = specials; *p; ++p)
+            {
+                token[(unsigned char)*p] = true;
+            }
+            // lowNibble[低4位]的第n位表示高4位为n的字符是否为token，token都小于0x80，高4位不超过7
+            for (int c = 0; c < 0x80; ++c)
+            {
+                if (token[c])
+                {
+                    lowNibble[c & 0x0f] |= 1 << (c >> 4);
+                }
+            }
+            for (int i = 0; i < 8; ++i)
+            {
+                highBit[i] = 1 << i;
+            }
+        }
+        bool token[256];
+        uint8_t lowNibble[16];
+        uint8_t highBit[16];
+    };
+    static constexpr TokenTable s_table;
+
+    static inline bool isControl(unsigned char c)
+    {
+        return (c < 0x20 && c != '\t') || c == 0x7f;
+    }
+
+    static const char *findNonTokenScalar(const char *p, const char *end)
+    {
+        while (p < end && s_table.token[(unsigned char)*p])
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    static const char *findControlScalar(const char *p, const char *end)
+    {
+        while (p < end && !isControl(*p))
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    __attribute__((target("sse4.2"))) static const char *findNonTokenSse42(const char *p, const char *end)
+    {
+        // 最多8个区间，不能精确表示token的补集：'|'和'~'落在"{"-"\xff"中，命中后再查表确认
+        alignas(16) static const char ranges[16] = {'\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xff'};
+        const __m128i r = _mm_loadu_si128((const __m128i *)ranges);
+        while (end - p >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            int index = _mm_cmpestri(r, 16, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+            if (index == 16)
+            {
+                p += 16;
+                continue;
+            }
+            p += index;
+            if (!s_table.token[(unsigned char)*p])
+            {
+                return p;
+            }
+            ++p;
+        }
+        return findNonTokenScalar(p, end);
+    }
+
+    __attribute__((target("sse4.2"))) static const char *findControlSse42(const char *p, const char *end)
+    {
+        alignas(16) static const char ranges[16] = {'\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'};
+        const __m128i r = _mm_loadu_si128((const __m128i *)ranges);
+        while (end - p >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            int index = _mm_cmpestri(r, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+            if (index != 16)
+            {
+                return p + index;
+            }
+            p += 16;
+        }
+        return findControlScalar(p, end);
+    }
+
+    __attribute__((target("avx2"))) static const char *findNonTokenAvx2(const char *p, const char *end)
+    {
+        // 按低4位查出允许的高4位位图，再与高4位对应的位相与，为0即不是token(高4位>=8时位为0)
+        const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)s_table.lowNibble));
+        const __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)s_table.highBit));
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        const __m256i zero = _mm256_setzero_si256();
+        while (end - p >= 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            __m256i row = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(v, nibble));
+            __m256i bit = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), zero));
+            if (mask)
+            {
+                p += __builtin_ctz(mask);
+                _mm256_zeroupper();
+                return p;
+            }
+            p += 32;
+        }
+        // 清除ymm高位，避免之后的SSE指令付出切换代价
+        _mm256_zeroupper();
+        return findNonTokenScalar(p, end);
+    }
+
+    __attribute__((target("avx2"))) static const char *findControlAvx2(const char *p, const char *end)
+    {
+        const __m256i max = _mm256_set1_epi8(0x1f);
+        const __m256i del = _mm256_set1_epi8(0x7f);
+        const __m256i tab = _mm256_set1_epi8('\t');
+        while (end - p >= 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max), v);
+            __m256i bad = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), _mm256_or_si256(low, _mm256_cmpeq_epi8(v, del)));
+            uint32_t mask = _mm256_movemask_epi8(bad);
+            if (mask)
+            {
+                p += __builtin_ctz(mask);
+                _mm256_zeroupper();
+                return p;
+            }
+            p += 32;
+        }
+        _mm256_zeroupper();
+        return findControlScalar(p, end);
+    }
+
+    HttpScanner::Kernel HttpScanner::s_kernel = HttpScanner::SCALAR;
+    HttpScanner::ScanFunc HttpScanner::s_findNonToken = findNonTokenScalar;
+    HttpScanner::ScanFunc HttpScanner::s_findControl = findControlScalar;
+
+    HttpScanner::Kernel HttpScanner::getBestKernel()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.2"))
+        {
+            return SSE42;
+        }
+        return SCALAR;
+    }
+
+    HttpScanner::Kernel HttpScanner::setKernel(Kernel kernel)
+    {
+        Kernel best = getBestKernel();
+        if (kernel > best)
+        {
+            kernel = best;
+        }
+        switch (kernel)
+        {
+        case AVX2:
+            s_findNonToken = findNonTokenAvx2;
+            s_findControl = findControlAvx2;
+            break;
+        case SSE42:
+            s_findNonToken = findNonTokenSse42;
+            s_findControl = findControlSse42;
+            break;
+        default:
+            s_findNonToken = findNonTokenScalar;
+            s_findControl = findControlScalar;
+            break;
+        }
+        s_kernel = kernel;
+        return kernel;
+    }
+
+    const char *HttpScanner::KernelToString(Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case AVX2:
+            return "avx2";
+        case SSE42:
+            return "sse4.2";
+        default:
+            return "scalar";
+        }
+    }
+
+    struct _HttpScannerInit
+    {
+        _HttpScannerInit()
+        {
+            HttpScanner::Kernel kernel = HttpScanner::setKernel(g_httpParserSimd->getValue() ? HttpScanner::AVX2 : HttpScanner::SCALAR);
+            SRV_LOG_DEBUG(g_logger) << "http parser scan kernel=" << HttpScanner::KernelToString(kernel);
+            g_httpParserSimd->addChangeValueListener(
+                [](const bool &oldValue, const bool &newValue)
+                {
+                    HttpScanner::setKernel(newValue ? HttpScanner::AVX2 : HttpScanner::SCALAR);
+                });
+        }
+    };
+
+    static _HttpScannerInit _init;
+} // namespace WebSrv::http
@@ -83,8 +83,34 @@ namespace WebSrv::http
             response->setHeader("Server", getName());
             _dispatch->handle(request, response, session);
 
+            // servlet没读完的请求体留在连接中会被当作下一个请求：不大时丢弃，否则关闭连接
+            // (客户端还在等"100 Continue"时消息体可能不会到达，也直接关闭)
+            auto reader = request->getBodyReader();
+            if (reader && !reader->isFinished())
+            {
+                if (reader->isExpectContinue() ||
+                    reader->skip(HttpRequestParser::getHttpRequestBufferBodySize()) < 0 ||
+                    !reader->isFinished())
+                {
+                    isClose = true;
+                    if (session->getResponseState() == HttpSession::ResponseState::NONE)
+                    {
+                        response->setHeader("connection", "close");
+                    }
+                }
+            }
 
-            int ret=session->sendResponse(response);
+            int ret = 0;
+            if (session->getResponseState() != HttpSession::ResponseState::NONE)
+            {
+                // servlet已流式发送响应，补上最后一块；http/1.0的流式响应以关闭连接结束
+                ret = session->finishResponse();
+                isClose = isClose || !response->isChunked();
+            }
+            else
+            {
+                ret = session->sendResponse(response);
+            }
 
             if(ret<=0){
                 SRV_LOG_DEBUG(g_logger) <<"sendResponse http request fail, errno=" << errno << " errstr=" << strerror(errno);
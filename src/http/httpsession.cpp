@@ -1,5 +1,8 @@
 #include "http/httpsession.h"
 #include "http/httpparser.h"
+#include <sstream>
+#include <strings.h>
+#include <sys/uio.h>
 #include "log.h"
 namespace WebSrv::http
 {
@@ -12,14 +15,15 @@ namespace WebSrv::http
 
     HttpRequest::ptr HttpSession::recvRequest()
     {
-
+        _responseState = ResponseState::NONE;
         HttpRequestParser::ptr parser(new HttpRequestParser);
         uint64_t buffSize = HttpRequestParser::getHttpRequestBufferSize();
         std::shared_ptr<char> buffer(new char[buffSize], [](char *p)
                                      { delete[] p; });
         char *data = buffer.get();
-        int offset = 0;
-        // 获取请求头
+        size_t offset = 0;
+        size_t nParse = 0;
+        // 获取请求头，解析器记录已解析的位置，每次只解析新读到的数据
         do
         {
             int len = read(data + offset, buffSize - offset);
@@ -28,71 +32,137 @@ namespace WebSrv::http
                 close();
                 return nullptr;
             }
-            len += offset;
-            size_t nParse = parser->execute(data, len);
-            if (nParse < 0)
+            offset += len;
+            nParse = parser->execute(data, offset);
+            if (parser->hasError())
             {
                 // 解析错误
                 close();
                 return nullptr;
             }
-            // nParse==0 报文不完整(不处理到缓存满或者超时退出)
-            offset = len - nParse;
-
             // 解析完成
             if (nParse > 0)
             {
                 break;
             }
-
-            if (offset == (int)buffSize)
+            // 报文不完整，缓存满时退出
+            if (offset == buffSize)
             {
                 close();
                 return nullptr;
             }
-
         } while (true);
-        // 获取请求消息体
-        u_int64_t length = parser->getContentLength();
-        if (length > 0)
+        // 头部视图指向缓冲区
+        parser->getData()->setHeaderBuffer(buffer);
+        // 请求消息体，缓冲区中头部之后的数据是消息体的开头
+        uint64_t length = parser->getContentLength();
+        if (length > 0 || parser->isChunked())
         {
             if (length > HttpRequestParser::getHttpRequestMaxBodySize())
             {
                 close();
                 return nullptr;
             }
-            std::string body;
-            body.resize(length);
-            int len = 0;
-            if (length >= (u_int64_t)offset)
-            {
-                memcpy(&body[0], data, offset);
-                len = offset;
-            }
-            else
+            HttpBodyReader::ptr reader(new HttpBodyReader(this, buffer, nParse, offset, length, parser->isChunked(),
+                                                          HttpRequestParser::getHttpRequestMaxBodySize()));
+            if (reader->hasError())
             {
-                memcpy(&body[0], data, length);
-                len = length;
+                close();
+                return nullptr;
             }
-            length -= offset;
-            // 如果消息体没获取完整，继续读消息体
-            if (length > 0)
+            reader->setExpectContinue(parser->getData()->getVersion() >= 0x11 &&
+                                      strcasecmp(parser->getData()->getHeader("expect").c_str(), "100-continue") == 0);
+            // 小的请求体在分发前整体读入body，其他的由servlet通过读取器流式读取
+            if (!parser->isChunked() && length <= HttpRequestParser::getHttpRequestBufferBodySize())
             {
-                if (readFixSize(&body[len], length) <= 0)
+                std::string body;
+                if (reader->readAll(body) < 0)
                 {
                     close();
                     return nullptr;
                 }
+                parser->getData()->setBody(std::move(body));
+            }
+            else
+            {
+                parser->getData()->setBodyReader(reader);
             }
-            parser->getData()->setBody(body);
         }
         return parser->getData();
     }
 
     int HttpSession::sendResponse(HttpResponse::ptr response)
     {
+        // http/1.0不支持分块传输编码
+        if (response->getVersion() < 0x11)
+        {
+            response->setChunked(false);
+        }
         std::string data = response->toString();
         return writeFixSize(data.c_str(), data.size());
     }
 
+    int HttpSession::sendResponseHeader(HttpResponse::ptr response)
+    {
+        if (_responseState != ResponseState::NONE)
+        {
+            return -1;
+        }
+        _chunked = response->getVersion() >= 0x11;
+        response->setChunked(_chunked);
+        if (!_chunked)
+        {
+            response->setHeader("connection", "close");
+        }
+        std::stringstream ss;
+        response->dumpHeader(ss);
+        std::string data = ss.str();
+        _responseState = ResponseState::STREAMING;
+        return writeFixSize(data.c_str(), data.size());
+    }
+
+    int HttpSession::sendChunk(const void *data, size_t len)
+    {
+        if (_responseState != ResponseState::STREAMING)
+        {
+            return -1;
+        }
+        if (len == 0)
+        {
+            return 0;
+        }
+        if (!_chunked)
+        {
+            return writeFixSize(data, len) > 0 ? len : -1;
+        }
+        char head[20];
+        int n = snprintf(head, sizeof(head), "%zx\r\n", len);
+        iovec buffers[3];
+        buffers[0].iov_base = head;
+        buffers[0].iov_len = n;
+        buffers[1].iov_base = (void *)data;
+        buffers[1].iov_len = len;
+        buffers[2].iov_base = (void *)"\r\n";
+        buffers[2].iov_len = 2;
+        return writevFixSize(buffers, 3) > 0 ? len : -1;
+    }
+
+    int HttpSession::finishResponse()
+    {
+        if (_responseState == ResponseState::NONE)
+        {
+            return -1;
+        }
+        if (_responseState == ResponseState::FINISHED)
+        {
+            return 1;
+        }
+        _responseState = ResponseState::FINISHED;
+        if (!_chunked)
+        {
+            return 1;
+        }
+        return writeFixSize("0\r\n\r\n", 5);
+    }
+
 } // namespace WebSrv
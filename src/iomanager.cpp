@@ -1,67 +1,180 @@
 #include "iomanager.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
 #include <signal.h>
+#include <algorithm>
 #include "macro.h"
+#include "iouring.h"
+#include "configurator.h"
 namespace WebSrv
 {
     static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
-    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-        : Scheduler(threads, use_caller, name)
+
+    static ConfigVar<std::string>::ptr g_ioBackend =
+        Configurator::lookup<std::string>("iomanager.backend", "epoll", "iomanager io backend, epoll or io_uring (falls back to epoll when unavailable)");
+    static ConfigVar<uint32_t>::ptr g_ioUringEntries =
+        Configurator::lookup<uint32_t>("iomanager.io_uring.entries", 1024, "iomanager io_uring submission queue size");
+    static ConfigVar<uint32_t>::ptr g_ioMaxEvents =
+        Configurator::lookup<uint32_t>("iomanager.max_events", 256, "iomanager max events handled per epoll_wait");
+    static ConfigVar<uint32_t>::ptr g_ioMaxTimeout =
+        Configurator::lookup<uint32_t>("iomanager.max_timeout", 3000, "iomanager max epoll_wait timeout(ms)");
+
+    static uint32_t s_ioMaxEvents = 256;
+    static uint32_t s_ioMaxTimeout = 3000;
+
+    struct _IOManagerInit
+    {
+        _IOManagerInit()
+        {
+            s_ioMaxEvents = g_ioMaxEvents->getValue();
+            s_ioMaxTimeout = g_ioMaxTimeout->getValue();
+            g_ioMaxEvents->addChangeValueListener([](const uint32_t &oldValue, const uint32_t &newValue)
+                                                  { s_ioMaxEvents = newValue; });
+            g_ioMaxTimeout->addChangeValueListener([](const uint32_t &oldValue, const uint32_t &newValue)
+                                                   { s_ioMaxTimeout = newValue; });
+        }
+    };
+
+    static _IOManagerInit s_ioManagerInit;
+
+    static ConfigVar<bool>::ptr g_epollPersistent =
+        Configurator::lookup<bool>("iomanager.epoll_persistent", false, "register fd once with EPOLLIN|EPOLLOUT|EPOLLET and track readiness in user space");
+
+    /// @brief 持久注册模式的IOManager，句柄关闭时需要清除注册状态
+    static std::mutex s_persistentMutex;
+    static std::vector<IOManager *> s_persistentManagers;
+    static std::atomic<size_t> s_persistentCount = 0;
+
+    /// @brief io_uring完成项标记：epoll句柄就绪
+    static const uint64_t URING_EPOLL_TAG = 1;
+    /// @brief io_uring完成项标记：忽略(超时、取消请求)
+    static const uint64_t URING_IGNORE_TAG = 2;
+
+    /**
+     * @brief 提交到io_uring的请求，存放在等待协程的栈上，完成后恢复协程
+     *
+     */
+    struct IoRequest
+    {
+        Scheduler *scheduler = nullptr;
+        Fiber::ptr fiber;
+        /// @brief 所属句柄上下文，请求在其链表中直到协程恢复后摘除
+        IOManager::FdContext *fdCtx = nullptr;
+        IoRequest *prev = nullptr;
+        IoRequest *next = nullptr;
+        __kernel_timespec ts;
+        int res = 0;
+    };
+    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, bool affinity)
+        : Scheduler(threads, use_caller, name), TimerManager(getWorkerCount() + 1), _affinity(affinity), _persistent(g_epollPersistent->getValue())
     {
-        // 初始化epoll和pipe管道
+        // 初始化epoll和唤醒eventfd
         _epollFd = epoll_create(5000);
         WebSrvAssert(_epollFd > 0);
-        int ret = pipe(_tickleFds);
-        WebSrvAssert(ret == 0);
+        _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        WebSrvAssert(_wakeFd >= 0);
 
         epoll_event event{};
         // 边缘触发
         event.events = EPOLLIN | EPOLLET;
-        event.data.fd = _tickleFds[0];
-        // 非阻塞
-        ret = fcntl(_tickleFds[0], F_SETFL, O_NONBLOCK);
+        event.data.fd = _wakeFd;
+        int ret = epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event);
         WebSrvAssert(ret == 0);
 
-        ret = epoll_ctl(_epollFd, EPOLL_CTL_ADD, _tickleFds[0], &event);
-        WebSrvAssert(ret == 0);
+        // 每个工作线程一个eventfd，不轮询epoll的空闲线程等待在上面，唤醒时只唤醒一个
+        _idleFds.resize(getWorkerCount());
+        _idleWaiting.resize(getWorkerCount(), 0);
+        for (auto &fd : _idleFds)
+        {
+            fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            WebSrvAssert(fd >= 0);
+        }
+        if (_affinity)
+        {
+            // 每个工作线程一个epoll，空闲时直接等待在自己的epoll上，eventfd注册在其中用于唤醒
+            _epollFds.resize(getWorkerCount());
+            for (size_t i = 0; i < _epollFds.size(); ++i)
+            {
+                _epollFds[i] = epoll_create(5000);
+                WebSrvAssert(_epollFds[i] > 0);
+                event.events = EPOLLIN | EPOLLET;
+                event.data.fd = _idleFds[i];
+                ret = epoll_ctl(_epollFds[i], EPOLL_CTL_ADD, _idleFds[i], &event);
+                WebSrvAssert(ret == 0);
+            }
+        }
+        if (_persistent)
+        {
+            std::lock_guard<std::mutex> lock(s_persistentMutex);
+            s_persistentManagers.push_back(this);
+            ++s_persistentCount;
+        }
         signal(SIGPIPE,SIG_IGN);
-        contextResize(32);
+        allocFdPage(0);
+        initIoUring();
         start();
     }
 
+    void IOManager::initIoUring()
+    {
+        if (g_ioBackend->getValue() != "io_uring")
+        {
+            return;
+        }
+        if (_affinity)
+        {
+            SRV_LOG_WARN(g_logger) << "io_uring backend does not support affinity mode, use epoll";
+            return;
+        }
+        std::unique_ptr<IoUring> ring(new IoUring);
+        if (!ring->init(g_ioUringEntries->getValue()))
+        {
+            SRV_LOG_WARN(g_logger) << "io_uring unavailable (" << errno << ") (" << strerror(errno) << "), use epoll";
+            return;
+        }
+        _ring = std::move(ring);
+        _backend = IO_URING;
+    }
+
     IOManager::~IOManager()
     {
         stop();
+        SRV_LOG_DEBUG(g_logger) << getName() << " poll wakeups=" << _pollWakeups
+                                << " events=" << _polledEvents << " full=" << _pollFullBatches
+                                << " events/wakeup=" << (_pollWakeups ? (double)_polledEvents / _pollWakeups : 0);
+        if (_persistent)
+        {
+            std::lock_guard<std::mutex> lock(s_persistentMutex);
+            s_persistentManagers.erase(std::find(s_persistentManagers.begin(), s_persistentManagers.end(), this));
+            --s_persistentCount;
+        }
         close(_epollFd);
-        close(_tickleFds[0]);
-        close(_tickleFds[1]);
-        for (size_t i = 0; i < _fdContexts.size(); i++)
+        close(_wakeFd);
+        for (auto fd : _idleFds)
         {
-            if (_fdContexts[i])
-            {
-                delete _fdContexts[i];
-            }
+            close(fd);
+        }
+        for (auto fd : _epollFds)
+        {
+            close(fd);
+        }
+        for (auto &page : _fdPages)
+        {
+            delete[] page.load();
         }
     }
 
     int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
     {
-        FdContext *fdCtx = nullptr;
-        ReadMutex readlock(_rwMutex);
-        if ((int)_fdContexts.size() > fd)
-        {
-            fdCtx = _fdContexts[fd];
-            readlock.unlock();
-        }
-        else
+        FdContext *fdCtx = getFdContext(fd);
+        if (!fdCtx)
         {
-            readlock.unlock();
-            WriteMutex writelock(_rwMutex);
-            contextResize(fd * 1.5);
-            fdCtx = _fdContexts[fd];
+            SRV_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+            return -1;
         }
 
         std::lock_guard lock(fdCtx->mutex);
@@ -72,20 +185,62 @@ namespace WebSrv
                                     << " fd_ctx.event=" << (EPOLL_EVENTS)fdCtx->events;
             WebSrvAssert(!(fdCtx->events & event));
         }
+        if (_persistent && (fdCtx->ready & event))
+        {
+            // 上次等待之后已经就绪，消费就绪状态
+            fdCtx->ready = (Event)(fdCtx->ready & ~event);
+            if (!cb)
+            {
+                // 协程形式由调用者直接重试
+                return 1;
+            }
+            // 回调形式直接调度回调，相当于事件立即触发
+            Scheduler *scheduler = Scheduler::getThis();
+            std::thread::id threadid;
+            if (!scheduler || scheduler == this)
+            {
+                scheduler = this;
+                if (_affinity && fdCtx->registered)
+                {
+                    threadid = getWorkerThreadId(fdCtx->worker);
+                }
+            }
+            scheduler->schedule(&cb, threadid);
+            return 0;
+        }
 
-        int op = fdCtx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD; // 存在事件，修改注册，尚未注册事件，添加新的事件
-
-        epoll_event epollEvent;
-        epollEvent.events = EPOLLET | fdCtx->events | event;
-        epollEvent.data.ptr = fdCtx;
-        int ret = epoll_ctl(_epollFd, op, fd, &epollEvent);
-        if (ret)
+        // 持久注册模式只在首次添加时注册，否则存在事件，修改注册，尚未注册事件，添加新的事件
+        int op = -1;
+        if (!_persistent)
         {
-            SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << _epollFd << ", "
-                                    << op << ", " << fd << ", " << (EPOLL_EVENTS)epollEvent.events << "):"
-                                    << ret << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                    << (EPOLL_EVENTS)fdCtx->events;
-            return -1;
+            op = fdCtx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        }
+        else if (!fdCtx->registered)
+        {
+            op = EPOLL_CTL_ADD;
+        }
+        if (_affinity && op == EPOLL_CTL_ADD)
+        {
+            // 分配给当前工作线程，外部线程添加的轮流分配
+            size_t index = getWorkerIndex();
+            fdCtx->worker = index != ~0ull ? index : pickWorker();
+        }
+        if (op != -1)
+        {
+            int epollFd = getEpollFd(fdCtx);
+            epoll_event epollEvent;
+            epollEvent.events = _persistent ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) : (EPOLLET | fdCtx->events | event);
+            epollEvent.data.u64 = epollData(fdCtx);
+            int ret = epoll_ctl(epollFd, op, fd, &epollEvent);
+            if (ret)
+            {
+                SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd << ", "
+                                        << op << ", " << fd << ", " << (EPOLL_EVENTS)epollEvent.events << "):"
+                                        << ret << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                                        << (EPOLL_EVENTS)fdCtx->events;
+                return -1;
+            }
+            fdCtx->registered = _persistent;
         }
 
         ++_pendingEventCount;
@@ -94,6 +249,10 @@ namespace WebSrv
         fdCtx->events = (Event)(fdCtx->events | event);
         FdContext::EventContext &eventCtx = fdCtx->getContext(event);
         eventCtx.scheduler = Scheduler::getThis();
+        if (_affinity && eventCtx.scheduler == this)
+        {
+            eventCtx.threadid = getWorkerThreadId(fdCtx->worker);
+        }
         if (cb)
         {
             eventCtx.cb.swap(cb);
@@ -108,32 +267,21 @@ namespace WebSrv
 
     bool IOManager::cancelEvent(int fd, Event event)
     {
-        ReadMutex readlock(_rwMutex);
-        if ((int)_fdContexts.size() <= fd)
+        FdContext *fdCtx = findFdContext(fd);
+        if (!fdCtx)
         {
             return false;
         }
-        FdContext *fdCtx = _fdContexts[fd];
-        readlock.unlock();
         // 无事件
         std::lock_guard lock(fdCtx->mutex);
         if (!(fdCtx->events & event))
         {
             return false;
         }
-        // 移除对应事件
+        // 移除对应事件，持久注册模式保持注册不变
         Event newEvents = (Event)(fdCtx->events & ~event);
-        int op = newEvents ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event eventEvent;
-        eventEvent.events = EPOLLET | newEvents;
-        eventEvent.data.ptr = fdCtx;
-        int ret = epoll_ctl(_epollFd, op, fd, &eventEvent);
-        if (ret)
+        if (!_persistent && updateEpoll(fdCtx, newEvents))
         {
-            SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << _epollFd << ", "
-                                    << op << ", " << fd << ", " << (EPOLL_EVENTS)eventEvent.events << "):"
-                                    << ret << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                    << (EPOLL_EVENTS)fdCtx->events;
             return -1;
         }
         fdCtx->triggerEvent(event);
@@ -143,32 +291,21 @@ namespace WebSrv
 
     bool IOManager::delEvent(int fd, Event event)
     {
-        ReadMutex readlock(_rwMutex);
-        if ((int)_fdContexts.size() <= fd)
+        FdContext *fdCtx = findFdContext(fd);
+        if (!fdCtx)
         {
             return false;
         }
-        FdContext *fdCtx = _fdContexts[fd];
-        readlock.unlock();
         std::lock_guard lock(fdCtx->mutex);
         // 无事件
         if (!(fdCtx->events & event))
         {
             return false;
         }
-        // 移除对应事件
+        // 移除对应事件，持久注册模式保持注册不变
         Event newEvents = (Event)(fdCtx->events & ~event);
-        int op = newEvents ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event eventEvent;
-        eventEvent.events = EPOLLET | newEvents;
-        eventEvent.data.ptr = fdCtx;
-        int ret = epoll_ctl(_epollFd, op, fd, &eventEvent);
-        if (ret)
+        if (!_persistent && updateEpoll(fdCtx, newEvents))
         {
-            SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << _epollFd << ", "
-                                    << op << ", " << fd << ", " << (EPOLL_EVENTS)eventEvent.events << "):"
-                                    << ret << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                    << (EPOLL_EVENTS)fdCtx->events;
             return -1;
         }
         --_pendingEventCount;
@@ -181,6 +318,220 @@ namespace WebSrv
     {
         return dynamic_cast<IOManager *>(Scheduler::getThis());
     }
+
+    int IOManager::updateEpoll(FdContext *fdCtx, Event events)
+    {
+        int op = events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epollEvent;
+        epollEvent.events = EPOLLET | events;
+        epollEvent.data.u64 = epollData(fdCtx);
+        int epollFd = getEpollFd(fdCtx);
+        int ret = epoll_ctl(epollFd, op, fdCtx->fd, &epollEvent);
+        if (!ret && op == EPOLL_CTL_DEL)
+        {
+            ++fdCtx->generation;
+        }
+        if (ret)
+        {
+            SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd << ", "
+                                    << op << ", " << fdCtx->fd << ", " << (EPOLL_EVENTS)epollEvent.events << "):"
+                                    << ret << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                                    << (EPOLL_EVENTS)fdCtx->events;
+        }
+        return ret;
+    }
+
+    void IOManager::forgetFd(int fd)
+    {
+        if (s_persistentCount == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(s_persistentMutex);
+        for (auto iom : s_persistentManagers)
+        {
+            FdContext *fdCtx = iom->findFdContext(fd);
+            if (!fdCtx)
+            {
+                continue;
+            }
+            // 关闭句柄时内核自动从epoll中移除，不需要EPOLL_CTL_DEL
+            std::lock_guard<std::mutex> ctxLock(fdCtx->mutex);
+            fdCtx->registered = false;
+            fdCtx->ready = NONE;
+            ++fdCtx->generation;
+        }
+    }
+
+    IOManager::FdContext *IOManager::findFdContext(int fd) const
+    {
+        if (fd < 0 || (size_t)fd >= FD_PAGE_SIZE * FD_PAGE_COUNT)
+        {
+            return nullptr;
+        }
+        FdContext *page = _fdPages[fd / FD_PAGE_SIZE].load(std::memory_order_acquire);
+        return page ? &page[fd % FD_PAGE_SIZE] : nullptr;
+    }
+
+    IOManager::FdContext *IOManager::getFdContext(int fd)
+    {
+        FdContext *fdCtx = findFdContext(fd);
+        if (fdCtx || fd < 0 || (size_t)fd >= FD_PAGE_SIZE * FD_PAGE_COUNT)
+        {
+            return fdCtx;
+        }
+        return &allocFdPage(fd / FD_PAGE_SIZE)[fd % FD_PAGE_SIZE];
+    }
+
+    IOManager::FdContext *IOManager::allocFdPage(size_t index)
+    {
+        FdContext *page = new FdContext[FD_PAGE_SIZE];
+        for (size_t i = 0; i < FD_PAGE_SIZE; ++i)
+        {
+            page[i].fd = index * FD_PAGE_SIZE + i;
+        }
+        // 多个线程同时分配同一页时只有一个成功，其他的释放自己分配的页
+        FdContext *expected = nullptr;
+        if (!_fdPages[index].compare_exchange_strong(expected, page, std::memory_order_acq_rel))
+        {
+            delete[] page;
+            return expected;
+        }
+        return page;
+    }
+
+    int IOManager::submitIO(const io_uring_sqe &sqe, uint64_t timeout)
+    {
+        WebSrvAssert(_ring);
+        IoRequest req;
+        req.scheduler = Scheduler::getThis();
+        req.fiber = Fiber::getThis();
+        WebSrvAssert(!req.fiber->isSharedStack());
+        req.fdCtx = getFdContext(sqe.fd);
+        const unsigned need = timeout != ~0ull ? 2 : 1;
+        {
+            std::lock_guard<std::mutex> lock(_ringMutex);
+            if (_ring->space() < need)
+            {
+                // 提交队列已满，先提交让内核取走
+                _ring->submit();
+                if (_ring->space() < need)
+                {
+                    return -EAGAIN;
+                }
+            }
+            io_uring_sqe *first = _ring->getSqe();
+            io_uring_sqe *second = need == 2 ? _ring->getSqe() : nullptr;
+            *first = sqe;
+            first->user_data = (uint64_t)&req;
+            if (second)
+            {
+                // 链接超时请求，超时后取消io请求(结果为-ECANCELED)
+                first->flags |= IOSQE_IO_LINK;
+                req.ts.tv_sec = timeout / 1000;
+                req.ts.tv_nsec = (timeout % 1000) * 1000000ll;
+                second->opcode = IORING_OP_LINK_TIMEOUT;
+                second->fd = -1;
+                second->addr = (uint64_t)&req.ts;
+                second->len = 1;
+                second->user_data = URING_IGNORE_TAG;
+            }
+            ++_pendingEventCount;
+            if (req.fdCtx)
+            {
+                req.next = req.fdCtx->ioRequests;
+                if (req.next)
+                {
+                    req.next->prev = &req;
+                }
+                req.fdCtx->ioRequests = &req;
+            }
+            _ring->flush();
+            // 有轮询线程时它可能阻塞在等待中，需要立即提交；否则留给下一个轮询线程在等待时一起提交，省去一次系统调用
+            if (_poller != ~0ull)
+            {
+                int ret = _ring->submit();
+                if (ret < 0)
+                {
+                    // 请求仍在提交队列中，由轮询线程下次提交
+                    SRV_LOG_ERROR(g_logger) << "io_uring submit error (" << -ret << ") (" << strerror(-ret) << ")";
+                }
+            }
+        }
+        Fiber::yieldToSuspend();
+        if (req.fdCtx)
+        {
+            std::lock_guard<std::mutex> lock(_ringMutex);
+            (req.prev ? req.prev->next : req.fdCtx->ioRequests) = req.next;
+            if (req.next)
+            {
+                req.next->prev = req.prev;
+            }
+        }
+        if (req.res == -ECANCELED && timeout != ~0ull)
+        {
+            return -ETIMEDOUT;
+        }
+        return req.res;
+    }
+
+    int IOManager::waitIoUring(epoll_event *events, int maxEvents, int timeout, TaskList &batch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_ringMutex);
+            if (!_epollArmed)
+            {
+                io_uring_sqe *sqe = _ring->getSqe();
+                if (sqe)
+                {
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->fd = _epollFd;
+                    sqe->poll32_events = POLLIN;
+                    sqe->user_data = URING_EPOLL_TAG;
+                    _epollArmed = true;
+                }
+            }
+            _ring->flush();
+        }
+        int ret = _ring->wait(timeout);
+        if (ret == -EINTR)
+        {
+            errno = EINTR;
+            return -1;
+        }
+        bool epollReady = false;
+        _ring->reap([this, &epollReady, &batch](uint64_t userData, int res)
+                    {
+            if (userData == URING_EPOLL_TAG)
+            {
+                epollReady = true;
+                _epollArmed = false;
+                return;
+            }
+            if (userData == URING_IGNORE_TAG)
+            {
+                return;
+            }
+            IoRequest *req = (IoRequest *)userData;
+            req->res = res;
+            --_pendingEventCount;
+            // 调度后请求所在的协程可能立即恢复，不能再访问req
+            if (req->scheduler == this)
+            {
+                Task *task = Task::Create();
+                task->assign(&req->fiber);
+                batch.push(task);
+            }
+            else
+            {
+                req->scheduler->schedule(&req->fiber);
+            } });
+        if (!epollReady)
+        {
+            return 0;
+        }
+        return epoll_wait(_epollFd, events, maxEvents, 0);
+    }
     void IOManager::stop()
     {
         closeRecurringTimers();
@@ -188,19 +539,158 @@ namespace WebSrv
     }
     void IOManager::tickle()
     {
-        if (!hasIdleThreads())
+        if (_stopping)
         {
+            // 停止时唤醒所有空闲线程
+            std::vector<size_t> idles;
+            {
+                std::lock_guard<std::mutex> lock(_idleMutex);
+                idles.swap(_idleWorkers);
+                for (auto index : idles)
+                {
+                    _idleWaiting[index] = 0;
+                }
+                _idleWaitingCount = 0;
+            }
+            for (auto index : idles)
+            {
+                writeWakeup(_idleFds[index]);
+            }
+            wakePoller();
             return;
         }
-        int rt = write(_tickleFds[1], "T", 1);
-        WebSrvAssert(rt == 1); // 一对一
+        size_t index = ~0ull;
+        if (_idleWaitingCount > 0)
+        {
+            std::lock_guard<std::mutex> lock(_idleMutex);
+            if (!_idleWorkers.empty())
+            {
+                index = _idleWorkers.back();
+                _idleWorkers.pop_back();
+                _idleWaiting[index] = 0;
+                --_idleWaitingCount;
+            }
+        }
+        if (index != ~0ull)
+        {
+            writeWakeup(_idleFds[index]);
+        }
+        else if (_poller != ~0ull)
+        {
+            wakePoller();
+        }
+    }
+
+    void IOManager::tickle(std::thread::id threadid)
+    {
+        size_t index = threadid == std::thread::id() ? ~0ull : getWorkerIndex(threadid);
+        if (index == ~0ull)
+        {
+            tickle();
+            return;
+        }
+        bool waiting = false;
+        if (_idleWaitingCount > 0)
+        {
+            std::lock_guard<std::mutex> lock(_idleMutex);
+            if (_idleWaiting[index])
+            {
+                _idleWaiting[index] = 0;
+                _idleWorkers.erase(std::find(_idleWorkers.begin(), _idleWorkers.end(), index));
+                --_idleWaitingCount;
+                waiting = true;
+            }
+        }
+        if (waiting)
+        {
+            writeWakeup(_idleFds[index]);
+        }
+        else if (_poller == index)
+        {
+            wakePoller();
+        }
+        // 其他情况该线程正在执行任务，回到调度循环时会检查自己的收件箱
+    }
+
+    void IOManager::wakePoller()
+    {
+        if (!_pollerNotified.exchange(true))
+        {
+            writeWakeup(_wakeFd);
+        }
+    }
+
+    void IOManager::writeWakeup(int fd)
+    {
+        uint64_t one = 1;
+        int rt = write(fd, &one, sizeof(one));
+        WebSrvAssert(rt == sizeof(one));
+    }
+
+    void IOManager::addIdleWaiter(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(_idleMutex);
+        _idleWorkers.emplace_back(index);
+        _idleWaiting[index] = 1;
+        ++_idleWaitingCount;
+    }
+
+    void IOManager::removeIdleWaiter(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(_idleMutex);
+        if (_idleWaiting[index])
+        {
+            _idleWaiting[index] = 0;
+            _idleWorkers.erase(std::find(_idleWorkers.begin(), _idleWorkers.end(), index));
+            --_idleWaitingCount;
+        }
+    }
+
+    void IOManager::waitWakeup(size_t index)
+    {
+        addIdleWaiter(index);
+        // 进入等待后再检查一次，期间添加的任务必然会唤醒自己或被看到
+        if (!hasRunnableTask() && !stopping())
+        {
+            pollfd pfd{_idleFds[index], POLLIN, 0};
+            poll(&pfd, 1, 3000);
+        }
+        uint64_t value;
+        while (read(_idleFds[index], &value, sizeof(value)) > 0)
+            ;
+        removeIdleWaiter(index);
+    }
+
+    size_t IOManager::pickWorker()
+    {
+        size_t n = getWorkerCount();
+        for (size_t i = 0; i < n; ++i)
+        {
+            size_t index = _nextWorker++ % n;
+            std::thread::id threadid = getWorkerThreadId(index);
+            // use_caller的线程只在stop()时进入调度，不分配连接
+            if (threadid != std::thread::id() && threadid != _rootThreadid)
+            {
+                return index;
+            }
+        }
+        return _nextWorker++ % n;
+    }
+
+    std::thread::id IOManager::nextAffinityThread()
+    {
+        if (!_affinity)
+        {
+            return std::thread::id();
+        }
+        return getWorkerThreadId(pickWorker());
     }
     bool IOManager::stopping()
     {
         uint64_t timeout=0;
         return stopping(timeout);
     }
-    bool IOManager::stopping(uint64_t timeout)
+    bool IOManager::stopping(uint64_t &timeout)
     {
         timeout = getNextTimer();
         return timeout == ~0ull &&
@@ -210,10 +700,14 @@ namespace WebSrv
     void IOManager::idle()
     {
         SRV_LOG_DEBUG(g_logger) << __func__;
-        const uint64_t MAX_EVENTS = 256;
+        const int MAX_EVENTS = s_ioMaxEvents ? s_ioMaxEvents : 1;
         epoll_event *events = new epoll_event[MAX_EVENTS];
         std::shared_ptr<epoll_event> spEvents(events, [](epoll_event *ptr)
                                               { delete[] ptr; });
+        const size_t self = getWorkerIndex();
+        // 连接亲和模式下每个工作线程轮询自己的epoll，否则由一个轮询线程处理共享的epoll
+        const bool ownEpoll = _affinity && self != ~0ull;
+        const int epollFd = ownEpoll ? _epollFds[self] : _epollFd;
         while (true)
         {
             uint64_t nextTimeout=0;
@@ -221,11 +715,25 @@ namespace WebSrv
             {
                 break;
             }
+            if (ownEpoll)
+            {
+                addIdleWaiter(self);
+            }
+            // 同一时间只有一个空闲线程轮询epoll，其他空闲线程等待在自己的eventfd上
+            size_t none = ~0ull;
+            if (!ownEpoll && self != ~0ull && _poller != self && !_poller.compare_exchange_strong(none, self))
+            {
+                waitWakeup(self);
+                Fiber::yieldToSuspend();
+                continue;
+            }
+            // 完成的io请求、到期的定时器和触发的事件收集到一起，最后一次性加入队列
+            TaskList batch;
             int ret;
             int timeout;
             do
             {
-                static const int MAX_TIMEOUT = 3000;
+                const int MAX_TIMEOUT = s_ioMaxTimeout;
                 if (nextTimeout != ~0ull)
                 {
                     timeout = (int)nextTimeout > MAX_TIMEOUT ? MAX_TIMEOUT : nextTimeout;
@@ -234,7 +742,19 @@ namespace WebSrv
                 {
                     timeout = MAX_TIMEOUT;
                 }
-                ret = epoll_wait(_epollFd, events, MAX_EVENTS, timeout);
+                // 成为轮询线程前添加的任务可能没有唤醒自己
+                if (hasRunnableTask())
+                {
+                    timeout = 0;
+                }
+                if (_ring && !ownEpoll)
+                {
+                    ret = waitIoUring(events, MAX_EVENTS, timeout, batch);
+                }
+                else
+                {
+                    ret = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+                }
                 if (ret < 0 && errno == EINTR)
                 {
                 }
@@ -243,30 +763,96 @@ namespace WebSrv
                     break;
                 }
             } while (true);
+            if (ownEpoll)
+            {
+                removeIdleWaiter(self);
+            }
+            // 等待之后时钟缓存已过时
+            refreshClockCache();
+            if (ret >= 0)
+            {
+                _pollWakeups.fetch_add(1, std::memory_order_relaxed);
+                _polledEvents.fetch_add(ret, std::memory_order_relaxed);
+                if (ret == MAX_EVENTS)
+                {
+                    _pollFullBatches.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
 
             std::vector<std::function<void()>> cbs;
             listExpiredCallback(cbs);
-            if (!cbs.empty())
+            for (auto &cb : cbs)
             {
-                schedule(cbs.begin(), cbs.end());
-                cbs.clear();
+                Task *task = Task::Create();
+                task->assign(&cb);
+                if (task->valid())
+                {
+                    batch.push(task);
+                }
+                else
+                {
+                    Task::Destroy(task);
+                }
             }
 
             // 处理io事件
             for (int i = 0; i < ret; i++)
             {
                 epoll_event &event = events[i];
-                if (event.data.fd == _tickleFds[0])
+                if (event.data.fd == _wakeFd)
                 {
-                    uint8_t tmp[256];
-                    // 此处为有超时任务产生的fd，读出后忽略
-                    while (read(_tickleFds[0], tmp, sizeof(tmp)) > 0)
+                    uint64_t value;
+                    // 唤醒轮询线程(有新任务或定时器)，读出后忽略
+                    _pollerNotified = false;
+                    while (read(_wakeFd, &value, sizeof(value)) > 0)
+                        ;
+                    continue;
+                }
+                if (ownEpoll && event.data.fd == _idleFds[self])
+                {
+                    uint64_t value;
+                    while (read(_idleFds[self], &value, sizeof(value)) > 0)
                         ;
                     continue;
                 }
 
-                FdContext *fdCtx = (FdContext *)event.data.ptr;
+                FdContext *fdCtx = findFdContext((uint32_t)event.data.u64);
+                if (!fdCtx)
+                {
+                    continue;
+                }
                 std::lock_guard lock(fdCtx->mutex);
+                if (fdCtx->generation != (uint32_t)(event.data.u64 >> 32))
+                {
+                    // 取出后句柄已从epoll移除(可能已关闭并被复用)，丢弃过时的事件
+                    continue;
+                }
+                if (_persistent)
+                {
+                    // 持久注册：有等待者的事件直接触发，没有的记录为就绪，不调用epoll_ctl
+                    int realEvents = NONE;
+                    if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+                    {
+                        realEvents |= READ;
+                    }
+                    if (event.events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    {
+                        realEvents |= WRITE;
+                    }
+                    int waiting = fdCtx->events & realEvents;
+                    fdCtx->ready = (Event)(fdCtx->ready | (realEvents & ~waiting));
+                    if (waiting & READ)
+                    {
+                        fdCtx->triggerEvent(READ, &batch, this);
+                        --_pendingEventCount;
+                    }
+                    if (waiting & WRITE)
+                    {
+                        fdCtx->triggerEvent(WRITE, &batch, this);
+                        --_pendingEventCount;
+                    }
+                    continue;
+                }
                 // 发生错误将事件重新添加
                 if (event.events & (EPOLLERR | EPOLLHUP))
                 {
@@ -295,43 +881,99 @@ namespace WebSrv
                 int op = leftEvents ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
                 event.events = EPOLLET | leftEvents;
 
-                int ret2 = epoll_ctl(_epollFd, op, fdCtx->fd, &event);
+                int ret2 = epoll_ctl(epollFd, op, fdCtx->fd, &event);
                 if (ret2)
                 {
-                    SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << _epollFd << ", "
+                    SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd << ", "
                                             << op << ", " << fdCtx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
                                             << ret2 << " (" << errno << ") (" << strerror(errno) << ")";
                     continue;
                 }
+                if (op == EPOLL_CTL_DEL)
+                {
+                    ++fdCtx->generation;
+                }
                 // 将事件添加到池中
                 if (realEvents & READ)
                 {
-                    fdCtx->triggerEvent(READ);
+                    fdCtx->triggerEvent(READ, &batch, this);
                     --_pendingEventCount;
                 }
 
                 if (realEvents & WRITE)
                 {
-                    fdCtx->triggerEvent(WRITE);
+                    fdCtx->triggerEvent(WRITE, &batch, this);
                     --_pendingEventCount;
                 }
             }
+            // 共享epoll的轮询线程有任务时会交出轮询并唤醒一个线程，这里不再唤醒
+            pushTasks(batch, ownEpoll || self == ~0ull);
+            if (!ownEpoll && self != ~0ull)
+            {
+                // 没有任务时继续轮询，否则交出轮询并唤醒一个空闲线程接替
+                if (!hasRunnableTask())
+                {
+                    continue;
+                }
+                _poller = ~0ull;
+                tickle();
+            }
             Fiber::yieldToSuspend();
         }
+        if (self != ~0ull && _poller == self)
+        {
+            _poller = ~0ull;
+            tickle();
+        }
     }
     void IOManager::onTimerInsertedAtFront()
     {
-        tickle();
+        // 只有轮询线程需要重新计算超时时间，亲和模式下唤醒一个空闲线程
+        if (_affinity)
+        {
+            tickle();
+        }
+        else
+        {
+            wakePoller();
+        }
     }
     bool IOManager::cancelAll(int fd)
     {
-        ReadMutex readlock(_rwMutex);
-        if ((int)_fdContexts.size() <= fd)
+        FdContext *fdCtx = findFdContext(fd);
+        if (!fdCtx)
         {
             return false;
         }
-        FdContext *fdCtx = _fdContexts[fd];
-        readlock.unlock();
+        if (_ring)
+        {
+            // 逐个按user_data取消该句柄上正在执行的io_uring请求(按句柄取消需要5.19以上内核)
+            std::lock_guard<std::mutex> lock(_ringMutex);
+            bool submit = false;
+            for (IoRequest *req = fdCtx->ioRequests; req; req = req->next)
+            {
+                io_uring_sqe *sqe = _ring->getSqe();
+                if (!sqe)
+                {
+                    _ring->submit();
+                    sqe = _ring->getSqe();
+                    if (!sqe)
+                    {
+                        SRV_LOG_ERROR(g_logger) << "io_uring cancel fd=" << fd << " no sqe";
+                        break;
+                    }
+                }
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = (uint64_t)req;
+                sqe->user_data = URING_IGNORE_TAG;
+                submit = true;
+            }
+            if (submit)
+            {
+                _ring->submit();
+            }
+        }
         // 无事件
         std::lock_guard lock(fdCtx->mutex);
 
@@ -339,18 +981,9 @@ namespace WebSrv
         {
             return false;
         }
-        // 移除所有事件
-        int op = EPOLL_CTL_DEL;
-        epoll_event eventEvent;
-        eventEvent.events = 0;
-        eventEvent.data.ptr = fdCtx;
-        int ret = epoll_ctl(_epollFd, op, fd, &eventEvent);
-        if (ret)
+        // 移除所有事件，持久注册模式保持注册不变(关闭句柄时由forgetFd清除)
+        if (!_persistent && updateEpoll(fdCtx, NONE))
         {
-            SRV_LOG_ERROR(g_logger) << "epoll_ctl(" << _epollFd << ", "
-                                    << op << ", " << fd << ", " << (EPOLL_EVENTS)eventEvent.events << "):"
-                                    << ret << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                    << (EPOLL_EVENTS)fdCtx->events;
             return -1;
         }
         if (fdCtx->events & READ)
@@ -366,38 +999,6 @@ namespace WebSrv
         WebSrvAssert(fdCtx->events == 0);
         return true;
     }
-    void IOManager::contextResize(size_t size)
-    {
-        size_t oldsize = _fdContexts.size();
-        if (oldsize == size)
-        {
-            return;
-        }
-        else if (oldsize < size)
-        {
-            _fdContexts.resize(size);
-            for (size_t i = 0; i < _fdContexts.size(); i++)
-            {
-                if (!_fdContexts[i])
-                {
-                    _fdContexts[i] = new FdContext;
-                    _fdContexts[i]->fd = i;
-                }
-            }
-        }
-        else
-        {
-            // 一般只增不减
-            for (size_t i = oldsize - 1; i >= size; i--)
-            {
-                if (_fdContexts[i])
-                {
-                    delete _fdContexts[i];
-                    _fdContexts.pop_back();
-                }
-            }
-        }
-    }
     IOManager::FdContext::EventContext &IOManager::FdContext::getContext(Event event)
     {
         switch (event)
@@ -416,21 +1017,37 @@ namespace WebSrv
         ctx.scheduler = nullptr;
         ctx.fiber.reset();
         ctx.cb = nullptr;
+        ctx.threadid = std::thread::id();
     }
-    void IOManager::FdContext::triggerEvent(Event event)
+    void IOManager::FdContext::triggerEvent(Event event, TaskList *batch, Scheduler *batchOwner)
     {
         WebSrvAssert(events & event);
         events = (Event)(events & ~event);
         EventContext &ctx = getContext(event);
-        if (ctx.cb)
+        if (batch && ctx.scheduler == batchOwner)
+        {
+            Task *task = Task::Create();
+            if (ctx.cb)
+            {
+                task->assign(&ctx.cb);
+            }
+            else
+            {
+                task->assign(&ctx.fiber);
+            }
+            task->threadid = ctx.threadid;
+            batch->push(task);
+        }
+        else if (ctx.cb)
         {
-            ctx.scheduler->schedule(&ctx.cb);
+            ctx.scheduler->schedule(&ctx.cb, ctx.threadid);
         }
         else
         {
-            ctx.scheduler->schedule(&ctx.fiber);
+            ctx.scheduler->schedule(&ctx.fiber, ctx.threadid);
         }
         ctx.scheduler = nullptr;
+        ctx.threadid = std::thread::id();
         return;
     }
 } // namespace WebSrv
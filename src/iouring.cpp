@@ -0,0 +1,162 @@
+#include "iouring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace WebSrv
+{
+    static int io_uring_setup(unsigned entries, io_uring_params *params)
+    {
+        return syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg, size_t argSize)
+    {
+        return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+    }
+
+    IoUring::~IoUring()
+    {
+        if (_sqes)
+        {
+            munmap(_sqes, _sqesSize);
+        }
+        if (_cqRing && _cqRing != _sqRing)
+        {
+            munmap(_cqRing, _cqRingSize);
+        }
+        if (_sqRing)
+        {
+            munmap(_sqRing, _sqRingSize);
+        }
+        if (_fd >= 0)
+        {
+            close(_fd);
+        }
+    }
+
+    bool IoUring::init(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _fd = io_uring_setup(entries, &params);
+        if (_fd < 0)
+        {
+            return false;
+        }
+        // 需要等待带超时(EXT_ARG)、完成项不丢失(NODROP)、单次mmap映射两个队列(SINGLE_MMAP)
+        const unsigned required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP;
+        if ((params.features & required) != required)
+        {
+            errno = ENOTSUP;
+            return false;
+        }
+        _entries = params.sq_entries;
+        _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (_cqRingSize > _sqRingSize)
+        {
+            _sqRingSize = _cqRingSize;
+        }
+        _cqRingSize = _sqRingSize;
+        _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_sqRing == MAP_FAILED)
+        {
+            _sqRing = nullptr;
+            return false;
+        }
+        _cqRing = _sqRing;
+        _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = (io_uring_sqe *)mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sqes == MAP_FAILED)
+        {
+            _sqes = nullptr;
+            return false;
+        }
+
+        char *sq = (char *)_sqRing;
+        _sqHead = (unsigned *)(sq + params.sq_off.head);
+        _sqTail = (unsigned *)(sq + params.sq_off.tail);
+        _sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+        _sqArray = (unsigned *)(sq + params.sq_off.array);
+        char *cq = (char *)_cqRing;
+        _cqHead = (unsigned *)(cq + params.cq_off.head);
+        _cqTail = (unsigned *)(cq + params.cq_off.tail);
+        _cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+        _cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        _sqeHead = _sqeTail = *_sqTail;
+        return true;
+    }
+
+    io_uring_sqe *IoUring::getSqe()
+    {
+        unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+        if (_sqeTail - head >= _entries)
+        {
+            return nullptr;
+        }
+        io_uring_sqe *sqe = &_sqes[_sqeTail & *_sqMask];
+        ++_sqeTail;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    unsigned IoUring::flush()
+    {
+        unsigned count = _sqeTail - _sqeHead;
+        if (count == 0)
+        {
+            return 0;
+        }
+        for (unsigned i = _sqeHead; i != _sqeTail; ++i)
+        {
+            _sqArray[i & *_sqMask] = i & *_sqMask;
+        }
+        __atomic_store_n(_sqTail, _sqeTail, __ATOMIC_RELEASE);
+        _sqeHead = _sqeTail;
+        return count;
+    }
+
+    int IoUring::submit()
+    {
+        flush();
+        if (unsubmitted() == 0)
+        {
+            return 0;
+        }
+        // 提交数量取最大值，内核取走所有已发布的项，多个线程同时提交时链接的请求不会被拆开
+        int ret;
+        do
+        {
+            ret = io_uring_enter(_fd, _entries, 0, 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        return ret < 0 ? -errno : ret;
+    }
+
+    int IoUring::wait(int timeout)
+    {
+        unsigned toSubmit = unsubmitted() ? _entries : 0;
+        if (hasCompletion())
+        {
+            if (!toSubmit)
+            {
+                return 0;
+            }
+            // 已有完成项，只提交不等待
+            timeout = 0;
+        }
+        __kernel_timespec ts;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (timeout >= 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000ll;
+            arg.ts = (uint64_t)&ts;
+        }
+        int ret = io_uring_enter(_fd, toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        return ret < 0 ? -errno : 0;
+    }
+} // namespace WebSrv
@@ -8,17 +8,12 @@ namespace WebSrv
 
     constexpr int FORMAT_BUF_SIZE = 256;
 
+    // 程序加载时的单调时钟
+    static uint64_t s_startTime = getMonotonicMilliseconds();
+
     uint64_t getElapseTime()
     {
-        static uint64_t startTime=GetProcessStartTime();
-            // 获取当前时间点
-        auto currentTime = std::chrono::system_clock::now();
-
-         // 将当前时间点转换为时间戳（毫秒为单位）
-        auto duration = currentTime.time_since_epoch();
-        uint64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-
-        return millis-startTime;
+        return getMonotonicMilliseconds() - s_startTime;
     }
 
 
@@ -163,7 +163,7 @@ namespace WebSrv
             new LogEvent(shared_from_this(), level,
                          curFile, curLine, curFunc, WebSrv::getElapseTime(),
                          getSystemTheadId(), WebSrv::Fiber::getFiberId(),
-                         SystemClock::to_time_t(SystemClock::now()),Thread::getName()));
+                         getCachedTime(),Thread::getName()));
         event->getStringStream() << msg;
         LogEventWrap eventWrap(event);
     }
@@ -0,0 +1,105 @@
+#include "offload.h"
+#include <cerrno>
+#include "scheduler.h"
+#include "configurator.h"
+#include "thread.h"
+#include "hook.h"
+#include "log.h"
+
+namespace WebSrv
+{
+    static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
+
+    static ConfigVar<uint32_t>::ptr g_offloadThreads =
+        Configurator::lookup<uint32_t>("offload.threads", 4, "blocking work offload pool threads");
+
+    OffloadPool *OffloadPool::getInstance()
+    {
+        static OffloadPool pool;
+        return &pool;
+    }
+
+    OffloadPool::~OffloadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cond.notify_all();
+        for (auto &thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+    bool OffloadPool::canOffload()
+    {
+        // hook只在调度器的工作线程中启用
+        if (!isHookEnable() || !Scheduler::getThis())
+        {
+            return false;
+        }
+        Fiber::ptr fiber = Fiber::getThis();
+        return fiber.get() != Scheduler::getMainFiber() && !fiber->isSharedStack();
+    }
+
+    void OffloadPool::run(const std::function<void()> &cb)
+    {
+        std::call_once(_started, &OffloadPool::start, this);
+        Job job;
+        job.cb = &cb;
+        job.scheduler = Scheduler::getThis();
+        job.fiber = Fiber::getThis();
+        // 由当前线程恢复，池中线程完成得比挂起早时，当前线程也要先挂起才能取到这个协程
+        job.threadid = std::this_thread::get_id();
+        job.scheduler->addExternalWait();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(&job);
+        }
+        _cond.notify_one();
+        ++_offloadCount;
+        Fiber::yieldToSuspend();
+        job.scheduler->removeExternalWait();
+        errno = job.error;
+    }
+
+    void OffloadPool::start()
+    {
+        uint32_t count = g_offloadThreads->getValue();
+        count = count ? count : 1;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            _threads.emplace_back(&OffloadPool::worker, this);
+        }
+        SRV_LOG_DEBUG(g_logger) << "offload pool start threads=" << count;
+    }
+
+    void OffloadPool::worker()
+    {
+        Thread::setName("offload");
+        while (true)
+        {
+            Job *job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [this]()
+                           { return _stopping || !_jobs.empty(); });
+                if (_jobs.empty())
+                {
+                    return;
+                }
+                job = _jobs.front();
+                _jobs.pop_front();
+            }
+            errno = 0;
+            (*job->cb)();
+            job->error = errno;
+            // 调度后协程可能立即恢复，job随协程的栈失效，之后不能再访问
+            Scheduler *scheduler = job->scheduler;
+            Fiber::ptr fiber = std::move(job->fiber);
+            std::thread::id threadid = job->threadid;
+            scheduler->schedule(&fiber, threadid);
+        }
+    }
+} // namespace WebSrv
@@ -1,12 +1,22 @@
 #include "scheduler.h"
 #include "log.h"
 #include "hook.h"
+#include "macro.h"
+#include "configurator.h"
+#include "util.h"
 namespace WebSrv
 {
 
     static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
     static thread_local Scheduler *t_scheduler = nullptr;
     static thread_local Fiber *t_schedulerFiber = nullptr;
+    /// @brief 当前线程在所属调度器中的工作线程下标
+    static thread_local size_t t_workerIndex = ~0ull;
+
+    static ConfigVar<uint32_t>::ptr g_schedulerQueueCapacity =
+        Configurator::lookup<uint32_t>("scheduler.queue_capacity", 4096, "scheduler per thread task queue capacity");
+    static ConfigVar<bool>::ptr g_clockCache =
+        Configurator::lookup<bool>("scheduler.clock_cache", true, "cache clock once per scheduler loop iteration in worker threads");
 
     Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
         : _name(name), _threadNum(threads)
@@ -28,6 +38,11 @@ namespace WebSrv
             _rootThreadid = std::this_thread::get_id();
             _threadIds.emplace_back(_rootThreadid);
         }
+        size_t workers = (_threadNum ? _threadNum : 1) + (use_caller ? 1 : 0);
+        for (size_t i = 0; i < workers; ++i)
+        {
+            _workers.emplace_back(new Worker(i, g_schedulerQueueCapacity->getValue()));
+        }
     }
 
     Scheduler::~Scheduler()
@@ -36,6 +51,22 @@ namespace WebSrv
         {
             t_scheduler = nullptr;
         }
+        // 正常停止时队列已为空
+        for (auto &worker : _workers)
+        {
+            while (Task *task = worker->queue.steal())
+            {
+                Task::Destroy(task);
+            }
+            while (Task *task = worker->inbox.pop())
+            {
+                Task::Destroy(task);
+            }
+        }
+        while (Task *task = _fibers.pop())
+        {
+            Task::Destroy(task);
+        }
     }
 
     Scheduler *Scheduler::getThis()
@@ -64,6 +95,16 @@ namespace WebSrv
         }
     }
 
+    std::vector<std::thread::id> Scheduler::getPoolThreadIds() const
+    {
+        std::vector<std::thread::id> ids;
+        for (auto &thread : _threads)
+        {
+            ids.emplace_back(thread.get_id());
+        }
+        return ids;
+    }
+
     void Scheduler::stop()
     {
         if (_rootFiber &&
@@ -117,6 +158,7 @@ namespace WebSrv
                 return;
             }
         }
+        WebSrvAssert2(!Fiber::getThis()->isSharedStack(), "shared stack fiber can not switch thread");
         schedule(Fiber::getThis(), threadid);
         Fiber::yieldToSuspend();
     }
@@ -126,6 +168,280 @@ namespace WebSrv
         SRV_LOG_INFO(g_logger) << __func__;
     }
 
+    Scheduler::Worker *Scheduler::findWorker(std::thread::id threadid)
+    {
+        for (auto &worker : _workers)
+        {
+            if (worker->threadid.load(std::memory_order_acquire) == threadid)
+            {
+                return worker.get();
+            }
+        }
+        return nullptr;
+    }
+
+    Scheduler::Worker *Scheduler::bindWorker()
+    {
+        for (auto &worker : _workers)
+        {
+            std::thread::id none;
+            if (worker->threadid.compare_exchange_strong(none, std::this_thread::get_id()))
+            {
+                t_workerIndex = worker->index;
+                return worker.get();
+            }
+        }
+        return nullptr;
+    }
+
+    void Scheduler::tickle(std::thread::id threadid)
+    {
+        if (hasIdleThreads())
+        {
+            tickle();
+        }
+    }
+
+    size_t Scheduler::getWorkerIndex() const
+    {
+        return t_scheduler == this ? t_workerIndex : ~0ull;
+    }
+
+    size_t Scheduler::getWorkerIndex(std::thread::id threadid)
+    {
+        Worker *worker = findWorker(threadid);
+        return worker ? worker->index : ~0ull;
+    }
+
+    bool Scheduler::hasRunnableTask()
+    {
+        // 与pushTask中的屏障配对，保证不会错过刚添加的任务
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t index = getWorkerIndex();
+        if (index < _workers.size() && _workers[index]->inboxSize > 0)
+        {
+            return true;
+        }
+        if (_globalSize > 0)
+        {
+            return true;
+        }
+        for (auto &worker : _workers)
+        {
+            if (!worker->queue.empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 共享栈协程的栈内容在其线程的共享栈上，只能回到该线程执行；绑定线程的协程也回到绑定的线程
+     *
+     * @param task
+     */
+    static void pinFiberThread(Task *task)
+    {
+        if (!task->fiber)
+        {
+            return;
+        }
+        if (task->fiber->isSharedStack() && task->fiber->getSharedThread() != std::thread::id())
+        {
+            task->threadid = task->fiber->getSharedThread();
+        }
+        else if (task->fiber->getBoundThread() != std::thread::id())
+        {
+            task->threadid = task->fiber->getBoundThread();
+        }
+    }
+
+    void Scheduler::pushTask(Task *task)
+    {
+        pinFiberThread(task);
+        // 先计数，保证任务在队列中时stopping()不会返回真
+        ++_taskCount;
+        std::thread::id threadid = task->threadid;
+        bool pushed = false;
+        if (threadid != std::thread::id())
+        {
+            Worker *worker = findWorker(threadid);
+            if (worker)
+            {
+                std::lock_guard<std::mutex> lock(worker->mutex);
+                worker->inbox.push(task);
+                ++worker->inboxSize;
+                pushed = true;
+            }
+        }
+        else if (t_scheduler == this && t_workerIndex < _workers.size())
+        {
+            pushed = _workers[t_workerIndex]->queue.push(task);
+        }
+        if (!pushed)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _fibers.push(task);
+            ++_globalSize;
+        }
+        // 与空闲线程进入等待前的检查配对(hasRunnableTask)，避免丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        tickle(threadid);
+    }
+
+    void Scheduler::pushTasks(TaskList &tasks, bool tickleAny)
+    {
+        if (tasks.empty())
+        {
+            return;
+        }
+        // 先计数，保证任务在队列中时stopping()不会返回真
+        uint64_t count = 0;
+        for (Task *task = tasks.head; task; task = task->next)
+        {
+            ++count;
+        }
+        _taskCount += count;
+
+        // 指定线程的任务先按线程收集，再各加一次锁放入收件箱
+        static thread_local std::vector<TaskList> t_inboxes;
+        if (t_inboxes.size() < _workers.size())
+        {
+            t_inboxes.resize(_workers.size());
+        }
+        const size_t self = getWorkerIndex();
+        TaskList global;
+        size_t globalCount = 0;
+        bool any = false;
+        while (Task *task = tasks.pop())
+        {
+            pinFiberThread(task);
+            if (task->threadid != std::thread::id())
+            {
+                Worker *worker = findWorker(task->threadid);
+                if (worker)
+                {
+                    t_inboxes[worker->index].push(task);
+                    continue;
+                }
+            }
+            else if (self < _workers.size() && _workers[self]->queue.push(task))
+            {
+                any = true;
+                continue;
+            }
+            any = true;
+            global.push(task);
+            ++globalCount;
+        }
+        if (globalCount)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            while (Task *task = global.pop())
+            {
+                _fibers.push(task);
+            }
+            _globalSize += globalCount;
+        }
+        static thread_local std::vector<size_t> t_targets;
+        t_targets.clear();
+        for (size_t i = 0; i < _workers.size(); ++i)
+        {
+            if (t_inboxes[i].empty())
+            {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(_workers[i]->mutex);
+            while (Task *task = t_inboxes[i].pop())
+            {
+                _workers[i]->inbox.push(task);
+                ++_workers[i]->inboxSize;
+            }
+            if (i != self)
+            {
+                t_targets.push_back(i);
+            }
+        }
+        // 与空闲线程进入等待前的检查配对(hasRunnableTask)，避免丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (auto index : t_targets)
+        {
+            tickle(getWorkerThreadId(index));
+        }
+        if (any && tickleAny)
+        {
+            tickle(std::thread::id());
+        }
+    }
+
+    Task *Scheduler::takeTask(Worker *self, bool &tickleMe)
+    {
+        Task *ft = nullptr;
+        if (self && self->inboxSize > 0)
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            ft = self->inbox.pop();
+            if (ft)
+            {
+                --self->inboxSize;
+            }
+        }
+        // 队头竞争失败说明被其他线程取走，只要还有任务就重试
+        while (!ft && self && !self->queue.empty())
+        {
+            ft = self->queue.steal();
+        }
+        if (!ft && _globalSize > 0)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Task *prev = nullptr;
+            Task *it = _fibers.head;
+            while (it)
+            {
+                // 不是期望执行的线程，等待其他线程获取
+                if (it->threadid != std::thread::id() && it->threadid != std::this_thread::get_id())
+                {
+                    prev = it;
+                    it = it->next;
+                    tickleMe = true;
+                    continue;
+                }
+                // 可能是由外部线程的主协程调度的忽略（一般不会出现）
+                if (it->fiber && it->fiber->getState() == Fiber::RUNNING)
+                {
+                    prev = it;
+                    it = it->next;
+                    tickleMe = true;
+                    continue;
+                }
+                ft = _fibers.removeAfter(prev);
+                --_globalSize;
+                break;
+            }
+        }
+        if (!ft)
+        {
+            // 从其他线程窃取
+            size_t n = _workers.size();
+            size_t start = self ? self->index : 0;
+            for (size_t i = 0; i < n && !ft; ++i)
+            {
+                Worker *victim = _workers[(start + i) % n].get();
+                if (victim != self && !victim->queue.empty())
+                {
+                    ft = victim->queue.steal();
+                }
+            }
+        }
+        if (ft)
+        {
+            // 还有任务可被其他线程执行
+            tickleMe |= (self && !self->queue.empty()) || _globalSize > 0;
+        }
+        return ft;
+    }
+
     void Scheduler::run()
     {
         SRV_LOG_DEBUG(g_logger) << _name << " " << __func__;
@@ -136,81 +452,77 @@ namespace WebSrv
             // 构建每个线程的主协程
             t_schedulerFiber = Fiber::getThis().get();
         }
+        Worker *self = bindWorker();
+        // 每轮循环刷新一次时钟缓存，任务中读取时钟不再调用clock_gettime
+        setClockCache(g_clockCache->getValue());
         // 空闲协程
-        Fiber::ptr idleFiber(new Fiber(std::bind(&Scheduler::idle, this)));
+        Fiber::ptr idleFiber = Fiber::create(std::bind(&Scheduler::idle, this));
         SRV_LOG_DEBUG(g_logger)<<"idleFiber: "<<idleFiber->getId();
         // 回调函数协程
         Fiber::ptr cbFiber;
-        FiberAndThread ft;
         while (true)
         {
-            ft.reset();
+            refreshClockCache();
             bool tickle_me = false;
             bool active = false;
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _fibers.begin();
-            while (it != _fibers.end())
+            Task *task = takeTask(self, tickle_me);
+            if (task && task->fiber && task->fiber->getState() == Fiber::RUNNING)
+            {
+                // 协程还未切出(如switchTo)，放回全局队列稍后执行
+                std::lock_guard<std::mutex> lock(_mutex);
+                _fibers.push(task);
+                ++_globalSize;
+                tickle_me = true;
+                task = nullptr;
+            }
+            if (task)
             {
-                // 不是期望执行的线程，等待其他线程获取
-                if (it->_threadid != std::thread::id() && it->_threadid != std::this_thread::get_id())
-                {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-                // 可能是由外部线程的主协程调度的忽略（一般不会出现）
-                if (it->_fiber && it->_fiber->getState() == Fiber::RUNNING)
-                {
-                    ++it;
-                    continue;
-                }
-
-                ft = *it;
-                _fibers.erase(it++);
                 ++_activeThreadCount;
+                --_taskCount;
                 active = true;
-                break;
             }
-            // 没有期望在该线程执行的协程时为假
-            tickle_me |= it != _fibers.end();
-            lock.unlock();
             // 通知其他线程，有处理不了的任务,无实装时不执行
             if (tickle_me)
             {
                 tickle();
             }
 
-            if (ft._fiber &&
-                (ft._fiber->getState() != Fiber::DONE &&
-                 ft._fiber->getState() != Fiber::EXCEPT))
+            if (task && task->fiber &&
+                (task->fiber->getState() != Fiber::DONE &&
+                 task->fiber->getState() != Fiber::EXCEPT))
             {
-                ft._fiber->swapIn();
+                Fiber::ptr fiber;
+                fiber.swap(task->fiber);
+                Task::Destroy(task);
+                fiber->swapIn();
                 --_activeThreadCount;
 
-                if (ft._fiber->getState() == Fiber::READY)
+                if (fiber->getState() == Fiber::READY)
                 { // 就绪状态，重新加入
-                    schedule(ft._fiber);
+                    schedule(&fiber);
                 }
-                ft.reset();
             }
-            else if (ft._cb)
-            { // 函数任务
+            else if (task && task->cb)
+            { // 函数任务，任务由协程执行完后释放(协程挂起后可能在其他线程结束)
+                auto cb = [task]()
+                {
+                    std::unique_ptr<Task, void (*)(Task *)> guard(task, &Task::Destroy);
+                    task->cb();
+                };
                 if (cbFiber)
                 {
-                    cbFiber->reset(ft._cb);
+                    cbFiber->reset(cb);
                 }
                 else
                 {
-                    cbFiber.reset(new Fiber(ft._cb));
+                    cbFiber = Fiber::create(cb, 0, false, _sharedStack);
                 }
-                ft.reset();
                 cbFiber->swapIn();
                 --_activeThreadCount;
 
                 if (cbFiber->getState() == Fiber::READY)
                 { // 就绪状态，重新加入
-                    schedule(cbFiber);
-                    cbFiber.reset();
+                    schedule(&cbFiber);
                 }
                 else if (cbFiber->getState() == Fiber::SUSPEND)
                 {
@@ -224,12 +536,19 @@ namespace WebSrv
                 if (active)
                 {
                     // 还有任务
+                    Task::Destroy(task);
                     --_activeThreadCount;
                     continue;
                 }
                 if (idleFiber->getState() == Fiber::DONE)
                 {
                     SRV_LOG_DEBUG(g_logger) << _name << "idle fiber done";
+                    if (self)
+                    {
+                        self->threadid.store(std::thread::id());
+                        t_workerIndex = ~0ull;
+                    }
+                    setClockCache(false);
                     break;
                 }
 
@@ -242,8 +561,7 @@ namespace WebSrv
 
     bool Scheduler::stopping()
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        return _stopping && _fibers.empty() && _activeThreadCount == 0;
+        return _stopping && _taskCount == 0 && _activeThreadCount == 0 && _externalWaits == 0;
     }
 
     void Scheduler::idle()
@@ -3,11 +3,30 @@
 #include "fdmanager.h"
 #include <netinet/tcp.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
 #include "hook.h"
 namespace WebSrv
 {
     static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
 
+    /**
+     * @brief 是否为通配地址(0.0.0.0/::)
+     *
+     */
+    static bool isAnyAddress(const Address::ptr &addr)
+    {
+        const sockaddr *sa = addr->getAddr();
+        if (sa->sa_family == AF_INET)
+        {
+            return ((const sockaddr_in *)sa)->sin_addr.s_addr == htonl(INADDR_ANY);
+        }
+        if (sa->sa_family == AF_INET6)
+        {
+            return IN6_IS_ADDR_UNSPECIFIED(&((const sockaddr_in6 *)sa)->sin6_addr);
+        }
+        return true;
+    }
+
     Socket::ptr Socket::CreateTCP(Address::ptr address)
     {
         Socket::ptr socket(new Socket(address->getFamily(), TCP, 0));
@@ -104,7 +123,7 @@ namespace WebSrv
 
     int64_t Socket::getSendTimeout()
     {
-        FdCtx::ptr ctx = FdManager::getFdManger()->get(_socket);
+        FdCtx *ctx = FdManager::getFdManger()->get(_socket);
         if (ctx)
         {
             return ctx->getTimeout(SO_SNDTIMEO);
@@ -133,7 +152,7 @@ namespace WebSrv
             int(timeout / 1000), int(timeout % 1000 * 1000)
         };
         setOption(SOL_SOCKET, SO_SNDTIMEO, tv);
-        FdCtx::ptr ctx = FdManager::getFdManger()->get(_socket);
+        FdCtx *ctx = FdManager::getFdManger()->get(_socket);
         if (ctx)
         {
             ctx->setTimeout(SO_SNDTIMEO, timeout);
@@ -142,7 +161,7 @@ namespace WebSrv
 
     int64_t Socket::getRecvTimeout()
     {
-        FdCtx::ptr ctx = FdManager::getFdManger()->get(_socket);
+        FdCtx *ctx = FdManager::getFdManger()->get(_socket);
         if (ctx)
         {
             return ctx->getTimeout(SO_RCVTIMEO);
@@ -171,7 +190,7 @@ namespace WebSrv
             int(timeout / 1000), int(timeout % 1000 * 1000)
         };
         setOption(SOL_SOCKET, SO_RCVTIMEO, tv);
-        FdCtx::ptr ctx = FdManager::getFdManger()->get(_socket);
+        FdCtx *ctx = FdManager::getFdManger()->get(_socket);
         if (ctx)
         {
             ctx->setTimeout(SO_RCVTIMEO, timeout);
@@ -188,7 +207,7 @@ namespace WebSrv
         return error;
     }
 
-    bool Socket::bind(Address::ptr address)
+    bool Socket::bind(Address::ptr address, bool reusePort)
     {
         if (!isValid())
         {
@@ -198,6 +217,10 @@ namespace WebSrv
                 return false;
             }
         }
+        if (reusePort && !setOption(SOL_SOCKET, SO_REUSEPORT, 1))
+        {
+            return false;
+        }
         if (address->getFamily() != _family)
         {
             SRV_LOG_ERROR(g_logger) << "bind socket.family= " << _family << ", address.family" << address->getFamily() << "on equal, address=" << address->toString();
@@ -248,18 +271,81 @@ namespace WebSrv
 
     Socket::ptr Socket::accept()
     {
-        Socket::ptr sock(new Socket(_family, _type, _protocol));
-        int newSock = ::accept(_socket, nullptr, nullptr);
+        std::vector<Socket::ptr> clients;
+        return acceptBatch(clients, 1) ? clients[0] : nullptr;
+    }
+
+    size_t Socket::acceptBatch(std::vector<Socket::ptr> &clients, size_t max)
+    {
+        const int flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sockaddr_storage peer;
+        socklen_t peerLen = sizeof(peer);
+        // 第一个连接走hook，没有积压时挂起协程等待
+        int newSock = ::accept4(_socket, (sockaddr *)&peer, &peerLen, flags);
         if (newSock == -1)
         {
             SRV_LOG_ERROR(g_logger) << "accept (" << _socket << ") errno="
                                     << errno << "errno string=" << strerror(errno);
+            return 0;
+        }
+        size_t count = 0;
+        Socket::ptr sock = wrapAccepted(newSock, (sockaddr *)&peer, peerLen);
+        if (sock)
+        {
+            clients.emplace_back(sock);
+            ++count;
+        }
+        // 监听socket由hook设为非阻塞时，直接调用原函数取出积压的连接，取空即停止，不再等待
+        FdCtx *ctx = FdManager::getFdManger()->get(_socket);
+        if (!ctx || !ctx->getSysNonblock())
+        {
+            return count;
+        }
+        int savedErrno = errno;
+        while (count < max)
+        {
+            peerLen = sizeof(peer);
+            newSock = accept4_f(_socket, (sockaddr *)&peer, &peerLen, flags);
+            if (newSock == -1)
+            {
+                if (errno != EAGAIN && errno != EINTR)
+                {
+                    SRV_LOG_ERROR(g_logger) << "accept (" << _socket << ") errno="
+                                            << errno << "errno string=" << strerror(errno);
+                }
+                break;
+            }
+            sock = wrapAccepted(newSock, (sockaddr *)&peer, peerLen);
+            if (sock)
+            {
+                clients.emplace_back(sock);
+                ++count;
+            }
+        }
+        errno = savedErrno;
+        return count;
+    }
+
+    Socket::ptr Socket::wrapAccepted(int socket, const sockaddr *peer, socklen_t peerLen)
+    {
+        if (!FdManager::getFdManger()->addSocket(socket))
+        {
+            ::close(socket);
+            return nullptr;
         }
-        if (sock->init(newSock))
+        Socket::ptr sock(new Socket(_family, _type, _protocol));
+        sock->_socket = socket;
+        sock->_isConnected = true;
+        if (_family != UNIX)
         {
-            return sock;
+            sock->_remoteAddress = Address::create(peer, peerLen);
+            // 监听在具体地址上时连接的本地地址与其相同，通配地址时留到获取时再查询
+            if (_localAddress && !isAnyAddress(_localAddress))
+            {
+                sock->_localAddress = Address::create(_localAddress->getAddr(), _localAddress->getAddrLen());
+            }
         }
-        return nullptr;
+        return sock;
     }
 
     bool Socket::connect(const Address::ptr addr, int64_t timeoutMs)
@@ -410,6 +496,51 @@ namespace WebSrv
         return -1;
     }
 
+    ssize_t Socket::sendFile(int fd, off_t *offset, size_t count)
+    {
+        if (isConnected())
+        {
+            return ::sendfile(_socket, fd, offset, count);
+        }
+        return -1;
+    }
+
+    ssize_t Socket::spliceFrom(int fd, loff_t *offset, size_t length, unsigned int flags)
+    {
+        if (isConnected())
+        {
+            return ::splice(fd, offset, _socket, nullptr, length, flags);
+        }
+        return -1;
+    }
+
+    ssize_t Socket::spliceTo(int fd, size_t length, unsigned int flags)
+    {
+        if (isConnected())
+        {
+            return ::splice(_socket, nullptr, fd, nullptr, length, flags);
+        }
+        return -1;
+    }
+
+    Address::ptr Socket::getRemoteAddress() const
+    {
+        if (!_remoteAddress && _isConnected)
+        {
+            const_cast<Socket *>(this)->initRemoteAddress();
+        }
+        return _remoteAddress;
+    }
+
+    Address::ptr Socket::getLocalAddress() const
+    {
+        if (!_localAddress && isValid())
+        {
+            const_cast<Socket *>(this)->initLocalAddress();
+        }
+        return _localAddress;
+    }
+
     std::ostream &Socket::dump(std::ostream &os) const
     {
         os << "[Socket sock=" << _socket
@@ -532,7 +663,7 @@ namespace WebSrv
     }
     bool Socket::init(int socket)
     {
-        FdCtx::ptr ctx = FdManager::getFdManger()->get(socket);
+        FdCtx *ctx = FdManager::getFdManger()->get(socket);
         if (ctx && ctx->isSocket() && !ctx->isClose())
         {
             _socket = socket;
@@ -65,6 +65,90 @@ namespace WebSrv
         return rt;
     }
 
+    int SocketStream::writev(const iovec *buffers, size_t count)
+    {
+        if (!isConnected())
+        {
+            return -1;
+        }
+        return _socket->send((iovec *)buffers, count);
+    }
+
+    int64_t SocketStream::writevFixSize(iovec *buffers, size_t count)
+    {
+        int64_t total = 0;
+        while (count > 0)
+        {
+            int length = writev(buffers, count);
+            if (length <= 0)
+            {
+                return length;
+            }
+            total += length;
+            // 跳过已发送完的块，调整部分发送的块
+            size_t left = length;
+            while (count > 0 && left >= buffers->iov_len)
+            {
+                left -= buffers->iov_len;
+                ++buffers;
+                --count;
+            }
+            if (count > 0)
+            {
+                buffers->iov_base = (char *)buffers->iov_base + left;
+                buffers->iov_len -= left;
+            }
+        }
+        return total;
+    }
+
+    int64_t SocketStream::sendFile(int fd, off_t offset, size_t length)
+    {
+        if (!isConnected())
+        {
+            return -1;
+        }
+        size_t left = length;
+        while (left > 0)
+        {
+            ssize_t rt = _socket->sendFile(fd, &offset, left);
+            if (rt <= 0)
+            {
+                return rt;
+            }
+            left -= rt;
+        }
+        return length;
+    }
+
+    int64_t SocketStream::spliceFrom(int fd, size_t length)
+    {
+        if (!isConnected())
+        {
+            return -1;
+        }
+        size_t left = length;
+        while (left > 0)
+        {
+            ssize_t rt = _socket->spliceFrom(fd, nullptr, left);
+            if (rt <= 0)
+            {
+                return rt;
+            }
+            left -= rt;
+        }
+        return length;
+    }
+
+    int64_t SocketStream::spliceTo(int fd, size_t length)
+    {
+        if (!isConnected())
+        {
+            return -1;
+        }
+        return _socket->spliceTo(fd, length);
+    }
+
     void SocketStream::close()
     {
         if (_socket)
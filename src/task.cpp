@@ -0,0 +1,158 @@
+#include "task.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "configurator.h"
+namespace WebSrv
+{
+    static ConfigVar<uint32_t>::ptr g_taskCacheMaxSize =
+        Configurator::lookup<uint32_t>("scheduler.task_cache_size", 1024, "scheduler task cache max size per thread");
+
+    static uint32_t s_taskCacheMaxSize = 0;
+
+    struct _TaskCacheInit
+    {
+        _TaskCacheInit()
+        {
+            s_taskCacheMaxSize = g_taskCacheMaxSize->getValue();
+            g_taskCacheMaxSize->addChangeValueListener([](const uint32_t &oldValue, const uint32_t &newValue)
+                                                       { s_taskCacheMaxSize = newValue; });
+        }
+    };
+
+    static _TaskCacheInit s_taskCacheInit;
+
+    /**
+     * @brief 线程任务缓存，本线程释放的任务放入local，其他线程释放的任务无锁压入remote，
+     * local为空时一次取走remote。线程退出时缓存不释放而是交给下一个线程继续使用，
+     * 保证其他线程归还任务时缓存一定有效。local和remote都受scheduler.task_cache_size限制
+     *
+     */
+    struct TaskCache
+    {
+        Task *local = nullptr;
+        size_t count = 0;
+        std::atomic<Task *> remote = nullptr;
+        /// @brief remote中的任务数量(压入前先计数，不小于实际数量)
+        std::atomic<size_t> remoteCount = 0;
+    };
+
+    static std::mutex s_orphanMutex;
+    /// @brief 已退出线程留下的缓存
+    static std::vector<TaskCache *> s_orphanCaches;
+
+    /// @brief 线程退出时缓存已交出(之后析构的协程仍可能释放任务)
+    static thread_local bool t_taskCacheDestroyed = false;
+
+    /**
+     * @brief 线程退出时把缓存交出
+     *
+     */
+    struct TaskCacheHolder
+    {
+        TaskCacheHolder()
+        {
+            std::lock_guard<std::mutex> lock(s_orphanMutex);
+            if (!s_orphanCaches.empty())
+            {
+                cache = s_orphanCaches.back();
+                s_orphanCaches.pop_back();
+            }
+            else
+            {
+                cache = new TaskCache;
+            }
+        }
+
+        ~TaskCacheHolder()
+        {
+            // 缓存中的任务留给下一个使用该缓存的线程
+            t_taskCacheDestroyed = true;
+            std::lock_guard<std::mutex> lock(s_orphanMutex);
+            s_orphanCaches.emplace_back(cache);
+        }
+
+        TaskCache *cache;
+    };
+
+    static TaskCache *getTaskCache()
+    {
+        if (t_taskCacheDestroyed)
+        {
+            return nullptr;
+        }
+        static thread_local TaskCacheHolder holder;
+        return holder.cache;
+    }
+
+    Task *Task::Create()
+    {
+        TaskCache *cache = getTaskCache();
+        if (!cache)
+        {
+            // 缓存已交出，不归属任何缓存，释放时直接delete
+            return new Task;
+        }
+        if (!cache->local)
+        {
+            Task *remote = cache->remote.exchange(nullptr, std::memory_order_acquire);
+            size_t n = 0;
+            for (Task *t = remote; t; t = t->next)
+            {
+                ++n;
+            }
+            cache->remoteCount.fetch_sub(n, std::memory_order_relaxed);
+            cache->count += n;
+            cache->local = remote;
+        }
+        Task *task = cache->local;
+        if (task)
+        {
+            cache->local = task->next;
+            --cache->count;
+            task->next = nullptr;
+            return task;
+        }
+        task = new Task;
+        task->owner = cache;
+        return task;
+    }
+
+    void Task::Destroy(Task *task)
+    {
+        task->fiber.reset();
+        task->cb.reset();
+        task->threadid = std::thread::id();
+        TaskCache *owner = task->owner;
+        TaskCache *cache = getTaskCache();
+        if (!owner || !cache)
+        {
+            delete task;
+            return;
+        }
+        if (owner == cache)
+        {
+            if (owner->count >= s_taskCacheMaxSize)
+            {
+                delete task;
+                return;
+            }
+            task->next = owner->local;
+            owner->local = task;
+            ++owner->count;
+            return;
+        }
+        // 归还到分配线程，超过上限直接释放
+        if (owner->remoteCount.fetch_add(1, std::memory_order_relaxed) >= s_taskCacheMaxSize)
+        {
+            owner->remoteCount.fetch_sub(1, std::memory_order_relaxed);
+            delete task;
+            return;
+        }
+        Task *head = owner->remote.load(std::memory_order_relaxed);
+        do
+        {
+            task->next = head;
+        } while (!owner->remote.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+    }
+} // namespace WebSrv
@@ -2,19 +2,35 @@
 #include "configurator.h"
 #include "log.h"
 #include "socket.h"
+#include "fdmanager.h"
+#include "hook.h"
+#include "util.h"
+#include <cmath>
+#include <unistd.h>
 namespace WebSrv
 {
     static Logger::ptr g_logger = SRV_LOGGER_NAME("system");
 
     static ConfigVar<uint64_t>::ptr g_tcpServerReadTimeout=Configurator::lookup("tcp_server.read_timeout",(uint64_t)(60*1000*2),"tcp server read timeout");
     static ConfigVar<uint64_t>::ptr g_tcpServerSendTimeout=Configurator::lookup("tcp_server.send_timeout",(uint64_t)(60*1000*2),"tcp server send timeout");
+    static ConfigVar<bool>::ptr g_tcpServerSharedStack=Configurator::lookup("tcp_server.shared_stack",false,"tcp server handle client on shared stack fiber");
+    static ConfigVar<bool>::ptr g_tcpServerReusePort=Configurator::lookup("tcp_server.reuse_port",false,"tcp server listen with one SO_REUSEPORT socket per io worker thread");
+    static ConfigVar<uint32_t>::ptr g_tcpServerMaxConnections=Configurator::lookup("tcp_server.max_connections",(uint32_t)0,"tcp server max concurrent connections, 0 for unlimited");
+    static ConfigVar<uint32_t>::ptr g_tcpServerMaxAcceptRate=Configurator::lookup("tcp_server.max_accept_rate",(uint32_t)0,"tcp server max accepted connections per second, 0 for unlimited");
+    static ConfigVar<uint32_t>::ptr g_tcpServerAcceptBatch=Configurator::lookup("tcp_server.accept_batch",(uint32_t)64,"tcp server max connections accepted per readiness");
+    static ConfigVar<uint32_t>::ptr g_tcpServerAcceptBackoff=Configurator::lookup("tcp_server.accept_backoff",(uint32_t)100,"tcp server accept retry delay(ms) when out of file descriptors or memory");
 
     TcpServer::TcpServer(IOManager *worker, IOManager *ioWorker,
                          IOManager *acceptWorker)
         : _worker(worker), _ioWorker(ioWorker), _acceptWorker(acceptWorker),
           _recvTimeout(g_tcpServerReadTimeout->getValue()),
           _sendTimeout(g_tcpServerSendTimeout->getValue()),
-          _stop(true),_name("TcpServer/1.0.0")
+          _stop(true),_sharedStack(g_tcpServerSharedStack->getValue()),
+          _reusePort(g_tcpServerReusePort->getValue()),
+          _maxConnections(g_tcpServerMaxConnections->getValue()),
+          _maxAcceptRate(g_tcpServerMaxAcceptRate->getValue()),
+          _acceptBatch(std::max<uint32_t>(g_tcpServerAcceptBatch->getValue(), 1)),
+          _name("TcpServer/1.0.0")
     {
     }
 
@@ -36,27 +52,47 @@ namespace WebSrv
 
     bool TcpServer::listen(const std::vector<Address::ptr> &addrs, std::vector<Address::ptr> &fails)
     {
+        // 多监听模式每个线程一个监听socket，否则一个地址一个
+        std::vector<std::thread::id> threads;
+        if (_reusePort)
+        {
+            threads = _ioWorker->getPoolThreadIds();
+        }
+        if (threads.empty())
+        {
+            threads.emplace_back();
+        }
         for (auto &addr : addrs)
         {
-            Socket::ptr sock = Socket::CreateTCP(addr);
-            if (!sock->bind(addr))
+            Address::ptr bindAddr = addr;
+            for (auto &threadid : threads)
             {
-               SRV_LOG_ERROR(g_logger) << "bind fail "
-                                       << "addr=[" << addr->toString() << "]";
-                fails.emplace_back(addr);
-                continue;
+                Socket::ptr sock = Socket::CreateTCP(addr);
+                if (!sock->bind(bindAddr, _reusePort))
+                {
+                    SRV_LOG_ERROR(g_logger) << "bind fail "
+                                            << "addr=[" << addr->toString() << "]";
+                    fails.emplace_back(addr);
+                    break;
+                }
+                if (!sock->listen())
+                {
+                    SRV_LOG_ERROR(g_logger) << "listen fail " << "addr=[" << sock->toString() << "]";
+                    fails.emplace_back(addr);
+                    break;
+                }
+                // 监听socket可能在未hook的线程创建，交给FdManager管理，accept才会挂起协程而不是阻塞线程
+                FdManager::getFdManger()->get(*sock, true);
+                // 端口为0时之后的socket绑定到第一个分配到的端口
+                bindAddr = sock->getLocalAddress();
+                _socks.emplace_back(sock);
+                _acceptThreads.emplace_back(threadid);
             }
-            if (!sock->listen())
-            {
-               SRV_LOG_ERROR(g_logger) << "listen fail " << "addr=[" << sock->toString() << "]";
-                fails.emplace_back(addr);
-                continue;
-            }
-            _socks.emplace_back(sock);
         }
         if (!fails.empty())
         {
             _socks.clear();
+            _acceptThreads.clear();
             return false;
         }
 
@@ -76,21 +112,32 @@ namespace WebSrv
             return;
         }
         _stop = false;
-        for (auto &sock : _socks)
         {
-            _acceptWorker->schedule(std::bind(&TcpServer::startAccept,shared_from_this(),sock));
+            std::lock_guard<std::mutex> lock(_admissionMutex);
+            _acceptTokens = _maxAcceptRate;
+            _acceptRefillTime = getMonotonicMilliseconds();
+        }
+        // 多监听模式的接收循环在ioWorker的各线程，连接直接在接收的线程处理
+        IOManager *acceptWorker = _reusePort ? _ioWorker : _acceptWorker;
+        for (size_t i = 0; i < _socks.size(); ++i)
+        {
+            acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), _socks[i]), _acceptThreads[i]);
         }
     }
 
     void TcpServer::stop()
     {
-        _stop=false;
-        _acceptWorker->schedule([this](){
+        _stop = true;
+        // 唤醒等待名额的接收循环，让其退出
+        release(0);
+        IOManager *acceptWorker = _reusePort ? _ioWorker : _acceptWorker;
+        acceptWorker->schedule([this](){
             for(auto& sock:_socks){
                 IOManager::getThis()->cancelAll(*sock);
                 sock->close();
             }
             _socks.clear();
+            _acceptThreads.clear();
         });
     }
 
@@ -101,6 +148,9 @@ namespace WebSrv
            << " name=" << _name 
            << " worker=" << (_worker ? _worker->getName() : "")
            << " accept=" << (_acceptWorker ? _acceptWorker->getName() : "")
+           << " reuse_port=" << _reusePort
+           << " max_connections=" << _maxConnections
+           << " max_accept_rate=" << _maxAcceptRate
            << " recv_timeout=" << _recvTimeout << "]" << std::endl;
         std::string pfx = prefix.empty() ? "    " : prefix;
         for (auto &i : _socks)
@@ -115,21 +165,149 @@ namespace WebSrv
         SRV_LOG_INFO(g_logger)<<"handleClient: "<<client->toString();
     }
 
+    void TcpServer::serveClient(Socket::ptr client)
+    {
+        handleClient(client);
+        release();
+    }
+
     void TcpServer::startAccept(Socket::ptr sock)
-    {   
+    {
+        // 多监听模式的接收循环固定在当前线程，挂起后被唤醒也回到这里
+        if (_reusePort)
+        {
+            Fiber::getThis()->setBoundThread(std::this_thread::get_id());
+        }
+        std::vector<Socket::ptr> clients;
         while (!_stop)
         {
-            Socket::ptr client =  sock->accept();
-            if (client)
+            size_t allowed = admit(_acceptBatch);
+            if (!allowed)
+            {
+                continue;
+            }
+            clients.clear();
+            sock->acceptBatch(clients, allowed);
+            int error = errno;
+            // 没用上的名额归还
+            release(allowed - clients.size());
+            if (clients.empty())
+            {
+                if (_stop)
+                {
+                    break;
+                }
+                SRV_LOG_ERROR(g_logger) << "accept errno=" << error << " errno str=" << strerror(error);
+                // 句柄或内存耗尽时连接留在积压队列中，稍后再试，避免空转
+                if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM)
+                {
+                    usleep(g_tcpServerAcceptBackoff->getValue() * 1000);
+                }
+                continue;
+            }
+            for (auto &client : clients)
             {
                 client->setRecvTimeout(_recvTimeout);
-                _ioWorker->schedule(std::bind(&TcpServer::handleClient,shared_from_this(),client));
+                // 多监听模式在接收的线程处理；连接亲和模式下把连接轮流分配到各工作线程，之后该连接的事件都在这个线程处理
+                std::thread::id threadid = _reusePort ? std::this_thread::get_id() : _ioWorker->nextAffinityThread();
+                if (_sharedStack)
+                {
+                    _ioWorker->schedule(Fiber::create(std::bind(&TcpServer::serveClient, shared_from_this(), client), 0, false, true), threadid);
+                }
+                else
+                {
+                    _ioWorker->schedule(std::bind(&TcpServer::serveClient, shared_from_this(), client), threadid);
+                }
+            }
+        }
+    }
+
+    size_t TcpServer::admit(size_t want)
+    {
+        while (!_stop)
+        {
+            // 预留名额，多个接收循环同时接收时也不会超过上限
+            size_t count = want;
+            if (_maxConnections)
+            {
+                uint64_t current = _connections;
+                if (current >= _maxConnections)
+                {
+                    std::unique_lock<std::mutex> lock(_admissionMutex);
+                    // 由当前线程恢复，唤醒早于挂起时当前线程也要先挂起才能取到这个协程
+                    _acceptWaiters.push_back({Scheduler::getThis(), Fiber::getThis(), std::this_thread::get_id()});
+                    _hasAcceptWaiters = true;
+                    // 加入等待后再检查一次，避免错过加入前结束的连接的唤醒
+                    if (_stop || _connections < _maxConnections)
+                    {
+                        _acceptWaiters.pop_back();
+                        _hasAcceptWaiters = !_acceptWaiters.empty();
+                        continue;
+                    }
+                    lock.unlock();
+                    Fiber::yieldToSuspend();
+                    continue;
+                }
+                count = std::min<uint64_t>(want, _maxConnections - current);
+                if (!_connections.compare_exchange_weak(current, current + count))
+                {
+                    continue;
+                }
             }
             else
             {
-               SRV_LOG_ERROR(g_logger) << "accept errno=" << errno << " errno str=" << strerror(errno);
+                _connections += count;
+            }
+            if (!_maxAcceptRate)
+            {
+                return count;
+            }
+            uint64_t waitMs = 0;
+            size_t tokens = takeAcceptTokens(count, waitMs);
+            release(count - tokens);
+            if (tokens)
+            {
+                return tokens;
             }
+            usleep(waitMs * 1000);
+        }
+        return 0;
+    }
+
+    void TcpServer::release(size_t count)
+    {
+        _connections -= count;
+        if (!_hasAcceptWaiters)
+        {
+            return;
+        }
+        std::vector<AcceptWaiter> waiters;
+        {
+            std::lock_guard<std::mutex> lock(_admissionMutex);
+            waiters.swap(_acceptWaiters);
+            _hasAcceptWaiters = false;
+        }
+        for (auto &waiter : waiters)
+        {
+            waiter.scheduler->schedule(&waiter.fiber, waiter.threadid);
+        }
+    }
+
+    size_t TcpServer::takeAcceptTokens(size_t want, uint64_t &waitMs)
+    {
+        std::lock_guard<std::mutex> lock(_admissionMutex);
+        uint64_t now = getMonotonicMilliseconds();
+        // 最多积累1秒的令牌
+        _acceptTokens = std::min<double>(_maxAcceptRate, _acceptTokens + (now - _acceptRefillTime) * _maxAcceptRate / 1000.0);
+        _acceptRefillTime = now;
+        size_t tokens = std::min<size_t>(want, (size_t)_acceptTokens);
+        if (!tokens)
+        {
+            waitMs = std::max<uint64_t>(std::ceil((1 - _acceptTokens) * 1000 / _maxAcceptRate), 1);
+            return 0;
         }
+        _acceptTokens -= tokens;
+        return tokens;
     }
 
 } // namespace WebServer
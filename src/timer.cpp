@@ -1,9 +1,366 @@
 #include "timer.h"
+#include <algorithm>
 #include "util.h"
+#include "configurator.h"
 namespace WebSrv
 {
+    static ConfigVar<bool>::ptr g_timerWheel =
+        Configurator::lookup<bool>("timer.wheel", true, "use hierarchical timing wheel for timers, false uses ordered set");
+
+    /**
+     * @brief 分层时间轮，精度1ms：第0层256个槽每槽1ms，第1~3层各64个槽，每个槽覆盖下一层一整圈，
+     * 定时器按距当前时间的远近放入对应层，转到该槽时下移到更低层，超出范围(约18.6小时)的放在最高层
+     * 槽位是侵入式双向链表，添加、取消都是O(1)；非空槽位记录在位图中，用于跳过空槽和计算下一个执行时间
+     *
+     */
+    struct TimerManager::TimerWheel
+    {
+        static constexpr int ROOT_BITS = 8;
+        static constexpr int LEVEL_BITS = 6;
+        static constexpr int LEVELS = 3;
+        static constexpr int ROOT_SIZE = 1 << ROOT_BITS;
+        static constexpr int LEVEL_SIZE = 1 << LEVEL_BITS;
+        static constexpr int SLOTS = ROOT_SIZE + LEVELS * LEVEL_SIZE;
+        /// @brief 已到期等待取出的定时器链表
+        static constexpr int DUE_SLOT = SLOTS;
+        static constexpr uint64_t MAX_DELTA = 1ull << (ROOT_BITS + LEVELS * LEVEL_BITS);
+
+        explicit TimerWheel(uint64_t now) : current(now) {}
+
+        /**
+         * @brief 第level层(1~LEVELS)中时间tick所在的槽位
+         *
+         */
+        static int levelSlot(int level, uint64_t tick)
+        {
+            int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+            return ROOT_SIZE + (level - 1) * LEVEL_SIZE + (int)((tick >> shift) & (LEVEL_SIZE - 1));
+        }
+
+        /**
+         * @brief 槽位区间[from, to)中第一个非空槽位，没有返回to
+         *
+         */
+        int findSlot(int from, int to) const
+        {
+            while (from < to)
+            {
+                uint64_t word = bits[from / 64] >> (from % 64);
+                if (word)
+                {
+                    int slot = from + __builtin_ctzll(word);
+                    return slot < to ? slot : to;
+                }
+                from = (from / 64 + 1) * 64;
+            }
+            return to;
+        }
+
+        void link(Timer *timer, int slot)
+        {
+            timer->_slot = slot;
+            if (slot == DUE_SLOT)
+            {
+                // 到期链表按到期顺序追加到末尾
+                timer->_prevNode = dueTail;
+                timer->_nextNode = nullptr;
+                if (dueTail)
+                {
+                    dueTail->_nextNode = timer;
+                }
+                else
+                {
+                    heads[slot] = timer;
+                }
+                dueTail = timer;
+                return;
+            }
+            timer->_prevNode = nullptr;
+            timer->_nextNode = heads[slot];
+            if (heads[slot])
+            {
+                heads[slot]->_prevNode = timer;
+            }
+            heads[slot] = timer;
+            bits[slot / 64] |= 1ull << (slot % 64);
+            ++count;
+        }
+
+        void unlink(Timer *timer)
+        {
+            int slot = timer->_slot;
+            if (timer->_prevNode)
+            {
+                timer->_prevNode->_nextNode = timer->_nextNode;
+            }
+            else
+            {
+                heads[slot] = timer->_nextNode;
+            }
+            if (timer->_nextNode)
+            {
+                timer->_nextNode->_prevNode = timer->_prevNode;
+            }
+            if (slot == DUE_SLOT)
+            {
+                if (dueTail == timer)
+                {
+                    dueTail = timer->_prevNode;
+                }
+            }
+            else
+            {
+                --count;
+                if (!heads[slot])
+                {
+                    bits[slot / 64] &= ~(1ull << (slot % 64));
+                }
+            }
+            timer->_prevNode = timer->_nextNode = nullptr;
+            timer->_slot = -1;
+        }
+
+        /**
+         * @brief 按执行时间放入对应层的槽位，已过期的放在当前槽位
+         *
+         */
+        void insert(Timer *timer)
+        {
+            uint64_t next = timer->_next < current ? current : timer->_next;
+            uint64_t delta = next - current;
+            if (delta < ROOT_SIZE)
+            {
+                link(timer, next & (ROOT_SIZE - 1));
+                return;
+            }
+            for (int level = 1; level <= LEVELS; ++level)
+            {
+                if (delta < 1ull << (ROOT_BITS + level * LEVEL_BITS))
+                {
+                    link(timer, levelSlot(level, next));
+                    return;
+                }
+            }
+            // 超出范围，先放在最高层最远的槽位，下移时按实际时间重新放置
+            link(timer, levelSlot(LEVELS, current + MAX_DELTA - 1));
+        }
+
+        /**
+         * @brief 转到now，到期的定时器移到到期链表
+         *
+         */
+        void advance(uint64_t now)
+        {
+            while (current <= now)
+            {
+                if (count == 0)
+                {
+                    current = now + 1;
+                    break;
+                }
+                int idx = current & (ROOT_SIZE - 1);
+                if (idx == 0)
+                {
+                    // 第0层转完一圈，上层当前槽位下移，该层下标不为0时更高层还没转到下一个槽
+                    for (int level = 1; level <= LEVELS; ++level)
+                    {
+                        int slot = levelSlot(level, current);
+                        while (Timer *timer = heads[slot])
+                        {
+                            unlink(timer);
+                            if (!reap(timer))
+                            {
+                                insert(timer);
+                            }
+                        }
+                        if (slot != ROOT_SIZE + (level - 1) * LEVEL_SIZE)
+                        {
+                            break;
+                        }
+                    }
+                }
+                if (heads[idx])
+                {
+                    while (Timer *timer = heads[idx])
+                    {
+                        unlink(timer);
+                        if (!reap(timer))
+                        {
+                            link(timer, DUE_SLOT);
+                        }
+                    }
+                    ++current;
+                    continue;
+                }
+                // 跳过空槽，直到本圈下一个非空槽位、本圈结束或超过now
+                uint64_t step = findSlot(idx + 1, ROOT_SIZE) - idx;
+                current += std::min(step, now - current + 1);
+            }
+        }
+
+        /**
+         * @brief 释放已移出槽位的惰性取消的定时器
+         *
+         * @return true 已取消并释放，之后不能再访问
+         * @return false 未取消
+         */
+        bool reap(Timer *timer)
+        {
+            if (!timer->isLazyCancelled())
+            {
+                return false;
+            }
+            dead.fetch_sub(1, std::memory_order_relaxed);
+            timer->_hold.reset();
+            return true;
+        }
+
+        /**
+         * @brief 惰性取消的定时器超过一半时全部移除，均摊到每次取消是O(1)
+         *
+         */
+        void collect()
+        {
+            int64_t n = dead.load(std::memory_order_relaxed);
+            if (n <= 0 || (uint64_t)n * 2 < count)
+            {
+                return;
+            }
+            for (int slot = findSlot(0, SLOTS); slot < SLOTS; slot = findSlot(slot + 1, SLOTS))
+            {
+                Timer *timer = heads[slot];
+                while (timer)
+                {
+                    Timer *next = timer->_nextNode;
+                    if (timer->isLazyCancelled())
+                    {
+                        unlink(timer);
+                        reap(timer);
+                    }
+                    timer = next;
+                }
+            }
+        }
+
+        /**
+         * @brief 下一个执行时间，到期链表非空为0，没有定时器为~0
+         * 第0层的定时器是准确时间，上层取槽位下移的时间(不晚于其中的定时器)
+         *
+         */
+        uint64_t nextExpire() const
+        {
+            if (heads[DUE_SLOT])
+            {
+                return 0;
+            }
+            if (count == 0)
+            {
+                return ~0ull;
+            }
+            uint64_t result = ~0ull;
+            int idx = current & (ROOT_SIZE - 1);
+            if (idx == 0)
+            {
+                // 正好在一圈的开始，上层当前槽位还没有下移
+                for (int level = 1; level <= LEVELS; ++level)
+                {
+                    int slot = levelSlot(level, current);
+                    if (heads[slot])
+                    {
+                        return current;
+                    }
+                    if (slot != ROOT_SIZE + (level - 1) * LEVEL_SIZE)
+                    {
+                        break;
+                    }
+                }
+            }
+            int slot = findSlot(idx, ROOT_SIZE);
+            if (slot < ROOT_SIZE)
+            {
+                result = current + (slot - idx);
+            }
+            else if ((slot = findSlot(0, idx)) < idx)
+            {
+                result = current + (ROOT_SIZE - idx + slot);
+            }
+            for (int level = 1; level <= LEVELS; ++level)
+            {
+                int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+                int base = ROOT_SIZE + (level - 1) * LEVEL_SIZE;
+                int cur = (current >> shift) & (LEVEL_SIZE - 1);
+                // 当前槽位已下移过，其中的定时器在下一圈
+                int found = findSlot(base + cur + 1, base + LEVEL_SIZE);
+                int offset;
+                if (found < base + LEVEL_SIZE)
+                {
+                    offset = found - base - cur;
+                }
+                else if ((found = findSlot(base, base + cur + 1)) <= base + cur)
+                {
+                    offset = found - base - cur + LEVEL_SIZE;
+                }
+                else
+                {
+                    continue;
+                }
+                result = std::min(result, ((current >> shift) + offset) << shift);
+            }
+            return result;
+        }
+
+        std::mutex mutex;
+        /// @brief 下一个要处理的时间(ms)
+        uint64_t current;
+        /// @brief 各层槽位中的定时器数量(不包括到期链表，包括惰性取消还未移除的)
+        size_t count = 0;
+        /// @brief 惰性取消还未移除的定时器数量(取消时不加锁，可能短暂为负)
+        std::atomic<int64_t> dead = 0;
+        Timer *heads[SLOTS + 1] = {};
+        Timer *dueTail = nullptr;
+        /// @brief 非空槽位位图
+        uint64_t bits[SLOTS / 64] = {};
+    };
+
     bool Timer::cannel()
     {
+        if (!_recurring)
+        {
+            // 和到期处理竞争，先置位的一方拥有回调
+            if (_done.exchange(true))
+            {
+                return false;
+            }
+            _cb = nullptr;
+            if (_manager->_useWheel)
+            {
+                _manager->_wheels[_shard]->dead.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                _manager->_deadTimers.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+        if (_manager->_useWheel)
+        {
+            // 释放自身持有放在解锁之后
+            Timer::ptr hold;
+            TimerManager::TimerWheel &wheel = *_manager->_wheels[_shard];
+            std::lock_guard<std::mutex> lock(wheel.mutex);
+            if (!_cb)
+            {
+                return false;
+            }
+            _cb = nullptr;
+            if (_slot < 0)
+            {
+                return false;
+            }
+            wheel.unlink(this);
+            hold.swap(_hold);
+            return true;
+        }
         WriteMutex lock(_manager->_rWMutex);
         //std::unique_lock<std::mutex> lock(_manager->_mutex);
         // 取出后会移除回调函数
@@ -22,9 +379,22 @@ namespace WebSrv
 
     bool Timer::refresh()
     {
+        if (_manager->_useWheel)
+        {
+            TimerManager::TimerWheel &wheel = *_manager->_wheels[_shard];
+            std::lock_guard<std::mutex> lock(wheel.mutex);
+            if (!isPending() || _slot < 0)
+            {
+                return false;
+            }
+            wheel.unlink(this);
+            _next = coalesce(getMonotonicMilliseconds() + _ms);
+            wheel.insert(this);
+            return true;
+        }
         WriteMutex lock(_manager->_rWMutex);
         //std::unique_lock<std::mutex> lock(_manager->_mutex);
-        if (!_cb)
+        if (!isPending())
         {
             return false;
         }
@@ -34,7 +404,7 @@ namespace WebSrv
             return false;
         }
         _manager->_timerSet.erase(it);
-        _next = getCurrentMilliseconds() + _ms;
+        _next = coalesce(getMonotonicMilliseconds() + _ms);
         _manager->_timerSet.emplace(shared_from_this());
         return true;
     }
@@ -46,9 +416,28 @@ namespace WebSrv
         {
             return true;
         }
+        if (_manager->_useWheel)
+        {
+            uint64_t next;
+            {
+                TimerManager::TimerWheel &wheel = *_manager->_wheels[_shard];
+                std::lock_guard<std::mutex> lock(wheel.mutex);
+                if (!isPending() || _slot < 0)
+                {
+                    return false;
+                }
+                wheel.unlink(this);
+                _next = coalesce(fromNow ? getMonotonicMilliseconds() + ms : _next - _ms + ms);
+                _ms = ms;
+                wheel.insert(this);
+                next = _next;
+            }
+            _manager->wheelCheckFront(next);
+            return true;
+        }
         WriteMutex lock(_manager->_rWMutex);
         //std::unique_lock<std::mutex> lock(_manager->_mutex);
-        if (!_cb)
+        if (!isPending())
         {
             return false;
         }
@@ -61,12 +450,12 @@ namespace WebSrv
         bool maybeFront = false;
         if (fromNow)
         {
-            _next = getCurrentMilliseconds() + ms;
+            _next = coalesce(getMonotonicMilliseconds() + ms);
         }
         else
         {
             // 在原来的时间戳上更改
-            _next = _next - _ms + ms;
+            _next = coalesce(_next - _ms + ms);
             // 有可能在顶部
             maybeFront = true;
         }
@@ -92,13 +481,15 @@ namespace WebSrv
         return true;
     }
 
-    Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
-        : _ms(ms), _cb(cb), _recurring(recurring), _manager(manager), _next(getCurrentMilliseconds() + _ms)
+    Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager, uint64_t slack)
+        : _ms(ms), _cb(cb), _recurring(recurring), _manager(manager),
+          _slack(slack > 1 ? 1ull << (63 - __builtin_clzll(slack)) : 0)
     {
+        _next = coalesce(getMonotonicMilliseconds() + _ms);
     }
 
     Timer::Timer(uint64_t next)
-        : _ms(0),_next(getCurrentMilliseconds())
+        : _ms(0),_next(getMonotonicMilliseconds())
     {
     }
 
@@ -129,11 +520,80 @@ namespace WebSrv
 
     
 
-    Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+    TimerManager::TimerManager(size_t shards)
+        : _useWheel(g_timerWheel->getValue())
+    {
+        if (_useWheel)
+        {
+            uint64_t now = getMonotonicMilliseconds();
+            for (size_t i = 0; i < (shards ? shards : 1); ++i)
+            {
+                _wheels.emplace_back(new TimerWheel(now));
+            }
+        }
+    }
+
+    TimerManager::~TimerManager()
+    {
+        // 断开时间轮中定时器对自身的持有
+        for (auto &wheel : _wheels)
+        {
+            for (int slot = 0; slot <= TimerWheel::SLOTS; ++slot)
+            {
+                while (Timer *timer = wheel->heads[slot])
+                {
+                    wheel->unlink(timer);
+                    timer->_cb = nullptr;
+                    Timer::ptr hold;
+                    hold.swap(timer->_hold);
+                }
+            }
+        }
+    }
+
+    void TimerManager::wheelInsert(const Timer::ptr &timer)
+    {
+        size_t shard = getTimerShard();
+        if (shard >= _wheels.size())
+        {
+            shard = _wheels.size() - 1;
+        }
+        timer->_shard = shard;
+        TimerWheel &wheel = *_wheels[shard];
+        uint64_t next;
+        {
+            std::lock_guard<std::mutex> lock(wheel.mutex);
+            timer->_hold = timer;
+            wheel.insert(timer.get());
+            next = timer->_next;
+        }
+        wheelCheckFront(next);
+    }
+
+    void TimerManager::wheelCheckFront(uint64_t next)
     {
-        Timer::ptr timer(new Timer(ms, cb, recurring, this));
+        uint64_t earliest = _earliest;
+        while (next < earliest)
+        {
+            if (_earliest.compare_exchange_weak(earliest, next))
+            {
+                onTimerInsertedAtFront();
+                return;
+            }
+        }
+    }
+
+    Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring, uint64_t slack)
+    {
+        Timer::ptr timer(new Timer(ms, cb, recurring, this, slack));
+        if (_useWheel)
+        {
+            wheelInsert(timer);
+            return timer;
+        }
         WriteMutex lock(_rWMutex);
         //std::unique_lock<std::mutex> lock(_mutex);
+        sweepTimerSet();
         // 不能直接比较头部，因为头部可能是失效指针
         auto it = _timerSet.insert(timer).first;
         bool atFront = (it == _timerSet.begin()) && !_tickled;
@@ -160,14 +620,68 @@ namespace WebSrv
         }
     }
 
-    Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::function<bool()> cond, bool recurring)
+    Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::function<bool()> cond, bool recurring, uint64_t slack)
     {
-        return addTimer(ms,[cb, cond]() { _onTimer(cond, cb); },recurring);
+        return addTimer(ms,[cb, cond]() { _onTimer(cond, cb); },recurring,slack);
+    }
+
+    void TimerManager::sweepTimerSet()
+    {
+        int64_t n = _deadTimers.load(std::memory_order_relaxed);
+        if (n <= 0 || (uint64_t)n * 2 < _timerSet.size())
+        {
+            return;
+        }
+        for (auto it = _timerSet.begin(); it != _timerSet.end();)
+        {
+            if ((*it)->isLazyCancelled())
+            {
+                it = _timerSet.erase(it);
+                _deadTimers.fetch_sub(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                ++it;
+            }
+        }
     }
 
     void TimerManager::listExpiredCallback(std::vector<std::function<void()>> &cbs)
     {
-        uint64_t now = getCurrentMilliseconds();
+        uint64_t now = getMonotonicMilliseconds();
+        if (_useWheel)
+        {
+            for (auto &wheel : _wheels)
+            {
+                std::lock_guard<std::mutex> lock(wheel->mutex);
+                wheel->advance(now);
+                while (Timer *timer = wheel->heads[TimerWheel::DUE_SLOT])
+                {
+                    wheel->unlink(timer);
+                    // 到期后被取消的，由取消方拥有回调
+                    if (!timer->_recurring && timer->_done.exchange(true))
+                    {
+                        wheel->reap(timer);
+                        continue;
+                    }
+                    if (timer->_recurring && !_closeRecurring)
+                    {
+                        cbs.emplace_back(timer->_cb);
+                        timer->_next = timer->coalesce(now + timer->_ms);
+                        wheel->insert(timer);
+                    }
+                    else
+                    {
+                        cbs.emplace_back(std::move(timer->_cb));
+                        timer->_cb = nullptr;
+                        // 可能释放定时器，之后不能再访问
+                        timer->_hold.reset();
+                    }
+                }
+                wheel->collect();
+            }
+            return;
+        }
         std::vector<Timer::ptr> res;
         ReadMutex readlock(_rWMutex);
         if (_timerSet.empty())
@@ -198,10 +712,16 @@ namespace WebSrv
         cbs.reserve(res.size());
         for (auto &timer : res)
         {
+            if (!timer->_recurring && timer->_done.exchange(true))
+            {
+                // 已惰性取消
+                _deadTimers.fetch_sub(1, std::memory_order_relaxed);
+                continue;
+            }
             cbs.emplace_back(timer->_cb);
             if (timer->_recurring&&!_closeRecurring)
             {
-                timer->_next = now + timer->_ms;
+                timer->_next = timer->coalesce(now + timer->_ms);
                 _timerSet.emplace(timer);
             }
             else
@@ -213,7 +733,32 @@ namespace WebSrv
 
     std::function<void()> TimerManager::getExpiredCallback()
     {
-        uint64_t now_ms = getCurrentMilliseconds();
+        uint64_t now_ms = getMonotonicMilliseconds();
+        if (_useWheel)
+        {
+            for (auto &wheel : _wheels)
+            {
+                Timer::ptr hold;
+                std::lock_guard<std::mutex> lock(wheel->mutex);
+                wheel->advance(now_ms);
+                Timer *timer = wheel->heads[TimerWheel::DUE_SLOT];
+                while (timer && !timer->_recurring && timer->_done.exchange(true))
+                {
+                    wheel->unlink(timer);
+                    wheel->reap(timer);
+                    timer = wheel->heads[TimerWheel::DUE_SLOT];
+                }
+                if (timer)
+                {
+                    wheel->unlink(timer);
+                    auto cb = std::move(timer->_cb);
+                    timer->_cb = nullptr;
+                    hold.swap(timer->_hold);
+                    return cb;
+                }
+            }
+            return nullptr;
+        }
         ReadMutex readlock(_rWMutex);
         if (_timerSet.empty())
         {
@@ -226,9 +771,23 @@ namespace WebSrv
         {
             return nullptr;
         }
+        while (!_timerSet.empty() && (*_timerSet.begin())->isLazyCancelled())
+        {
+            _timerSet.erase(_timerSet.begin());
+            _deadTimers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (_timerSet.empty())
+        {
+            return nullptr;
+        }
         if((*_timerSet.begin())->_next<now_ms){
             auto timer= *_timerSet.begin();
             _timerSet.erase(_timerSet.begin());
+            if (!timer->_recurring && timer->_done.exchange(true))
+            {
+                _deadTimers.fetch_sub(1, std::memory_order_relaxed);
+                return nullptr;
+            }
             auto cb=timer->_cb;
             timer->_cb=nullptr;
             return cb;
@@ -239,13 +798,54 @@ namespace WebSrv
 
     bool TimerManager::hasTimer()
     {
-        ReadMutex rLock(_rWMutex);
+        if (_useWheel)
+        {
+            for (auto &wheel : _wheels)
+            {
+                std::lock_guard<std::mutex> lock(wheel->mutex);
+                wheel->collect();
+                if (wheel->count || wheel->heads[TimerWheel::DUE_SLOT])
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        WriteMutex lock(_rWMutex);
         //std::lock_guard<std::mutex> lock(_mutex);
-        return !_timerSet.size();
+        sweepTimerSet();
+        return !_timerSet.empty();
     }
 
     uint64_t TimerManager::getNextTimer()
     {
+        if (_useWheel)
+        {
+            // 计算期间插入的定时器都会触发onTimerInsertedAtFront，不会错过
+            _earliest = ~0ull;
+            uint64_t next = ~0ull;
+            for (auto &wheel : _wheels)
+            {
+                std::lock_guard<std::mutex> lock(wheel->mutex);
+                wheel->collect();
+                next = std::min(next, wheel->nextExpire());
+            }
+            uint64_t earliest = _earliest;
+            while (next < earliest && !_earliest.compare_exchange_weak(earliest, next))
+                ;
+            if (next == ~0ull)
+            {
+                return ~0ull;
+            }
+            uint64_t now = getMonotonicMilliseconds();
+            return now >= next ? 0 : next - now;
+        }
+        if (_deadTimers > 0)
+        {
+            // 全部已取消时清理掉，否则没有定时器也不能停止
+            WriteMutex lock(_rWMutex);
+            sweepTimerSet();
+        }
         ReadMutex lock(_rWMutex);
         //std::lock_guard<std::mutex> lock(_mutex);
 
@@ -256,7 +856,7 @@ namespace WebSrv
         }
 
         const Timer::ptr &next = *_timerSet.begin();
-        uint64_t now = getCurrentMilliseconds();
+        uint64_t now = getMonotonicMilliseconds();
         if (now >= next->_next)
         {
             return 0;
@@ -6,8 +6,8 @@
 #include <unistd.h>
 #include <filesystem>
 #include <thread>
+#include <atomic>
 #include <ctime>
-#include <regex>
 namespace WebSrv
 {
     uint32_t getSystemTheadId()
@@ -58,6 +58,72 @@ namespace WebSrv
         return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
     }
 
+    static std::atomic<uint64_t> s_clockReads = 0;
+    /// @brief 当前线程的时钟缓存
+    static thread_local bool t_clockCache = false;
+    static thread_local uint64_t t_monotonicMs = 0;
+    static thread_local time_t t_wallTime = 0;
+    /// @brief 墙上时间下次跨秒时的单调时钟毫秒数
+    static thread_local uint64_t t_nextWallMs = 0;
+
+    static uint64_t readMonotonic()
+    {
+        s_clockReads.fetch_add(1, std::memory_order_relaxed);
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    }
+
+    static time_t readWallTime(long *nsec = nullptr)
+    {
+        s_clockReads.fetch_add(1, std::memory_order_relaxed);
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (nsec)
+        {
+            *nsec = ts.tv_nsec;
+        }
+        return ts.tv_sec;
+    }
+
+    uint64_t getMonotonicMilliseconds()
+    {
+        return t_clockCache ? t_monotonicMs : readMonotonic();
+    }
+
+    time_t getCachedTime()
+    {
+        return t_clockCache ? t_wallTime : readWallTime();
+    }
+
+    void setClockCache(bool enable)
+    {
+        t_clockCache = enable;
+        t_nextWallMs = 0;
+        refreshClockCache();
+    }
+
+    void refreshClockCache()
+    {
+        if (!t_clockCache)
+        {
+            return;
+        }
+        t_monotonicMs = readMonotonic();
+        // 墙上时间只精确到秒，到下一秒之前不需要重新读取
+        if (t_monotonicMs >= t_nextWallMs)
+        {
+            long nsec;
+            t_wallTime = readWallTime(&nsec);
+            t_nextWallMs = t_monotonicMs + (1000 - nsec / 1000000);
+        }
+    }
+
+    uint64_t getClockReads()
+    {
+        return s_clockReads;
+    }
+
 
     void backtrace(std::vector<std::string> &bt, int size, int skip)
     {
@@ -278,36 +344,227 @@ namespace WebSrv
         }
     }
 
-    bool parseURL(const std::string &url, URL &res)
+    /**
+     * @brief url中不允许出现的字符(控制字符和空格)
+     *
+     */
+    static bool isInvalidURLChar(char c)
     {
-        std::regex urlRegex(R"((\w+):\/\/([^\/]+)([^?#]*)(\?([^#]*))?(#(.*))?)");
+        return (unsigned char)c <= 0x20 || c == 0x7f;
+    }
 
-        std::smatch matches;
-        if (std::regex_match(url, matches, urlRegex))
+    /**
+     * @brief 拆分path ["?" query] ["#" fragment]
+     *
+     */
+    static bool splitURLPath(std::string_view url, URL &res)
+    {
+        for (char c : url)
         {
-            res.protocol = matches[1].str();
-            res.host = matches[2].str();
-            res.path = matches[3].str();
-            res.query = matches[5].str();
-            res.fragment = matches[7].str();
-            return true;
+            if (isInvalidURLChar(c))
+            {
+                return false;
+            }
+        }
+        size_t fragment = url.find('#');
+        if (fragment != std::string_view::npos)
+        {
+            res.fragment.assign(url.substr(fragment + 1));
+            url = url.substr(0, fragment);
+        }
+        else
+        {
+            res.fragment.clear();
+        }
+        size_t query = url.find('?');
+        if (query != std::string_view::npos)
+        {
+            res.query.assign(url.substr(query + 1));
+            url = url.substr(0, query);
+        }
+        else
+        {
+            res.query.clear();
+        }
+        res.path.assign(url);
+        return true;
+    }
+
+    bool parseURL(std::string_view url, URL &res)
+    {
+        // scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." )
+        size_t i = 0;
+        while (i < url.size() && (isalnum((unsigned char)url[i]) || url[i] == '+' || url[i] == '-' || url[i] == '.'))
+        {
+            ++i;
+        }
+        if (i == 0 || !isalpha((unsigned char)url[0]) || url.compare(i, 3, "://") != 0)
+        {
+            return false;
+        }
+        std::string_view scheme = url.substr(0, i);
+        url = url.substr(i + 3);
+        // authority到'/'、'?'或'#'为止
+        size_t authority = url.find_first_of("/?#");
+        std::string_view host = url.substr(0, authority);
+        if (host.empty())
+        {
+            return false;
+        }
+        if (!splitURLPath(authority == std::string_view::npos ? std::string_view() : url.substr(authority), res))
+        {
+            return false;
+        }
+        res.protocol.assign(scheme);
+        res.host.assign(host);
+        return true;
+    }
+
+    bool parse2URL(std::string_view url, URL &res)
+    {
+        return splitURLPath(url, res);
+    }
+
+    static inline int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        c |= 0x20;
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
         }
-        return false;
+        return -1;
     }
 
-    bool parse2URL(const std::string &url, URL &res)
+    size_t percentDecode(char *data, size_t len, bool plusAsSpace)
     {
-        std::regex urlRegex("^([^?#]*)\\??([^#]*)#?(.*)$");
+        // 没有需要解码的字符时不写内存
+        size_t i = 0;
+        while (i < len && data[i] != '%' && !(plusAsSpace && data[i] == '+'))
+        {
+            ++i;
+        }
+        size_t out = i;
+        for (; i < len; ++i)
+        {
+            char c = data[i];
+            if (c == '%' && i + 2 < len)
+            {
+                int high = hexValue(data[i + 1]);
+                int low = high < 0 ? -1 : hexValue(data[i + 2]);
+                if (low >= 0)
+                {
+                    data[out++] = (char)(high << 4 | low);
+                    i += 2;
+                    continue;
+                }
+            }
+            data[out++] = plusAsSpace && c == '+' ? ' ' : c;
+        }
+        return out;
+    }
 
-        std::smatch matches;
-        if (std::regex_match(url, matches, urlRegex))
+    bool removeDotSegments(std::string &path)
+    {
+        if (path.find('.') == std::string::npos)
         {
-            res.path = matches[1].str();
-            res.query = matches[2].str();
-            res.fragment = matches[3].str();
             return true;
         }
-        return false;
+        // 输出位置不超过读取位置，原地写入
+        size_t root = path[0] == '/' ? 1 : 0;
+        size_t out = root;
+        size_t i = root;
+        while (i <= path.size())
+        {
+            size_t end = path.find('/', i);
+            if (end == std::string::npos)
+            {
+                end = path.size();
+            }
+            std::string_view seg(&path[i], end - i);
+            bool slash = end < path.size();
+            if (seg == "..")
+            {
+                if (out == root)
+                {
+                    return false;
+                }
+                // 输出以'/'结尾(或是相对路径的第一段)，退回到上一段的开头
+                out = path.rfind('/', out - 2);
+                out = out == std::string::npos || out < root ? root : out + 1;
+            }
+            else if (seg != ".")
+            {
+                for (size_t k = i; k < end; ++k)
+                {
+                    path[out++] = path[k];
+                }
+                if (slash)
+                {
+                    path[out++] = '/';
+                }
+            }
+            i = end + 1;
+        }
+        path.resize(out);
+        return true;
+    }
+
+    std::string percentEncode(std::string_view str, bool spaceAsPlus)
+    {
+        static const char *hex = "0123456789ABCDEF";
+        std::string res;
+        res.reserve(str.size());
+        for (char c : str)
+        {
+            if (isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' || c == '~')
+            {
+                res.push_back(c);
+            }
+            else if (spaceAsPlus && c == ' ')
+            {
+                res.push_back('+');
+            }
+            else
+            {
+                res.push_back('%');
+                res.push_back(hex[(unsigned char)c >> 4]);
+                res.push_back(hex[(unsigned char)c & 0x0f]);
+            }
+        }
+        return res;
+    }
+
+    void parseQuery(std::string_view query, const std::function<void(std::string &key, std::string &value)> &cb)
+    {
+        std::string key;
+        std::string value;
+        while (!query.empty())
+        {
+            size_t end = query.find('&');
+            std::string_view pair = query.substr(0, end);
+            query = end == std::string_view::npos ? std::string_view() : query.substr(end + 1);
+            size_t eq = pair.find('=');
+            key.assign(pair.substr(0, eq));
+            key.resize(percentDecode(&key[0], key.size(), true));
+            if (key.empty())
+            {
+                continue;
+            }
+            if (eq == std::string_view::npos)
+            {
+                value.clear();
+            }
+            else
+            {
+                value.assign(pair.substr(eq + 1));
+                value.resize(percentDecode(&value[0], value.size(), true));
+            }
+            cb(key, value);
+        }
     }
 
     std::string Formatv(const char *fmt, va_list ap)
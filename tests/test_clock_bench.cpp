@@ -0,0 +1,194 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <csignal>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "TinyWebServer/log.h"
+#include "TinyWebServer/util.h"
+#include "TinyWebServer/configurator.h"
+#include "TinyWebServer/http/httpserver.h"
+
+/**
+ * 比较关闭/开启事件循环时钟缓存(scheduler.clock_cache)时每个请求读取系统时钟的次数
+ * 服务端运行在子进程中，servlet每个请求写一条日志(输出到/dev/null)并设置一个超时定时器，
+ * 读取次数由/reads返回
+ */
+
+static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
+
+static const int CONNECTIONS = 4;
+static const int REQUESTS = 10000;
+/// @brief 每个请求后的间隔，让服务端每个请求都经过一次等待和唤醒(否则单核上客户端总是先发出下一个请求)
+static const int THINK_US = 200;
+
+static int connectServer(int port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    for (int i = 0; i < 500; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+/**
+ * @brief 发送一个请求并读完响应，返回响应体
+ *
+ */
+static bool roundTrip(int fd, const std::string &path, std::string &body)
+{
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+    if (send(fd, request.c_str(), request.size(), 0) != (ssize_t)request.size())
+    {
+        return false;
+    }
+    std::string buf;
+    char tmp[4096];
+    while (true)
+    {
+        ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf.append(tmp, n);
+        size_t end = buf.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+            continue;
+        }
+        size_t pos = buf.find("content-length: ");
+        size_t length = pos == std::string::npos ? 0 : std::stoul(buf.substr(pos + 16));
+        if (buf.size() >= end + 4 + length)
+        {
+            body = buf.substr(end + 4, length);
+            return true;
+        }
+    }
+}
+
+static void runServer(bool cache, int port)
+{
+    WebSrv::Configurator::lookup<bool>("scheduler.clock_cache")->setValue(cache);
+    WebSrv::Logger::ptr logger = SRV_LOGGER_NAME("bench");
+    logger->clearAppender();
+    logger->addAppender(WebSrv::LogAppender::ptr(new WebSrv::FileAppender("/dev/null")));
+    WebSrv::IOManager iom(2, false, "bench");
+    WebSrv::http::HttpServer::ptr server(new WebSrv::http::HttpServer(&iom, &iom, &iom, true));
+    auto dispatch = server->getServletDispatch();
+    dispatch->addServlet("/", [logger](WebSrv::http::HttpRequest::ptr request,
+                                       WebSrv::http::HttpResponse::ptr response,
+                                       WebSrv::http::HttpSession::ptr session)
+                         {
+        // 模拟请求处理中的超时控制
+        auto timer = WebSrv::IOManager::getThis()->addTimer(5000, []() {});
+        SRV_LOG_INFO(logger) << "request " << request->getPath();
+        response->setBody("hello");
+        timer->cannel();
+        return 0; });
+    dispatch->addServlet("/reads", [](WebSrv::http::HttpRequest::ptr request,
+                                      WebSrv::http::HttpResponse::ptr response,
+                                      WebSrv::http::HttpSession::ptr session)
+                         {
+        response->setBody(std::to_string(WebSrv::getClockReads()));
+        return 0; });
+    if (!server->listen(WebSrv::Address::lookupAny("127.0.0.1:" + std::to_string(port))))
+    {
+        _exit(1);
+    }
+    server->start();
+    // 由父进程结束
+    while (true)
+    {
+        pause();
+    }
+}
+
+static void bench(bool cache, int port)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        runServer(cache, port);
+    }
+    std::vector<int> fds;
+    std::string body;
+    for (int i = 0; i < CONNECTIONS; ++i)
+    {
+        int fd = connectServer(port);
+        if (fd < 0 || !roundTrip(fd, "/", body))
+        {
+            SRV_LOG_ERROR(g_logger) << "connect server fail port=" << port;
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            return;
+        }
+        fds.emplace_back(fd);
+    }
+    roundTrip(fds[0], "/reads", body);
+    uint64_t reads = std::stoull(body);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int fd : fds)
+    {
+        threads.emplace_back([fd]()
+                             {
+            std::string body;
+            for (int j = 0; j < REQUESTS / CONNECTIONS; ++j)
+            {
+                if (!roundTrip(fd, "/", body))
+                {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(THINK_US));
+            } });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    roundTrip(fds[0], "/reads", body);
+    reads = std::stoull(body) - reads;
+    SRV_LOG_INFO(g_logger) << "clock_cache=" << cache
+                           << " requests/s=" << (uint64_t)(REQUESTS / seconds)
+                           << " clock reads/request=" << (double)reads / REQUESTS;
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(WebSrv::LogLevel::Info);
+    SRV_LOGGER_NAME("system")->setLevel(WebSrv::LogLevel::Warn);
+    int port = 18180;
+    for (bool cache : {false, true})
+    {
+        bench(cache, port++);
+    }
+    return 0;
+}
@@ -1,3 +1,4 @@
+#include <vector>
 #include "TinyWebServer/fiber.h"
 #include "TinyWebServer/log.h"
 static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
@@ -23,6 +24,37 @@ void testFiber(){
     SRV_LOG_DEBUG(g_logger)<<__func__<<" end";
 }
 
+/**
+ * @brief 协程池复用的协程和新建的协程id唯一且递增
+ *
+ */
+bool testPoolId(){
+    WebSrv::Fiber::getThis();
+    std::vector<WebSrv::Fiber::ptr> fibers;
+    std::vector<uint64_t> ids;
+    std::vector<WebSrv::Fiber *> raws;
+    for (int round = 0; round < 3; ++round)
+    {
+        // 上一轮的协程放回协程池，这一轮先复用池中的再新建
+        fibers.clear();
+        for (int i = 0; i < 4 + round; ++i)
+        {
+            fibers.push_back(WebSrv::Fiber::create(runFiber));
+            ids.push_back(fibers.back()->getId());
+            raws.push_back(fibers.back().get());
+        }
+    }
+    bool ok = true;
+    for (size_t i = 1; i < ids.size(); ++i)
+    {
+        ok = ok && ids[i] > ids[i - 1];
+    }
+    // 确实发生了复用
+    ok = ok && raws[4] == raws[3];
+    SRV_LOG_INFO(g_logger) << "pool id ok=" << ok << " fibers=" << ids.size();
+    return ok;
+}
+
 int main(){
     std::vector<std::thread> threads;
     for(int i=0;i<3;++i){
@@ -31,5 +63,5 @@ int main(){
     for(auto& i:threads){
         i.join();
     }
-    return 0;
+    return testPoolId() ? 0 : 1;
 }
@@ -0,0 +1,74 @@
+#include "TinyWebServer/fiber.h"
+#include "TinyWebServer/log.h"
+#include <chrono>
+#include <ucontext.h>
+static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
+
+static const uint64_t s_rounds = 1000000;
+
+// 协程切换基准测试：一次call+back计两次切换
+static volatile bool s_stop = false;
+void switchLoop()
+{
+    while (!s_stop)
+    {
+        WebSrv::Fiber::getThis()->back();
+    }
+}
+
+void benchFiber()
+{
+    WebSrv::Fiber::getThis();
+    WebSrv::Fiber::ptr fiber(new WebSrv::Fiber(switchLoop, 0, true));
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < s_rounds; ++i)
+    {
+        fiber->call();
+    }
+    auto end = std::chrono::steady_clock::now();
+    s_stop = true;
+    fiber->call();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    SRV_LOG_INFO(g_logger) << "backend=" << WebSrv::fiberContextBackend()
+                           << " switches=" << s_rounds * 2
+                           << " ns/switch=" << ns / (s_rounds * 2);
+}
+
+// 作为对照的裸swapcontext切换
+static ucontext_t s_mainCtx;
+static ucontext_t s_loopCtx;
+void ucontextLoop()
+{
+    for (;;)
+    {
+        swapcontext(&s_loopCtx, &s_mainCtx);
+    }
+}
+
+void benchUcontext()
+{
+    static char stack[64 * 1024];
+    getcontext(&s_loopCtx);
+    s_loopCtx.uc_link = nullptr;
+    s_loopCtx.uc_stack.ss_sp = stack;
+    s_loopCtx.uc_stack.ss_size = sizeof(stack);
+    makecontext(&s_loopCtx, &ucontextLoop, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < s_rounds; ++i)
+    {
+        swapcontext(&s_mainCtx, &s_loopCtx);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    SRV_LOG_INFO(g_logger) << "backend=raw-swapcontext"
+                           << " switches=" << s_rounds * 2
+                           << " ns/switch=" << ns / (s_rounds * 2);
+}
+
+int main()
+{
+    g_logger->setLevel(WebSrv::LogLevel::Info);
+    benchFiber();
+    benchUcontext();
+    return 0;
+}
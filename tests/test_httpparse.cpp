@@ -1,6 +1,426 @@
 #include <iostream>
 #include <cstring>
+#include <string>
+#include <random>
+#include <unistd.h>
 #include "TinyWebServer/http/httpparser.h"
+#include "TinyWebServer/http/httpscan.h"
+#include "TinyWebServer/http/httpbody.h"
+#include "TinyWebServer/util.h"
+
+/**
+ * @brief 逐字节喂给解析器，结果应与一次性解析相同
+ *
+ */
+static bool testIncremental()
+{
+    std::string req = "POST /submit?a=1&b=2 HTTP/1.1\r\n"
+                      "Host: www.example.com\r\n"
+                      "Content-Length:  5 \r\n"
+                      "X-Empty:\r\n"
+                      "Accept: text/html\r\n\r\nhello";
+    WebSrv::http::HttpRequestParser parser;
+    size_t n = 0;
+    size_t len = 0;
+    for (len = 1; len <= req.size() && n == 0; ++len)
+    {
+        n = parser.execute(&req[0], len);
+    }
+    auto data = parser.getData();
+    bool ok = n == req.size() - 5 && parser.isFinished() && parser.getContentLength() == 5 &&
+              data->getMethod() == WebSrv::http::HttpMethod::HTTP_POST && data->getPath() == "/submit" &&
+              data->getParam("b") == "2" && data->getHeaderView("host") == "www.example.com" &&
+              data->getHeader("content-length") == "5" && data->hasHeader("x-empty", nullptr) &&
+              data->getHeaderAs<int>("Content-Length", 0) == 5;
+    // 修改头部后视图被复制到map
+    data->setHeader("Host", "other");
+    ok = ok && data->getHeaderViews().empty() && data->getHeader("host") == "other" && data->getHeaders().size() == 4;
+    std::cout << "incremental ok=" << ok << std::endl;
+    return ok;
+}
+
+/**
+ * @brief 头部视图复制到map后仍持有接收缓冲区，之前取得的视图不失效
+ *
+ */
+static bool testHeaderBuffer()
+{
+    std::string req = "GET / HTTP/1.1\r\n"
+                      "Host: www.example.com\r\n"
+                      "User-Agent: test\r\n\r\n";
+    std::shared_ptr<char> buffer(new char[req.size()], std::default_delete<char[]>());
+    memcpy(buffer.get(), req.data(), req.size());
+    WebSrv::http::HttpRequestParser parser;
+    bool ok = parser.execute(buffer.get(), req.size()) == req.size() && parser.isFinished();
+    auto data = parser.getData();
+    data->setHeaderBuffer(buffer);
+    std::weak_ptr<char> weak = buffer;
+    buffer.reset();
+    std::string_view host = data->getHeaderView("host");
+    ok = ok && data->getHeaders().size() == 2;
+    data->setHeader("Accept", "*/*");
+    ok = ok && !weak.expired() && host == "www.example.com" && data->getHeaderViews().empty();
+    std::cout << "header buffer ok=" << ok << std::endl;
+    return ok;
+}
+
+/**
+ * @brief 格式错误的请求
+ *
+ */
+static bool testReject()
+{
+    struct Case
+    {
+        const char *request;
+        int error;
+    } cases[] = {
+        {"GET / HTTP/1.1\r\nBad Header: x\r\n\r\n", 400},
+        {"GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n", 400},
+        {"GET / HTTP/2.0\r\n\r\n", 505},
+        {"GET / HTTP/1.x\r\n\r\n", 505},
+        {"FOO / HTTP/1.1\r\n\r\n", 405},
+        {"GET  / HTTP/1.1\r\n\r\n", 400},
+        {"GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n", 400},
+        {"GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", 400},
+    };
+    bool ok = true;
+    for (auto &c : cases)
+    {
+        std::string req = c.request;
+        WebSrv::http::HttpRequestParser parser;
+        size_t n = parser.execute(&req[0], req.size());
+        if (n != (size_t)-1 || !parser.hasError() || parser.getError() != c.error)
+        {
+            std::cout << "reject fail: " << c.request << " error=" << parser.getError() << std::endl;
+            ok = false;
+        }
+    }
+    std::cout << "reject ok=" << ok << std::endl;
+    return ok;
+}
+
+/**
+ * @brief url拆分、百分号解码和延迟解析的查询参数
+ *
+ */
+static bool testURL()
+{
+    bool ok = true;
+    WebSrv::URL url;
+    ok = ok && WebSrv::parseURL("http://www.example.com:8080/a%20b/c?x=1&y=%E4%B8%AD#top", url) &&
+         url.protocol == "http" && url.host == "www.example.com:8080" && url.path == "/a%20b/c" &&
+         url.query == "x=1&y=%E4%B8%AD" && url.fragment == "top";
+    ok = ok && WebSrv::parseURL("https://example.com", url) && url.host == "example.com" && url.path.empty();
+    ok = ok && !WebSrv::parseURL("http:///path", url) && !WebSrv::parseURL("example.com/path", url) &&
+         !WebSrv::parseURL("http://example.com/a b", url);
+
+    std::string s = "a%20b+c%zz%4";
+    s.resize(WebSrv::percentDecode(&s[0], s.size(), true));
+    ok = ok && s == "a b c%zz%4";
+    ok = ok && WebSrv::percentEncode("a b&c=中", true) == "a+b%26c%3D%E4%B8%AD";
+
+    std::string req = "GET /files/a%20b.txt?name=tiny+web&empty=&flag&=skip&name=last&q=%E4%B8%AD HTTP/1.1\r\n\r\n";
+    WebSrv::http::HttpRequestParser parser;
+    ok = ok && parser.execute(&req[0], req.size()) == req.size();
+    auto data = parser.getData();
+    // 未访问参数前只保存原始查询串
+    std::string line = data->toString();
+    ok = ok && data->getPath() == "/files/a b.txt" &&
+         line.compare(0, line.find(" HTTP/"), "GET /files/a b.txt?name=tiny+web&empty=&flag&=skip&name=last&q=%E4%B8%AD") == 0;
+    ok = ok && data->getParam("name") == "last" && data->hasParam("empty", nullptr) && data->hasParam("flag", nullptr) &&
+         data->getParam("q") == "中" && data->getParams().size() == 4;
+
+    std::string bad = "GET /a%00b HTTP/1.1\r\n\r\n";
+    parser.reset();
+    ok = ok && parser.execute(&bad[0], bad.size()) == (size_t)-1 && parser.getError() == 400;
+
+    // 点段在解码后移除，不能穿越到上级目录
+    std::string p = "/a/./b/../c/";
+    ok = ok && WebSrv::removeDotSegments(p) && p == "/a/c/";
+    p = "/a/b/..";
+    ok = ok && WebSrv::removeDotSegments(p) && p == "/a/";
+    p = "/a/..";
+    ok = ok && WebSrv::removeDotSegments(p) && p == "/";
+    p = "/a/../..";
+    ok = ok && !WebSrv::removeDotSegments(p);
+    p = "/a/.b/..c";
+    ok = ok && WebSrv::removeDotSegments(p) && p == "/a/.b/..c";
+    struct
+    {
+        const char *request;
+        const char *path;
+    } paths[] = {
+        {"GET /a%2Fb HTTP/1.1\r\n\r\n", "/a/b"},
+        {"GET /static/%2e%2e/secret HTTP/1.1\r\n\r\n", "/secret"},
+        {"GET /static/%2E%2e%2F%2e%2e/secret HTTP/1.1\r\n\r\n", nullptr},
+        {"GET /%2e%2e/etc/passwd HTTP/1.1\r\n\r\n", nullptr},
+        {"GET /../etc/passwd HTTP/1.1\r\n\r\n", nullptr},
+    };
+    for (auto &c : paths)
+    {
+        std::string r = c.request;
+        parser.reset();
+        size_t n = parser.execute(&r[0], r.size());
+        if (c.path)
+        {
+            ok = ok && n == r.size() && parser.getData()->getPath() == c.path;
+        }
+        else
+        {
+            ok = ok && n == (size_t)-1 && parser.getError() == 400;
+        }
+    }
+    std::cout << "url ok=" << ok << std::endl;
+    return ok;
+}
+
+/**
+ * @brief 分块传输编码：解码(整体和逐字节)、传输编码头部检查和响应编码
+ *
+ */
+static bool testChunked()
+{
+    bool ok = true;
+    const std::string body = "4;ext=1\r\nWiki\r\n6\r\npedia \r\nE\nin \r\n\r\nchunks.\n0\r\nExpires: never\r\n\r\nNEXT";
+    const std::string expect = "Wikipedia in \r\n\r\nchunks.";
+    for (size_t step : {body.size(), (size_t)1, (size_t)7})
+    {
+        WebSrv::http::HttpChunkedDecoder decoder;
+        std::string result;
+        size_t consumed = 0;
+        for (size_t i = 0; i < body.size() && !decoder.isFinished(); i += step)
+        {
+            std::string part = body.substr(i, step);
+            size_t decoded = 0;
+            size_t n = decoder.execute(&part[0], part.size(), decoded);
+            if (n == (size_t)-1)
+            {
+                ok = false;
+                break;
+            }
+            result.append(part.data(), decoded);
+            consumed = i + n;
+        }
+        ok = ok && decoder.isFinished() && result == expect && body.substr(consumed) == "NEXT";
+    }
+    for (const char *bad : {"x\r\n", "4\r\nWikiX\r\n", "11111111111111111\r\n", "\r\n"})
+    {
+        std::string s = bad;
+        WebSrv::http::HttpChunkedDecoder decoder;
+        size_t decoded = 0;
+        ok = ok && decoder.execute(&s[0], s.size(), decoded) == (size_t)-1 && decoder.hasError();
+    }
+
+    struct Case
+    {
+        const char *request;
+        int error;
+    } cases[] = {
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n", 0},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", 501},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", 400},
+    };
+    for (auto &c : cases)
+    {
+        std::string req = c.request;
+        WebSrv::http::HttpRequestParser parser;
+        size_t n = parser.execute(&req[0], req.size());
+        ok = ok && (c.error ? n == (size_t)-1 && parser.getError() == c.error : n == req.size() && parser.isChunked());
+    }
+
+    WebSrv::http::HttpResponse rsp;
+    rsp.setChunked(true);
+    rsp.setBody("hello world, hello chunked");
+    std::string s = rsp.toString();
+    WebSrv::http::HttpResponseParser parser;
+    size_t n = parser.execute(&s[0], s.size());
+    size_t decoded = 0;
+    WebSrv::http::HttpChunkedDecoder decoder;
+    ok = ok && n != (size_t)-1 && n > 0 && parser.isChunked() && s.find("content-length") == std::string::npos &&
+         decoder.execute(&s[n], s.size() - n, decoded) == s.size() - n && decoder.isFinished() &&
+         s.substr(n, decoded) == "hello world, hello chunked";
+    std::cout << "chunked ok=" << ok << std::endl;
+    return ok;
+}
+
+/**
+ * @brief 内存中的流，每次最多读出step字节，模拟数据分段到达
+ *
+ */
+class MemoryStream : public WebSrv::Stream
+{
+public:
+    MemoryStream(const std::string &data, size_t step) : _data(data), _step(step) {}
+    int read(void *buffer, size_t len) override
+    {
+        size_t n = std::min({len, _step, _data.size() - _pos});
+        memcpy(buffer, _data.data() + _pos, n);
+        _pos += n;
+        return n;
+    }
+    int read(WebSrv::ByteArray::ptr ba, size_t len) override
+    {
+        std::string buffer(std::min(len, _step), '\0');
+        int n = read(&buffer[0], buffer.size());
+        ba->write(buffer.data(), n);
+        return n;
+    }
+    int write(const void *buffer, size_t len) override
+    {
+        _written.append((const char *)buffer, len);
+        return len;
+    }
+    int write(WebSrv::ByteArray::ptr ba, size_t len) override { return -1; }
+    void close() override {}
+    const std::string &getWritten() const { return _written; }
+
+private:
+    std::string _data;
+    size_t _step;
+    size_t _pos = 0;
+    std::string _written;
+};
+
+/**
+ * @brief 流式读取消息体：缓冲区中的部分和之后从连接分段读到的部分，content-length和分块编码
+ *
+ */
+static bool testBodyReader()
+{
+    using WebSrv::http::HttpBodyReader;
+    bool ok = true;
+    const std::string body = "The quick brown fox jumps over the lazy dog";
+    // 缓冲区：头部 + 消息体开头
+    const std::string head = "HEADERS|";
+    auto makeBuffer = [&](const std::string &received)
+    {
+        std::shared_ptr<char> buffer(new char[head.size() + received.size()], [](char *p)
+                                     { delete[] p; });
+        memcpy(buffer.get(), head.data(), head.size());
+        memcpy(buffer.get() + head.size(), received.data(), received.size());
+        return buffer;
+    };
+
+    // content-length：逐段读取
+    {
+        MemoryStream stream(body.substr(10) + "NEXT", 3);
+        HttpBodyReader reader(&stream, makeBuffer(body.substr(0, 10)), head.size(), head.size() + 10, body.size(), false, 1024);
+        std::string result;
+        char buf[5];
+        int n = 0;
+        while ((n = reader.read(buf, sizeof(buf))) > 0)
+        {
+            result.append(buf, n);
+        }
+        ok = ok && n == 0 && reader.isFinished() && result == body && reader.getReadSize() == body.size();
+    }
+    // content-length：写入ByteArray和文件，期待100-continue
+    {
+        MemoryStream stream(body.substr(4), 7);
+        HttpBodyReader reader(&stream, makeBuffer(body.substr(0, 4)), head.size(), head.size() + 4, body.size(), false, 1024);
+        reader.setExpectContinue(true);
+        WebSrv::ByteArray::ptr ba(new WebSrv::ByteArray(16));
+        ok = ok && reader.readTo(ba) == (int64_t)body.size() && reader.isFinished() &&
+             stream.getWritten() == "HTTP/1.1 100 Continue\r\n\r\n";
+        ba->setPosition(0);
+        ok = ok && ba->toString() == body;
+    }
+    const std::string chunked = "5\r\nThe q\r\n19\r\nuick brown fox jumps over\r\nf;x=1\r\n the lazy dog\r\n\r\n0\r\n\r\n";
+    const std::string chunkedBody = "The quick brown fox jumps over the lazy dog\r\n";
+    // 分块编码：写入文件
+    {
+        MemoryStream stream(chunked.substr(12), 4);
+        HttpBodyReader reader(&stream, makeBuffer(chunked.substr(0, 12)), head.size(), head.size() + 12, 0, true, 1024);
+        FILE *file = tmpfile();
+        std::string result(chunkedBody.size() + 1, '\0');
+        ok = ok && file && reader.readTo(fileno(file)) == (int64_t)chunkedBody.size() && reader.isFinished() &&
+             pread(fileno(file), &result[0], result.size(), 0) == (ssize_t)chunkedBody.size();
+        result.resize(chunkedBody.size());
+        ok = ok && result == chunkedBody;
+        if (file)
+        {
+            fclose(file);
+        }
+    }
+    // 分块编码：整体读取、超过最大长度、丢弃
+    {
+        MemoryStream stream(chunked, 1);
+        HttpBodyReader reader(&stream, makeBuffer(""), head.size(), head.size(), 0, true, 1024);
+        std::string result = "prefix:";
+        ok = ok && reader.readAll(result) == (int64_t)chunkedBody.size() && result == "prefix:" + chunkedBody;
+
+        MemoryStream small(chunked, 8);
+        HttpBodyReader limited(&small, makeBuffer(""), head.size(), head.size(), 0, true, 16);
+        ok = ok && limited.readAll(result) == -1 && limited.hasError();
+
+        MemoryStream skipped(chunked, 8);
+        HttpBodyReader skipper(&skipped, makeBuffer(""), head.size(), head.size(), 0, true, 1024);
+        ok = ok && skipper.skip(10) >= 10 && !skipper.isFinished() && skipper.skip() > 0 && skipper.isFinished();
+    }
+    // 连接提前关闭
+    {
+        MemoryStream stream(body.substr(0, 20), 64);
+        HttpBodyReader reader(&stream, makeBuffer(""), head.size(), head.size(), body.size(), false, 1024);
+        std::string result;
+        ok = ok && reader.readAll(result) == -1 && reader.hasError();
+    }
+    std::cout << "body reader ok=" << ok << std::endl;
+    return ok;
+}
+
+/**
+ * @brief 各个扫描实现在随机数据上的结果与标量实现一致
+ *
+ */
+static bool testKernels()
+{
+    using WebSrv::http::HttpScanner;
+    std::mt19937 rng(12345);
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 2000; ++i)
+    {
+        std::string s(rng() % 100, 'a');
+        for (auto &c : s)
+        {
+            // 大多是可见字符，偶尔出现分隔符、控制字符和高位字符
+            uint32_t r = rng() % 100;
+            c = r < 90 ? (char)(0x21 + rng() % 94) : (char)(rng() % 256);
+        }
+        inputs.emplace_back(s);
+    }
+    std::vector<size_t> expect;
+    HttpScanner::setKernel(HttpScanner::SCALAR);
+    for (auto &s : inputs)
+    {
+        const char *end = s.data() + s.size();
+        expect.emplace_back(HttpScanner::findNonToken(s.data(), end) - s.data());
+        expect.emplace_back(HttpScanner::findControl(s.data(), end) - s.data());
+    }
+    bool ok = true;
+    for (auto kernel : {HttpScanner::SSE42, HttpScanner::AVX2})
+    {
+        if (HttpScanner::setKernel(kernel) != kernel)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            auto &s = inputs[i];
+            const char *end = s.data() + s.size();
+            if ((size_t)(HttpScanner::findNonToken(s.data(), end) - s.data()) != expect[2 * i] ||
+                (size_t)(HttpScanner::findControl(s.data(), end) - s.data()) != expect[2 * i + 1])
+            {
+                ok = false;
+            }
+        }
+        ok = ok && testIncremental() && testReject();
+    }
+    HttpScanner::setKernel(HttpScanner::getBestKernel());
+    std::cout << "kernels ok=" << ok << " best=" << HttpScanner::KernelToString(HttpScanner::getBestKernel()) << std::endl;
+    return ok;
+}
+
 int main(){
     WebSrv::http::HttpRequestParser parse;
     char req[] = "GET /path/to/resource HTTP/1.1\r\n"
@@ -23,4 +443,5 @@ int main(){
     
     parse2.getData()->dump(std::cout);
     std::cout << std::endl;
+    return testIncremental() && testHeaderBuffer() && testReject() && testURL() && testChunked() && testBodyReader() && testKernels() ? 0 : 1;
 }
\ No newline at end of file
@@ -18,6 +18,50 @@ void run(WebSrv::http::HttpServer::ptr httpServer)
                                     response->setBody(request->toString());
                                     return 0;
                                 });
+    // 边生成边发送的响应(http/1.1为分块编码)
+    servletDispatch->addServlet("/stream",
+                                [](WebSrv::http::HttpRequest::ptr request,
+                                   WebSrv::http::HttpResponse::ptr response,
+                                   WebSrv::http::HttpSession::ptr session)
+                                {
+                                    response->setHeader("content-type", "text/plain");
+                                    if (session->sendResponseHeader(response) <= 0)
+                                    {
+                                        return -1;
+                                    }
+                                    for (int i = 0; i < 5; ++i)
+                                    {
+                                        std::string line = "line " + std::to_string(i) + "\n";
+                                        if (session->sendChunk(line.c_str(), line.size()) < 0)
+                                        {
+                                            return -1;
+                                        }
+                                    }
+                                    return 0;
+                                });
+    // 流式读取请求体，只返回长度
+    servletDispatch->addServlet("/upload",
+                                [](WebSrv::http::HttpRequest::ptr request,
+                                   WebSrv::http::HttpResponse::ptr response,
+                                   WebSrv::http::HttpSession::ptr session)
+                                {
+                                    uint64_t size = request->getBody().size();
+                                    if (auto reader = request->getBodyReader())
+                                    {
+                                        char buffer[4096];
+                                        int n = 0;
+                                        while ((n = reader->read(buffer, sizeof(buffer))) > 0)
+                                        {
+                                            size += n;
+                                        }
+                                        if (n < 0)
+                                        {
+                                            return -1;
+                                        }
+                                    }
+                                    response->setBody("size=" + std::to_string(size) + "\n");
+                                    return 0;
+                                });
     servletDispatch->addGlobServlet("/home/*",
                                 [](WebSrv::http::HttpRequest::ptr request,
                                    WebSrv::http::HttpResponse::ptr response,
@@ -0,0 +1,323 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <csignal>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "TinyWebServer/log.h"
+#include "TinyWebServer/configurator.h"
+#include "TinyWebServer/tcpserver.h"
+#include "TinyWebServer/http/httpserver.h"
+
+/**
+ * 比较epoll(每次等待注册/持久注册/连接亲和加SO_REUSEPORT多监听)和io_uring后端的每个请求系统调用次数与吞吐量
+ * 服务端运行在子进程中，统计系统调用时父进程用ptrace跟踪子进程的所有线程
+ */
+
+static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
+
+static const int CONNECTIONS = 4;
+static const int WARMUP = 200;
+static const int REQUESTS = 20000;
+/// @brief 统计系统调用时的请求数和每个请求后的间隔，
+/// ptrace会拖慢服务端，不留间隔时客户端的下一个请求总是先到达，服务端永远不会阻塞等待，计数不真实
+static const int TRACED_REQUESTS = 2000;
+static const int TRACED_THINK_US = 2000;
+static const size_t ECHO_SIZE = 64;
+
+class EchoServer : public WebSrv::TcpServer
+{
+public:
+    using WebSrv::TcpServer::TcpServer;
+
+protected:
+    void handleClient(WebSrv::Socket::ptr client) override
+    {
+        char buf[4096];
+        while (true)
+        {
+            int n = client->recv(buf, sizeof(buf));
+            if (n <= 0 || client->send(buf, n) <= 0)
+            {
+                break;
+            }
+        }
+        client->close();
+    }
+};
+
+static void runServer(bool http, const std::string &backend, bool persistent, bool reusePort, int port)
+{
+    WebSrv::Configurator::lookup<std::string>("iomanager.backend")->setValue(backend);
+    WebSrv::Configurator::lookup<bool>("iomanager.epoll_persistent")->setValue(persistent);
+    WebSrv::IOManager iom(2, false, "bench", reusePort);
+    WebSrv::TcpServer::ptr server;
+    if (http)
+    {
+        WebSrv::http::HttpServer::ptr httpServer(new WebSrv::http::HttpServer(&iom, &iom, &iom, true));
+        httpServer->getServletDispatch()->addServlet("/", [](WebSrv::http::HttpRequest::ptr request,
+                                                             WebSrv::http::HttpResponse::ptr response,
+                                                             WebSrv::http::HttpSession::ptr session)
+                                                     {
+            response->setBody("hello");
+            return 0; });
+        server = httpServer;
+    }
+    else
+    {
+        server.reset(new EchoServer(&iom, &iom, &iom));
+    }
+    server->setReusePort(reusePort);
+    auto addr = WebSrv::Address::lookupAny("127.0.0.1:" + std::to_string(port));
+    if (!server->listen(addr))
+    {
+        _exit(1);
+    }
+    server->start();
+    // 由父进程结束
+    while (true)
+    {
+        pause();
+    }
+}
+
+static int connectServer(int port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    for (int i = 0; i < 500; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+/**
+ * @brief 发送一个请求并读完响应
+ *
+ */
+static bool roundTrip(int fd, bool http, std::string &buf)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+    static const std::string echo(ECHO_SIZE, 'x');
+    const char *data = http ? request : echo.c_str();
+    size_t len = http ? sizeof(request) - 1 : echo.size();
+    if (send(fd, data, len, 0) != (ssize_t)len)
+    {
+        return false;
+    }
+    buf.clear();
+    char tmp[4096];
+    while (true)
+    {
+        ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf.append(tmp, n);
+        if (!http)
+        {
+            if (buf.size() >= ECHO_SIZE)
+            {
+                return true;
+            }
+            continue;
+        }
+        size_t end = buf.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+            continue;
+        }
+        size_t pos = buf.find("content-length: ");
+        size_t length = pos == std::string::npos ? 0 : std::stoul(buf.substr(pos + 16));
+        if (buf.size() >= end + 4 + length)
+        {
+            return true;
+        }
+    }
+}
+
+struct Result
+{
+    double requestsPerSecond = 0;
+    double syscallsPerRequest = 0;
+};
+
+/**
+ * @brief 建立连接预热后执行请求，返回每秒请求数，计数窗口由counter前后快照得到
+ *
+ */
+static double runClients(bool http, int port, int requests, int thinkUs,
+                         const std::atomic<uint64_t> *counter, uint64_t &counted)
+{
+    std::vector<int> fds;
+    std::string buf;
+    for (int i = 0; i < CONNECTIONS; ++i)
+    {
+        int fd = connectServer(port);
+        if (fd < 0 || !roundTrip(fd, http, buf))
+        {
+            SRV_LOG_ERROR(g_logger) << "connect server fail port=" << port;
+            return 0;
+        }
+        fds.emplace_back(fd);
+    }
+    for (int i = 0; i < WARMUP; ++i)
+    {
+        roundTrip(fds[i % CONNECTIONS], http, buf);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t before = counter ? counter->load() : 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < CONNECTIONS; ++i)
+    {
+        threads.emplace_back([fd = fds[i], http, requests, thinkUs]()
+                             {
+            std::string buf;
+            for (int j = 0; j < requests / CONNECTIONS; ++j)
+            {
+                if (!roundTrip(fd, http, buf))
+                {
+                    break;
+                }
+                if (thinkUs)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(thinkUs));
+                }
+            } });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    counted = counter ? counter->load() - before : 0;
+    for (auto fd : fds)
+    {
+        close(fd);
+    }
+    return requests / seconds;
+}
+
+/**
+ * @brief 跟踪子进程所有线程，统计进入系统调用的次数，直到子进程退出
+ *
+ */
+static void traceSyscalls(pid_t pid, std::atomic<uint64_t> &syscalls)
+{
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+    // 每个系统调用停止两次(进入和返回)
+    uint64_t stops = 0;
+    while (true)
+    {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0)
+        {
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            if (tid == pid)
+            {
+                break;
+            }
+            continue;
+        }
+        int sig = 0;
+        if (WIFSTOPPED(status))
+        {
+            int stopSig = WSTOPSIG(status);
+            if (stopSig == (SIGTRAP | 0x80))
+            {
+                syscalls = ++stops / 2;
+            }
+            else if (stopSig != SIGTRAP && stopSig != SIGSTOP)
+            {
+                sig = stopSig;
+            }
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, sig);
+    }
+}
+
+static Result bench(bool http, const std::string &backend, bool persistent, bool reusePort, int port)
+{
+    Result result;
+    // 不跟踪，测吞吐量
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        runServer(http, backend, persistent, reusePort, port);
+    }
+    uint64_t counted = 0;
+    result.requestsPerSecond = runClients(http, port, REQUESTS, 0, nullptr, counted);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    // 跟踪，统计系统调用
+    ++port;
+    pid = fork();
+    if (pid == 0)
+    {
+        ptrace(PTRACE_TRACEME, 0, 0, 0);
+        raise(SIGSTOP);
+        runServer(http, backend, persistent, reusePort, port);
+    }
+    std::atomic<uint64_t> syscalls = 0;
+    std::thread client([&]()
+                       {
+        runClients(http, port, TRACED_REQUESTS, TRACED_THINK_US, &syscalls, counted);
+        kill(pid, SIGKILL); });
+    traceSyscalls(pid, syscalls);
+    client.join();
+    waitpid(pid, nullptr, 0);
+    result.syscallsPerRequest = (double)counted / TRACED_REQUESTS;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(WebSrv::LogLevel::Info);
+    SRV_LOGGER_NAME("system")->setLevel(WebSrv::LogLevel::Warn);
+    int port = 18080;
+    for (bool http : {false, true})
+    {
+        for (const char *backend : {"epoll", "epoll_persistent", "epoll_reuseport", "io_uring"})
+        {
+            bool persistent = strcmp(backend, "epoll_persistent") == 0;
+            bool reusePort = strcmp(backend, "epoll_reuseport") == 0;
+            Result result = bench(http, persistent || reusePort ? "epoll" : backend, persistent, reusePort, port);
+            port += 2;
+            SRV_LOG_INFO(g_logger) << (http ? "http" : "echo") << " backend=" << backend
+                                   << " requests/s=" << (uint64_t)result.requestsPerSecond
+                                   << " syscalls/request=" << result.syscallsPerRequest;
+        }
+    }
+    return 0;
+}
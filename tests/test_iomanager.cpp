@@ -1,14 +1,24 @@
 #include <iostream>
 #include "TinyWebServer/log.h"
 #include "TinyWebServer/iomanager.h"
+#include "TinyWebServer/configurator.h"
+#include "TinyWebServer/util.h"
+#include "TinyWebServer/fdmanager.h"
+#include "TinyWebServer/streams/socketstream.h"
+#include "TinyWebServer/offload.h"
+#include "TinyWebServer/tcpserver.h"
+#include "TinyWebServer/http/httpbody.h"
 #include <sys/socket.h>
 #include <sys/epoll.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <thread>
 #include <chrono>
+#include <map>
+#include <set>
 static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
 
 int sock = 0;
@@ -97,9 +107,814 @@ void testTimeTask()
     std::this_thread::sleep_for(std::chrono::seconds(1));
 }
 
+void testAffinity()
+{
+    WebSrv::IOManager ioManager(3, false, "affinity", true);
+    std::atomic<int> ok = 0;
+    const int count = 8;
+    for (int i = 0; i < count; ++i)
+    {
+        ioManager.schedule([&ok]()
+                           {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            fcntl(fds[0], F_SETFL, O_NONBLOCK);
+            auto threadid = std::this_thread::get_id();
+            WebSrv::IOManager::getThis()->addEvent(fds[0], WebSrv::IOManager::READ);
+            // 在其他线程写入，读事件触发后协程应回到注册时的线程
+            WebSrv::IOManager::getThis()->schedule([fds]()
+                                                   { write(fds[1], "x", 1); });
+            WebSrv::Fiber::yieldToSuspend();
+            if (threadid == std::this_thread::get_id())
+            {
+                ++ok;
+            }
+            close(fds[0]);
+            close(fds[1]); },
+                           ioManager.nextAffinityThread());
+    }
+    ioManager.stop();
+    SRV_LOG_INFO(g_logger) << "affinity ok=" << ok << "/" << count;
+}
+
+class TestTimerManager : public WebSrv::TimerManager
+{
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+/**
+ * @brief 随机时间的定时器(跨越时间轮多层)按时触发，取消的不触发；比较两种实现的添加取消速度
+ *
+ */
+void testTimerWheel()
+{
+    for (bool wheel : {true, false})
+    {
+        WebSrv::Configurator::lookup<bool>("timer.wheel")->setValue(wheel);
+        TestTimerManager manager;
+        const int count = 2000;
+        std::vector<uint64_t> expected(count), fired(count, 0);
+        uint64_t start = WebSrv::getMonotonicMilliseconds();
+        for (int i = 0; i < count; ++i)
+        {
+            uint64_t ms = rand() % 1500;
+            expected[i] = start + ms;
+            auto timer = manager.addTimer(ms, [i, &fired]()
+                                          { fired[i] = WebSrv::getMonotonicMilliseconds(); });
+            if (i % 4 == 0)
+            {
+                timer->cannel();
+                expected[i] = 0;
+            }
+        }
+        int ok = 0;
+        // 和IOManager一样按下一个定时器的时间等待
+        uint64_t next;
+        while ((next = manager.getNextTimer()) != ~0ull)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(next));
+            std::vector<std::function<void()>> cbs;
+            manager.listExpiredCallback(cbs);
+            for (auto &cb : cbs)
+            {
+                cb();
+            }
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            // 取消的不触发，其他的不早于设定时间、延迟不超过20ms
+            if (expected[i] ? (fired[i] >= expected[i] && fired[i] <= expected[i] + 20) : !fired[i])
+            {
+                ++ok;
+            }
+        }
+
+        const int ops = 200000;
+        std::vector<WebSrv::Timer::ptr> timers(ops);
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < ops; ++i)
+        {
+            timers[i] = manager.addTimer(1000 + rand() % 60000, []() {});
+        }
+        for (auto &timer : timers)
+        {
+            timer->cannel();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        SRV_LOG_INFO(g_logger) << (wheel ? "wheel" : "set") << " timer ok=" << ok << "/" << count
+                               << " add+cancel/s=" << (uint64_t)(ops / seconds);
+    }
+    WebSrv::Configurator::lookup<bool>("timer.wheel")->setValue(true);
+}
+
+/**
+ * @brief 带延迟容忍的定时器不早于设定时间、延迟不超过容忍值，合并后唤醒次数减少；
+ * 惰性取消的定时器全部取消后不再有下一个定时器
+ *
+ */
+void testTimerSlack()
+{
+    for (bool wheel : {true, false})
+    {
+        WebSrv::Configurator::lookup<bool>("timer.wheel")->setValue(wheel);
+        for (uint64_t slack : {0, 100})
+        {
+            TestTimerManager manager;
+            const int count = 1000;
+            std::vector<uint64_t> expected(count), fired(count, 0);
+            uint64_t start = WebSrv::getMonotonicMilliseconds();
+            for (int i = 0; i < count; ++i)
+            {
+                uint64_t ms = 500 + rand() % 1000;
+                expected[i] = start + ms;
+                manager.addTimer(ms, [i, &fired]()
+                                 { fired[i] = WebSrv::getMonotonicMilliseconds(); },
+                                 false, slack);
+            }
+            int wakeups = 0;
+            uint64_t next;
+            while ((next = manager.getNextTimer()) != ~0ull)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(next));
+                std::vector<std::function<void()>> cbs;
+                manager.listExpiredCallback(cbs);
+                wakeups += !cbs.empty();
+                for (auto &cb : cbs)
+                {
+                    cb();
+                }
+            }
+            int ok = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                if (fired[i] >= expected[i] && fired[i] <= expected[i] + slack + 20)
+                {
+                    ++ok;
+                }
+            }
+
+            std::vector<WebSrv::Timer::ptr> timers;
+            for (int i = 0; i < count; ++i)
+            {
+                timers.emplace_back(manager.addTimer(60000, []() {}, false, slack));
+            }
+            int cancelled = 0;
+            for (auto &timer : timers)
+            {
+                cancelled += timer->cannel();
+                // 取消过的不能再刷新
+                cancelled -= timer->refresh();
+            }
+            SRV_LOG_INFO(g_logger) << (wheel ? "wheel" : "set") << " slack=" << slack
+                                   << " timer ok=" << ok << "/" << count << " wakeups=" << wakeups
+                                   << " cancelled=" << cancelled << " left=" << manager.hasTimer();
+        }
+    }
+    WebSrv::Configurator::lookup<bool>("timer.wheel")->setValue(true);
+}
+
+/**
+ * @brief 跨页边界的句柄：不存在的页查找不分配，按需分配新页，删除不影响相邻页的句柄
+ *
+ * @param fd 一个socket，复制到页边界两侧的句柄号上
+ */
+bool testFdManagerPages(int fd)
+{
+    auto fdManager = WebSrv::FdManager::getFdManger();
+    // FdManager每页256个句柄，使用第3页和第4页交界处的句柄号
+    const int last = 256 * 4 - 1;
+    const int first = 256 * 4;
+    bool ok = !fdManager->get(first) && !fdManager->get(last);
+    ok = ok && !fdManager->get(-1, true) && !fdManager->get(256 * 4096, true);
+    if (dup2(fd, last) != last || dup2(fd, first) != first)
+    {
+        SRV_LOG_ERROR(g_logger) << "dup2 fail errno=" << errno;
+        return false;
+    }
+    WebSrv::FdCtx *lastCtx = fdManager->get(last, true);
+    WebSrv::FdCtx *firstCtx = fdManager->get(first, true);
+    ok = ok && lastCtx && firstCtx && lastCtx != firstCtx && lastCtx->isSocket() && firstCtx->isSocket();
+    ok = ok && fdManager->get(last) == lastCtx && fdManager->get(first) == firstCtx;
+    uint32_t lastGeneration = lastCtx ? lastCtx->getGeneration() : 0;
+    uint32_t firstGeneration = firstCtx ? firstCtx->getGeneration() : 0;
+    fdManager->del(first);
+    ok = ok && !fdManager->get(first) && fdManager->get(last) == lastCtx && lastCtx->isAlive(lastGeneration) &&
+         !firstCtx->isAlive(firstGeneration);
+    ok = ok && fdManager->get(first, true) == firstCtx && firstCtx->isAlive(firstCtx->getGeneration());
+    fdManager->del(first);
+    fdManager->del(last);
+    ok = ok && !fdManager->get(first) && !fdManager->get(last);
+    close(first);
+    close(last);
+    return ok;
+}
+
+/**
+ * @brief 句柄关闭后槽位被同一句柄号复用，旧的代数失效；测无锁查找的速度
+ *
+ */
+bool testFdManager()
+{
+    auto fdManager = WebSrv::FdManager::getFdManger();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    WebSrv::FdCtx *ctx = fdManager->get(fd, true);
+    uint32_t generation = ctx->getGeneration();
+    bool ok = ctx->isSocket() && ctx->isAlive(generation);
+    fdManager->del(fd);
+    ok = ok && !fdManager->get(fd) && !ctx->isAlive(generation);
+    WebSrv::FdCtx *reused = fdManager->get(fd, true);
+    ok = ok && reused == ctx && reused->isAlive(reused->getGeneration()) && !reused->isAlive(generation);
+    ok = ok && testFdManagerPages(fd);
+
+    const int ops = 10000000;
+    uint64_t found = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i)
+    {
+        found += fdManager->get(fd) != nullptr;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    fdManager->del(fd);
+    close(fd);
+    ok = ok && found == (uint64_t)ops;
+    SRV_LOG_INFO(g_logger) << "fd manager ok=" << ok << " get/s=" << (uint64_t)(ops / seconds);
+    return ok;
+}
+
+/**
+ * @brief 前一半用sendfile、后一半经管道splice发送文件，接收端用splice取出，校验内容；
+ * 对端不读时sendfile按发送超时返回
+ *
+ */
+bool testZeroCopy()
+{
+    char path[] = "/tmp/test_zerocopy_XXXXXX";
+    int fileFd = mkstemp(path);
+    unlink(path);
+    std::string data(4 << 20, 0);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (char)(i * 131 + (i >> 12));
+    }
+    bool ok = write(fileFd, data.data(), data.size()) == (ssize_t)data.size();
+    std::atomic<bool> sendOk = false, recvOk = false, timeoutOk = false, rcvbufOk = false;
+    {
+        WebSrv::IOManager iom(2, false, "zerocopy");
+        iom.schedule([&]()
+                     {
+            auto server = WebSrv::Socket::CreateTCPSocket();
+            server->bind(WebSrv::IPv4Address::create("127.0.0.1", 0));
+            server->listen();
+            auto addr = server->getLocalAddress();
+            iom.schedule([&, addr]()
+                         {
+                auto sock = WebSrv::Socket::CreateTCP(addr);
+                sock->connect(addr);
+                WebSrv::SocketStream stream(sock);
+                int fds[2];
+                pipe(fds);
+                std::string received;
+                char buf[65536];
+                while (received.size() < data.size())
+                {
+                    int64_t n = stream.spliceTo(fds[1], sizeof(buf));
+                    if (n <= 0 || read(fds[0], buf, n) != n)
+                    {
+                        break;
+                    }
+                    received.append(buf, n);
+                }
+                close(fds[0]);
+                close(fds[1]);
+                recvOk = received == data; });
+
+            auto client = server->accept();
+            WebSrv::SocketStream stream(client);
+            size_t half = data.size() / 2;
+            bool ok = stream.sendFile(fileFd, 0, half) == (int64_t)half;
+            int fds[2];
+            pipe(fds);
+            loff_t offset = half;
+            size_t left = data.size() - half;
+            while (ok && left > 0)
+            {
+                ssize_t n = splice(fileFd, &offset, fds[1], nullptr, left, SPLICE_F_MOVE);
+                ok = n > 0 && stream.spliceFrom(fds[0], n) == n;
+                left -= n;
+            }
+            close(fds[0]);
+            close(fds[1]);
+            sendOk = ok;
+
+            // 对端连接后不读，缓冲区写满后等待发送超时，接收缓冲区要在连接前设置才生效
+            auto peer = WebSrv::Socket::CreateTCP(addr);
+            rcvbufOk = peer->bind(WebSrv::IPv4Address::create("127.0.0.1", 0)) &&
+                       peer->setOption(SOL_SOCKET, SO_RCVBUF, 4096);
+            peer->connect(addr);
+            auto idle = server->accept();
+            idle->setOption(SOL_SOCKET, SO_SNDBUF, 4096);
+            idle->setSendTimeout(200);
+            uint64_t begin = WebSrv::getMonotonicMilliseconds();
+            off_t idleOffset = 0;
+            ssize_t n = 0;
+            do
+            {
+                n = idle->sendFile(fileFd, &idleOffset, data.size() - idleOffset);
+            } while (n > 0 && idleOffset < (off_t)data.size());
+            uint64_t elapsed = WebSrv::getMonotonicMilliseconds() - begin;
+            timeoutOk = n == -1 && errno == ETIMEDOUT && elapsed >= 150;
+            peer->close(); });
+    }
+    close(fileFd);
+    ok = ok && sendOk && recvOk && timeoutOk && rcvbufOk;
+    SRV_LOG_INFO(g_logger) << "zero copy ok=" << ok << " send=" << sendOk << " recv=" << recvOk
+                           << " timeout=" << timeoutOk << " rcvbuf=" << rcvbufOk;
+    return ok;
+}
+
+/**
+ * @brief 单个工作线程中一个协程等待卸载的阻塞任务时，其他协程继续运行；
+ * hook的open/pread/getaddrinfo卸载执行，lookup缓存命中时不再解析
+ *
+ */
+/**
+ * @brief 持久注册模式下事件已就绪时，回调形式的addEvent直接调度回调而不是丢弃
+ *
+ */
+bool testReadyCallback()
+{
+    auto persistent = WebSrv::Configurator::lookup<bool>("iomanager.epoll_persistent");
+    bool old = persistent->getValue();
+    persistent->setValue(true);
+    std::atomic<int> readFired = 0, writeFired = 0;
+    int ret = -1;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    {
+        WebSrv::IOManager iom(1, false, "ready");
+        iom.schedule([&]()
+                     {
+            auto iom = WebSrv::IOManager::getThis();
+            // 首次添加时注册读写，可写的边沿没有等待者，记为就绪
+            iom->addEvent(fds[0], WebSrv::IOManager::READ, [&]()
+                          { ++readFired; });
+            usleep(50 * 1000);
+            ret = iom->addEvent(fds[0], WebSrv::IOManager::WRITE, [&]()
+                                { ++writeFired; });
+            ::write(fds[1], "x", 1);
+            usleep(50 * 1000); });
+    }
+    persistent->setValue(old);
+    close(fds[0]);
+    close(fds[1]);
+    bool ok = ret == 0 && writeFired == 1 && readFired == 1;
+    SRV_LOG_INFO(g_logger) << "ready callback ok=" << ok << " ret=" << ret << " write=" << writeFired
+                           << " read=" << readFired;
+    return ok;
+}
+
+/**
+ * @brief io_uring后端关闭句柄时按请求逐个取消，唤醒所有等待在该句柄上的协程(不依赖按句柄取消的新内核特性)
+ *
+ */
+bool testUringClose()
+{
+    auto backend = WebSrv::Configurator::lookup<std::string>("iomanager.backend");
+    std::string old = backend->getValue();
+    backend->setValue("io_uring");
+    const int READERS = 3;
+    std::atomic<int> woken = 0;
+    bool uring = false;
+    uint64_t elapsed = 0;
+    {
+        WebSrv::IOManager iom(1, false, "uring");
+        uring = iom.getBackend() == WebSrv::IOManager::IO_URING;
+        iom.schedule([&]()
+                     {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            WebSrv::FdManager::getFdManger()->get(fds[0], true);
+            for (int i = 0; i < READERS; ++i)
+            {
+                WebSrv::IOManager::getThis()->schedule([&, fd = fds[0]]()
+                                                       {
+                    char buf[16];
+                    if (read(fd, buf, sizeof(buf)) < 0)
+                    {
+                        ++woken;
+                    } });
+            }
+            usleep(100 * 1000);
+            auto start = std::chrono::steady_clock::now();
+            close(fds[0]);
+            for (int i = 0; i < 100 && woken < READERS; ++i)
+            {
+                usleep(10 * 1000);
+            }
+            elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            close(fds[1]); });
+    }
+    backend->setValue(old);
+    bool ok = woken == READERS && elapsed < 1000;
+    SRV_LOG_INFO(g_logger) << "uring close ok=" << ok << " uring=" << uring << " woken=" << woken
+                           << " elapsed=" << elapsed;
+    return ok;
+}
+
+/**
+ * @brief 直接读写句柄的流
+ *
+ */
+class FdStream : public WebSrv::Stream
+{
+public:
+    FdStream(int fd) : _fd(fd) {}
+    int read(void *buffer, size_t len) override { return ::read(_fd, buffer, len); }
+    int read(WebSrv::ByteArray::ptr ba, size_t len) override { return -1; }
+    int write(const void *buffer, size_t len) override { return ::write(_fd, buffer, len); }
+    int write(WebSrv::ByteArray::ptr ba, size_t len) override { return -1; }
+    void close() override {}
+
+private:
+    int _fd;
+};
+
+void testOffload()
+{
+    auto pool = WebSrv::OffloadPool::getInstance();
+    std::atomic<int> ticks = 0;
+    std::atomic<bool> blockOk = false, fileOk = false, lookupOk = false, bodyOk = false;
+    uint64_t offloaded = 0;
+    {
+        WebSrv::IOManager iom(1, false, "offload");
+        iom.schedule([&]()
+                     {
+            // 阻塞300ms期间另一个协程每10ms计数一次
+            int ticksBefore = ticks;
+            int ret = WebSrv::OffloadPool::await([]()
+                                                 {
+                usleep(300 * 1000);
+                errno = EINTR;
+                return 7; });
+            blockOk = ret == 7 && errno == EINTR && ticks - ticksBefore >= 10;
+
+            char path[] = "/tmp/test_offload_XXXXXX";
+            int fd = mkstemp(path);
+            close(fd);
+            uint64_t before = pool->getOffloadCount();
+            fd = open(path, O_RDWR);
+            unlink(path);
+            const char data[] = "offload file io";
+            char buf[sizeof(data)] = {0};
+            fileOk = fd >= 0 && pwrite(fd, data, sizeof(data), 0) == (ssize_t)sizeof(data) &&
+                     pread(fd, buf, sizeof(buf), 0) == (ssize_t)sizeof(buf) &&
+                     memcmp(data, buf, sizeof(data)) == 0 && pool->getOffloadCount() - before >= 2;
+            close(fd);
+
+            WebSrv::Address::clearLookupCache();
+            before = pool->getOffloadCount();
+            auto addr = WebSrv::Address::lookupAnyIPAddress("localhost:80");
+            uint64_t first = pool->getOffloadCount() - before;
+            // 修改返回的地址不影响缓存
+            if (addr)
+            {
+                addr->setPort(81);
+            }
+            auto cached = WebSrv::Address::lookupAnyIPAddress("localhost:80");
+            uint64_t second = pool->getOffloadCount() - before - first;
+            lookupOk = addr && cached && first == 1 && second == 0 && cached->getPort() == 80;
+
+            // 请求体写入普通文件时交给线程池
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            const std::string body(100 * 1024, 'b');
+            std::thread writer([&]()
+                               { send(fds[1], body.data(), body.size(), 0); });
+            FdStream stream(fds[0]);
+            std::shared_ptr<char> buffer(new char[1], [](char *p)
+                                         { delete[] p; });
+            WebSrv::http::HttpBodyReader reader(&stream, buffer, 0, 0, body.size(), false, body.size());
+            char bodyPath[] = "/tmp/test_offload_body_XXXXXX";
+            int file = mkstemp(bodyPath);
+            unlink(bodyPath);
+            before = pool->getOffloadCount();
+            int64_t n = reader.readTo(file);
+            writer.join();
+            std::string written(body.size(), '\0');
+            bodyOk = n == (int64_t)body.size() && pool->getOffloadCount() - before >= 1 &&
+                     pread(file, &written[0], written.size(), 0) == (ssize_t)written.size() && written == body;
+            close(file);
+            close(fds[0]);
+            close(fds[1]); });
+        iom.schedule([&]()
+                     {
+            while (ticks < 30)
+            {
+                ++ticks;
+                usleep(10 * 1000);
+            } });
+    }
+    offloaded = pool->getOffloadCount();
+    SRV_LOG_INFO(g_logger) << "offload ok=" << (blockOk && fileOk && lookupOk && bodyOk) << " block=" << blockOk
+                           << " file=" << fileOk << " lookup=" << lookupOk << " body=" << bodyOk
+                           << " offloaded=" << offloaded;
+}
+
+/**
+ * @brief 连接处理到对端关闭为止，记录同时处理的最大连接数
+ *
+ */
+class HoldServer : public WebSrv::TcpServer
+{
+public:
+    using WebSrv::TcpServer::TcpServer;
+    std::atomic<int> active = 0, peak = 0, served = 0;
+    std::atomic<bool> peerOk = true;
+
+protected:
+    void handleClient(WebSrv::Socket::ptr client) override
+    {
+        int now = ++active;
+        int old = peak;
+        while (now > old && !peak.compare_exchange_weak(old, now))
+        {
+        }
+        // 远端地址由accept4直接得到
+        auto remote = std::dynamic_pointer_cast<WebSrv::IPAddress>(client->getRemoteAddress());
+        if (!remote || remote->getPort() == 0)
+        {
+            peerOk = false;
+        }
+        char buf[64];
+        while (client->recv(buf, sizeof(buf)) > 0)
+        {
+        }
+        client->close();
+        --active;
+        ++served;
+    }
+};
+
+void testAdmission()
+{
+    const int CLIENTS = 6;
+    const int MAX_CONNECTIONS = 2;
+    WebSrv::IOManager iom(2, false, "admission");
+    std::shared_ptr<HoldServer> server(new HoldServer(&iom, &iom, &iom));
+    server->setMaxConnections(MAX_CONNECTIONS);
+    const int port = 18091;
+    bool ok = server->listen(WebSrv::Address::lookupAny("127.0.0.1:" + std::to_string(port)));
+    if (ok)
+    {
+        server->start();
+    }
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    std::vector<int> fds;
+    for (int i = 0; i < CLIENTS && ok; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr *)&sa, sizeof(sa)) == 0)
+        {
+            fds.emplace_back(fd);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+    // 超出上限的连接留在积压队列中
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    bool limited = server->active == MAX_CONNECTIONS && server->getConnectionCount() == MAX_CONNECTIONS;
+    // 关闭的连接让出名额，剩下的连接依次被接收
+    for (auto fd : fds)
+    {
+        close(fd);
+    }
+    for (int i = 0; i < 100 && server->served < (int)fds.size(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ok = ok && fds.size() == CLIENTS && limited && server->served == CLIENTS &&
+         server->peak == MAX_CONNECTIONS && server->peerOk;
+    SRV_LOG_INFO(g_logger) << "admission ok=" << ok << " limited=" << limited << " served=" << server->served
+                           << " peak=" << server->peak << " peer=" << server->peerOk;
+    server->stop();
+    iom.stop();
+}
+
+/**
+ * @brief 记录多监听模式下接收循环和连接处理所在的线程
+ *
+ */
+class ReusePortServer : public WebSrv::TcpServer
+{
+public:
+    using WebSrv::TcpServer::TcpServer;
+    const std::vector<WebSrv::Socket::ptr> &getSocks() const { return _socks; }
+    const std::vector<std::thread::id> &getAcceptThreads() const { return _acceptThreads; }
+    std::mutex mutex;
+    /// @brief 监听句柄 -> 接收循环所在线程
+    std::map<int, std::thread::id> loops;
+    /// @brief 客户端端口 -> 处理连接的线程
+    std::map<uint16_t, std::thread::id> handled;
+    std::atomic<int> running = 0, ended = 0, served = 0;
+
+protected:
+    void startAccept(WebSrv::Socket::ptr sock) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loops[*sock] = std::this_thread::get_id();
+        }
+        ++running;
+        WebSrv::TcpServer::startAccept(sock);
+        ++ended;
+    }
+
+    void handleClient(WebSrv::Socket::ptr client) override
+    {
+        auto remote = std::dynamic_pointer_cast<WebSrv::IPAddress>(client->getRemoteAddress());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            handled[remote ? remote->getPort() : 0] = std::this_thread::get_id();
+        }
+        char buf[64];
+        while (client->recv(buf, sizeof(buf)) > 0)
+        {
+        }
+        client->close();
+        ++served;
+    }
+};
+
+/**
+ * @brief 监听socket的积压队列长度(tcpi_unacked)
+ *
+ */
+static int acceptQueueLength(int fd)
+{
+    tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len))
+    {
+        return -1;
+    }
+    return info.tcpi_unacked;
+}
+
+bool testReusePort()
+{
+    const int THREADS = 3;
+    const int CLIENTS = 30;
+    WebSrv::IOManager iom(THREADS, false, "reuseport");
+    std::shared_ptr<ReusePortServer> server(new ReusePortServer(&iom, &iom, &iom));
+    server->setReusePort(true);
+    bool ok = server->listen(WebSrv::Address::lookupAny("127.0.0.1:0"));
+    // 每个线程一个监听socket，都绑定到同一个端口
+    auto socks = server->getSocks();
+    auto threads = server->getAcceptThreads();
+    auto pool = iom.getPoolThreadIds();
+    std::set<std::thread::id> threadSet(threads.begin(), threads.end());
+    bool listenOk = ok && socks.size() == pool.size() && threadSet.size() == threads.size() &&
+                    threadSet == std::set<std::thread::id>(pool.begin(), pool.end());
+    uint16_t port = 0;
+    for (auto &sock : socks)
+    {
+        auto addr = std::dynamic_pointer_cast<WebSrv::IPAddress>(sock->getLocalAddress());
+        port = port ? port : addr->getPort();
+        listenOk = listenOk && addr->getPort() == port && port != 0;
+    }
+
+    server->start();
+    for (int i = 0; i < 100 && server->running < (int)socks.size(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // 接收循环已挂起在accept上，占住所有线程，连接留在内核分配的监听socket的积压队列中，
+    // 逐个连接并从队列长度的变化得到每个连接由哪个监听socket接收
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::atomic<bool> release = false;
+    std::atomic<int> busy = 0;
+    for (auto &id : pool)
+    {
+        iom.schedule([&]()
+                     {
+            ++busy;
+            while (!release)
+            {
+                std::this_thread::yield();
+            } }, id);
+    }
+    for (int i = 0; i < 100 && busy < (int)pool.size(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    std::vector<int> fds;
+    /// 客户端端口 -> 接收它的监听socket下标
+    std::map<uint16_t, size_t> accepted;
+    std::vector<int> queued(socks.size(), 0);
+    for (int i = 0; i < CLIENTS && listenOk; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr *)&sa, sizeof(sa)))
+        {
+            close(fd);
+            continue;
+        }
+        fds.emplace_back(fd);
+        sockaddr_in local;
+        socklen_t len = sizeof(local);
+        getsockname(fd, (sockaddr *)&local, &len);
+        for (int wait = 0; wait < 100; ++wait)
+        {
+            for (size_t k = 0; k < socks.size() && !accepted.count(ntohs(local.sin_port)); ++k)
+            {
+                int n = acceptQueueLength(*socks[k]);
+                if (n > queued[k])
+                {
+                    queued[k] = n;
+                    accepted[ntohs(local.sin_port)] = k;
+                }
+            }
+            if (accepted.count(ntohs(local.sin_port)))
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    listenOk = listenOk && busy == (int)pool.size() && (int)fds.size() == CLIENTS && (int)accepted.size() == CLIENTS;
+    release = true;
+
+    size_t handled = 0;
+    for (int i = 0; i < 100 && handled < accepted.size(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::lock_guard<std::mutex> lock(server->mutex);
+        handled = server->handled.size();
+    }
+    // 接收循环固定在对应线程，被唤醒后也在该线程接收，连接在接收它的线程处理
+    bool pinOk = server->running == (int)socks.size();
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        for (size_t i = 0; i < socks.size(); ++i)
+        {
+            pinOk = pinOk && server->loops[*socks[i]] == threads[i];
+        }
+        pinOk = pinOk && server->handled.size() == accepted.size();
+        for (auto &[clientPort, index] : accepted)
+        {
+            auto it = server->handled.find(clientPort);
+            pinOk = pinOk && it != server->handled.end() && it->second == threads[index];
+        }
+    }
+
+    for (auto fd : fds)
+    {
+        close(fd);
+    }
+    for (int i = 0; i < 100 && server->served < (int)fds.size(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    server->stop();
+    for (int i = 0; i < 100 && server->ended < server->running; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    bool stopOk = server->served == CLIENTS && server->ended == (int)socks.size();
+    ok = listenOk && pinOk && stopOk;
+    SRV_LOG_INFO(g_logger) << "reuse port ok=" << ok << " listen=" << listenOk << " pin=" << pinOk
+                           << " stop=" << stopOk << " listeners=" << socks.size() << " served=" << server->served
+                           << " ended=" << server->ended;
+    iom.stop();
+    return ok;
+}
+
 int main(int argc, char **argv)
 {
     //test1();
     testTimeTask();
-    return 0;
+    testAffinity();
+    testTimerWheel();
+    testTimerSlack();
+    bool ok = testFdManager();
+    ok = testReadyCallback() && ok;
+    ok = testUringClose() && ok;
+    ok = testZeroCopy() && ok;
+    testOffload();
+    testAdmission();
+    ok = testReusePort() && ok;
+    return ok ? 0 : 1;
 }
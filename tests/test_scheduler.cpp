@@ -1,12 +1,15 @@
 #include "TinyWebServer/scheduler.h"
 #include <thread>
 #include <iostream>
+#include <cstring>
 #include "log.h"
 static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
 
 void testFiber() {
     static int s_count = 5;
-    SRV_LOG_DEBUG(g_logger) << "test in fiber s_count=" << s_count;
+    SRV_LOG_DEBUG(g_logger) << "test in fiber s_count=" << s_count
+                            << " total=" << WebSrv::Fiber::totalFibers()
+                            << " pooled=" << WebSrv::Fiber::pooledFibers();
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
     if(--s_count >= 0) {
@@ -14,6 +17,27 @@ void testFiber() {
     }
 }
 
+void testYield() {
+    SRV_LOG_DEBUG(g_logger) << "test yield fiber id=" << WebSrv::Fiber::getFiberId();
+    WebSrv::Fiber::yieldToReady();
+}
+
+void testSharedStack(int id) {
+    char buf[1024];
+    memset(buf, id, sizeof(buf));
+    for(int i=0;i<3;++i){
+        WebSrv::Fiber::yieldToReady();
+        for(auto c:buf){
+            if(c!=(char)id){
+                SRV_LOG_ERROR(g_logger) << "shared stack corrupted id=" << id;
+                return;
+            }
+        }
+    }
+    SRV_LOG_DEBUG(g_logger) << "shared stack fiber ok id=" << id
+                            << " shared=" << WebSrv::Fiber::getThis()->isSharedStack();
+}
+
 int main(){
     SRV_LOG_DEBUG(g_logger)<<__func__;
     WebSrv::Scheduler sc(3,false);
@@ -21,7 +45,19 @@ int main(){
     std::this_thread::sleep_for(std::chrono::seconds(2));
     SRV_LOG_DEBUG(g_logger)<<"scheduler";
     sc.schedule(&testFiber);
+    for(int i=0;i<10;++i){
+        sc.schedule(&testYield);
+    }
     sc.stop();
-    SRV_LOG_DEBUG(g_logger)<<"end";
+    SRV_LOG_DEBUG(g_logger)<<"end total="<<WebSrv::Fiber::totalFibers()
+                           <<" pooled="<<WebSrv::Fiber::pooledFibers();
+
+    WebSrv::Scheduler shared(2,false,"shared");
+    shared.setSharedStack(true);
+    shared.start();
+    for(int i=1;i<=10;++i){
+        shared.schedule(std::bind(&testSharedStack,i));
+    }
+    shared.stop();
 
 }
\ No newline at end of file
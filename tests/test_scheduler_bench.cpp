@@ -0,0 +1,118 @@
+#include "TinyWebServer/scheduler.h"
+#include "TinyWebServer/log.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+static WebSrv::Logger::ptr g_logger = SRV_LOGGER_NAME("test");
+
+// 统计堆分配次数
+static std::atomic<uint64_t> s_allocs = 0;
+
+void *operator new(size_t size)
+{
+    ++s_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static const uint64_t s_tasks = 500000;
+// 每批任务执行完再添加下一批，测量稳定状态
+static const uint64_t s_batch = 1000;
+static std::atomic<uint64_t> s_done = 0;
+
+struct Payload
+{
+    uint64_t a;
+    uint64_t b;
+    uint64_t c;
+};
+
+void report(const char *name, std::chrono::steady_clock::time_point start, uint64_t allocs)
+{
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    SRV_LOG_INFO(g_logger) << name << " tasks=" << s_tasks
+                           << " tasks/s=" << (uint64_t)(s_tasks / sec)
+                           << " allocs/task=" << (double)allocs / s_tasks;
+}
+
+void waitDone(uint64_t n = s_tasks)
+{
+    while (s_done < n)
+    {
+        std::this_thread::yield();
+    }
+}
+
+// 外部线程添加任务(全局队列)
+void benchExternal(WebSrv::Scheduler &sc)
+{
+    s_done = 0;
+    Payload payload{1, 2, 3};
+    uint64_t allocs = s_allocs;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < s_tasks; ++i)
+    {
+        sc.schedule([payload]()
+                    { s_done += payload.a; });
+        if ((i + 1) % s_batch == 0)
+        {
+            waitDone(i + 1);
+        }
+    }
+    waitDone();
+    report("external", start, s_allocs - allocs);
+}
+
+// 工作线程内添加任务(本地队列+窃取)
+void benchInternal(WebSrv::Scheduler &sc)
+{
+    s_done = 0;
+    uint64_t allocs = s_allocs;
+    auto start = std::chrono::steady_clock::now();
+    sc.schedule([]()
+                {
+        Payload payload{1, 2, 3};
+        for (uint64_t i = 0; i < s_tasks; ++i)
+        {
+            WebSrv::Scheduler::getThis()->schedule([payload]()
+                                                   { s_done += payload.a; });
+            if ((i + 1) % s_batch == 0)
+            {
+                // 让出执行权等待这一批执行完
+                while (s_done < i + 1)
+                {
+                    WebSrv::Fiber::yieldToReady();
+                }
+            }
+        } });
+    waitDone();
+    report("internal", start, s_allocs - allocs);
+}
+
+int main()
+{
+    g_logger->setLevel(WebSrv::LogLevel::Info);
+    // 基类Scheduler::tickle每次都会打印日志
+    SRV_LOGGER_NAME("system")->setLevel(WebSrv::LogLevel::Warn);
+    WebSrv::Scheduler sc(2, false, "bench");
+    sc.start();
+    benchExternal(sc);
+    benchInternal(sc);
+    sc.stop();
+    return 0;
+}